@@ -0,0 +1,98 @@
+#include "Animation.h"
+#include "FrameDisplay.h"
+#include "Functions.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+void Animation::addCameraKey(double time, const Point &location,
+                             const Point &lookingAt) {
+  const CameraKey key = {time, location, lookingAt};
+  auto next = std::upper_bound(
+      keys.begin(), keys.end(), time,
+      [](double t, const CameraKey &k) { return t < k.time; });
+  keys.insert(next, key);
+}
+
+void Animation::cameraAt(double time, Point &location,
+                         Point &lookingAt) const {
+  if (keys.empty())
+    return;
+  if (time <= keys.front().time) {
+    location = keys.front().location;
+    lookingAt = keys.front().lookingAt;
+    return;
+  }
+  if (time >= keys.back().time) {
+    location = keys.back().location;
+    lookingAt = keys.back().lookingAt;
+    return;
+  }
+
+  // The first key after the time
+  auto next = std::upper_bound(
+      keys.begin(), keys.end(), time,
+      [](double t, const CameraKey &k) { return t < k.time; });
+  auto previous = next - 1;
+  const float f = (time - previous->time) / (next->time - previous->time);
+  location = add(previous->location,
+                 scale(f, sub(next->location, previous->location)));
+  lookingAt = add(previous->lookingAt,
+                  scale(f, sub(next->lookingAt, previous->lookingAt)));
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+bool Animation::render(Scene &s, int first, int last, int passes,
+                       const char *prefix) const {
+  double totalSeconds = 0;
+  double bvhSeconds = 0;
+  int refits = 0;
+
+  printf("frame   bvh            render     total\n");
+  for (int frame = first; frame <= last; frame++) {
+    const auto start = std::chrono::steady_clock::now();
+    const double time = frame * frameLength;
+    if (!keys.empty()) {
+      Point location, lookingAt;
+      cameraAt(time, location, lookingAt);
+      s.camera.changeLocation(location);
+      s.camera.changeView(lookingAt);
+    }
+    s.shutterOpen = time;
+    s.shutterClose = time + shutter * frameLength;
+
+    const bool refit = s.updateBVH();
+    const double bvhTime = secondsSince(start);
+    refits += refit;
+    bvhSeconds += bvhTime;
+
+    // Every frame uses the same sequences of samples, so the noise stays put
+    // instead of flickering
+    s.resetAccumulation();
+    s.passIndex = 0;
+    for (int i = 0; i < passes; i++)
+      s.render();
+
+    char name[1024];
+    snprintf(name, sizeof(name), "%s%04d.bmp", prefix, frame);
+    if (!FrameDisplay::save(s, name))
+      return false;
+
+    const double frameTime = secondsSince(start);
+    totalSeconds += frameTime;
+    printf("%5d %7.2fms %-7s %8.3fs %8.3fs\n", frame, 1000 * bvhTime,
+           refit ? "refit" : "rebuild", frameTime - bvhTime, frameTime);
+  }
+
+  const int frames = last - first + 1;
+  if (frames > 0)
+    printf("%d frames in %.3fs, %d refit, %.2fms per BVH update\n", frames,
+           totalSeconds, refits, 1000 * bvhSeconds / frames);
+  return true;
+}
@@ -0,0 +1,46 @@
+#ifndef _ANIMATION_H
+#define _ANIMATION_H
+
+#include <vector>
+
+#include "Point.h"
+#include "Scene.h"
+
+// Where the camera is and what it looks at at a moment in time
+struct CameraKey {
+  double time;
+  Point location;
+  Point lookingAt;
+};
+
+// Renders a scene as a numbered sequence of images. Objects move with the
+// scene's own time (MovingSphere, KeyframedTransform...), frame i starting at
+// time i * frameLength, and the camera follows its keys. Between frames the
+// BVH is refit rather than rebuilt while the objects stay the same.
+class Animation {
+public:
+  // Keys don't need to be added in order. Without any the camera is left
+  // where it is.
+  void addCameraKey(double time, const Point &location,
+                    const Point &lookingAt);
+
+  // Camera position at a time, interpolated linearly between keys and held
+  // outside of them
+  void cameraAt(double time, Point &location, Point &lookingAt) const;
+
+  // Renders frames first to last with passes render() calls each, and writes
+  // them to prefix0000.bmp, prefix0001.bmp... Prints how long each frame and
+  // its BVH update took. Returns false if a frame couldn't be saved.
+  bool render(Scene &s, int first, int last, int passes,
+              const char *prefix) const;
+
+  // Scene time between the start of two frames
+  double frameLength = 1;
+  // Fraction of a frame the shutter is open for, 0 for no motion blur
+  double shutter = 0.5;
+
+private:
+  std::vector<CameraKey> keys;
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef _AOV_H
+#define _AOV_H
+
+#include <cstring>
+
+// Arbitrary output variables: images rendered alongside the beauty image for
+// compositing. Direct, indirect and emission split the radiance by how many
+// bounces it took to reach the camera and add up to it; the rest describe
+// what each pixel's camera rays hit first.
+enum AovPass {
+  // Light reaching the camera after one bounce
+  AOV_DIRECT,
+  // Light reaching the camera after two bounces or more
+  AOV_INDIRECT,
+  // Emission and background seen straight from the camera
+  AOV_EMISSION,
+  AOV_ALBEDO,
+  AOV_NORMAL,
+  // Distance from the camera
+  AOV_DEPTH,
+  // The index of the object among the scene's objects, -1 for none. Not
+  // averaged: the last pass's first sample decides.
+  AOV_OBJECT_ID,
+  AOV_COUNT
+};
+
+inline unsigned int aovBit(AovPass pass) { return 1u << pass; }
+
+// The passes that split the radiance, which need more bookkeeping along the
+// whole path than the ones decided at the first hit
+static const unsigned int AOV_LIGHTING =
+    (1u << AOV_DIRECT) | (1u << AOV_INDIRECT) | (1u << AOV_EMISSION);
+
+inline int aovChannels(AovPass pass) {
+  return pass == AOV_DEPTH || pass == AOV_OBJECT_ID ? 1 : 3;
+}
+
+inline const char *aovName(AovPass pass) {
+  static const char *const NAMES[AOV_COUNT] = {
+      "direct", "indirect", "emission", "albedo", "normal", "depth", "id"};
+  return NAMES[pass];
+}
+
+// The pass called name, or AOV_COUNT if there is none
+inline AovPass aovFromName(const char *name) {
+  for (int p = 0; p < AOV_COUNT; p++)
+    if (strcmp(name, aovName((AovPass)p)) == 0)
+      return (AovPass)p;
+  return AOV_COUNT;
+}
+
+#endif
@@ -0,0 +1,85 @@
+#include "Arena.h"
+
+#include <cstdint>
+#include <cstdio>
+
+Arena::Arena(size_t blockSize) : blockSize(blockSize) {}
+
+Arena::~Arena() { release(); }
+
+Arena::Arena(Arena &&other)
+    : blockSize(other.blockSize), blocks(std::move(other.blocks)),
+      destructors(std::move(other.destructors)),
+      allocationCount(other.allocationCount), usedBytes(other.usedBytes) {
+  other.blocks.clear();
+  other.destructors.clear();
+  other.allocationCount = 0;
+  other.usedBytes = 0;
+}
+
+Arena &Arena::operator=(Arena &&other) {
+  if (this != &other) {
+    release();
+    blockSize = other.blockSize;
+    blocks = std::move(other.blocks);
+    destructors = std::move(other.destructors);
+    allocationCount = other.allocationCount;
+    usedBytes = other.usedBytes;
+    other.blocks.clear();
+    other.destructors.clear();
+    other.allocationCount = 0;
+    other.usedBytes = 0;
+  }
+  return *this;
+}
+
+void *Arena::allocate(size_t bytes, size_t align) {
+  allocationCount++;
+  usedBytes += bytes;
+
+  // Bump the pointer inside the newest block if the object fits
+  if (!blocks.empty()) {
+    Block &b = blocks.back();
+    uintptr_t start = reinterpret_cast<uintptr_t>(b.data) + b.used;
+    size_t padding = (align - start % align) % align;
+    if (b.used + padding + bytes <= b.size) {
+      b.used += padding + bytes;
+      return b.data + b.used - bytes;
+    }
+  }
+
+  // Otherwise start a new block. Objects bigger than a block get their own.
+  size_t size = bytes + align > blockSize ? bytes + align : blockSize;
+  Block b{static_cast<char *>(::operator new(size)), size, 0};
+  uintptr_t start = reinterpret_cast<uintptr_t>(b.data);
+  size_t padding = (align - start % align) % align;
+  b.used = padding + bytes;
+  blocks.push_back(b);
+  return b.data + padding;
+}
+
+void Arena::release() {
+  for (auto it = destructors.rbegin(); it != destructors.rend(); ++it)
+    it->fn(it->obj);
+  destructors.clear();
+
+  for (Block &b : blocks)
+    ::operator delete(b.data);
+  blocks.clear();
+
+  allocationCount = 0;
+  usedBytes = 0;
+}
+
+size_t Arena::bytesReserved() const {
+  size_t total = 0;
+  for (const Block &b : blocks)
+    total += b.size;
+  return total;
+}
+
+void Arena::report(const char *name) const {
+  printf("%s: %zu allocations, %zu bytes used, %zu bytes reserved in %zu "
+         "blocks\n",
+         name, allocationCount, usedBytes, bytesReserved(), blocks.size());
+}
@@ -0,0 +1,77 @@
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A bump allocator that owns everything a scene is built from (hittables,
+// materials, textures and BVH nodes). Objects are placed back to back in large
+// blocks, so objects created together sit together in memory, and the whole
+// scene is torn down at once with release().
+class Arena {
+public:
+  Arena(size_t blockSize = 64 * 1024);
+
+  ~Arena();
+
+  Arena(Arena &&other);
+
+  Arena &operator=(Arena &&other);
+
+  Arena(const Arena &) = delete;
+
+  Arena &operator=(const Arena &) = delete;
+
+  // Constructs a T inside the arena. Its destructor is run by release() if it
+  // has one that does anything.
+  template <class T, class... Args> T *make(Args &&...args) {
+    void *mem = allocate(sizeof(T), alignof(T));
+    T *obj = new (mem) T(std::forward<Args>(args)...);
+    if (!std::is_trivially_destructible<T>::value)
+      destructors.push_back(Destructor{obj, &destroy<T>});
+    return obj;
+  }
+
+  // Returns uninitialised memory that lives until release() is called.
+  void *allocate(size_t bytes, size_t align = alignof(std::max_align_t));
+
+  // Destroys every object (newest first) and frees all of the blocks.
+  void release();
+
+  size_t allocations() const { return allocationCount; }
+
+  // Bytes handed out to objects, not counting alignment padding
+  size_t bytesUsed() const { return usedBytes; }
+
+  // Bytes held in blocks
+  size_t bytesReserved() const;
+
+  // Prints the allocation count and byte totals
+  void report(const char *name) const;
+
+private:
+  struct Block {
+    char *data;
+    size_t size;
+    size_t used;
+  };
+
+  struct Destructor {
+    void *obj;
+    void (*fn)(void *);
+  };
+
+  template <class T> static void destroy(void *p) { static_cast<T *>(p)->~T(); }
+
+  size_t blockSize;
+  std::vector<Block> blocks;
+  std::vector<Destructor> destructors;
+
+  size_t allocationCount = 0;
+  size_t usedBytes = 0;
+};
+
+#endif
@@ -14,7 +14,7 @@
 // respect to the axis. Future: determine a better way to divide objects.
 // Octrees/k-d trees would be applicable I think?
 BVHNode::BVHNode(const std::vector<Hittable *> &objects, size_t start,
-                 size_t end, double t0, double t1) {
+                 size_t end, double t0, double t1, Arena &arena) {
   std::vector<Hittable *> objs =
       objects; // can now modify objects - it will modify objects (despite
                // const), as these are references
@@ -56,8 +56,8 @@ BVHNode::BVHNode(const std::vector<Hittable *> &objects, size_t start,
     size_t mid = start + size / 2;
 
     // Recursively define children nodes
-    left = new BVHNode(objs, start, mid, t0, t1);
-    right = new BVHNode(objs, mid, end, t0, t1);
+    left = arena.make<BVHNode>(objs, start, mid, t0, t1, arena);
+    right = arena.make<BVHNode>(objs, mid, end, t0, t1, arena);
   }
 
   aabb leftBox, rightBox;
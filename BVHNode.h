@@ -5,6 +5,7 @@
 #include <algorithm>
 
 #include "Hittable.h"
+#include "./Arena.h"
 #include "./Ray.h"
 #include "./aabb.h"
 #include "./Functions.h"
@@ -14,11 +15,12 @@
         public:
         BVHNode();
 
-        BVHNode(const HittableList &list, double t0, double t1) : BVHNode(list.objects, 0, list.objects.size(), t0, t1) {}
+        BVHNode(const HittableList &list, double t0, double t1, Arena &arena) : BVHNode(list.objects, 0, list.objects.size(), t0, t1, arena) {}
 
         // Divides a list of objects into several bounding boxes. It does this by randomly selecting an axis to divide and then sorting the objects with respect to the axis.
         // Future: determine a better way to divide objects. Octrees/k-d trees would be applicable I think?
-        BVHNode(const std::vector<Hittable *> &objects, size_t start, size_t end, double t0, double t1);
+        // Child nodes are placed in arena.
+        BVHNode(const std::vector<Hittable *> &objects, size_t start, size_t end, double t0, double t1, Arena &arena);
 
         virtual bool hit(const Ray &r, hitRecord &rec, double tMin, double tMax) const override;
 
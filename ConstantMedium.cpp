@@ -1,63 +1,103 @@
 #include "ConstantMedium.h"
 #include "Hittable.h"
-#include "RandomGenerator.h"
 #include "Textures/Texture.h"
 #include "Point.h"
 #include "aabb.h"
 #include "Functions.h"
 
+#include <cmath>
+
 ConstantMedium::ConstantMedium(Hittable *hittablePtr, double d,
-                               Texture *texturePtr) {
+                               Texture *texturePtr)
+    : phase(texturePtr) {
   boundary = hittablePtr;
   negativeInvertedDensity = -1 / d;
-  phaseFunction = new Isotropic(texturePtr);
+  phaseFunction = &phase;
+  hasBox = boundary->boundingBox(0, 1, box);
 }
 
-ConstantMedium::ConstantMedium(Hittable *hittablePtr, double d, Point &col) {
+ConstantMedium::ConstantMedium(Hittable *hittablePtr, double d, Point &col)
+    : phase(col) {
   boundary = hittablePtr;
   negativeInvertedDensity = -1 / d;
-  phaseFunction = new Isotropic(col);
+  phaseFunction = &phase;
+  hasBox = boundary->boundingBox(0, 1, box);
 }
 
-bool ConstantMedium::hit(const Ray &r, hitRecord &rec, double tMin,
-                         double tMax) const {
+bool ConstantMedium::inside(const Ray &r, double tMin, double tMax,
+                            double &tIn, double &tOut) const {
+  if (hasBox) {
+    double t0 = tMin, t1 = tMax;
+    if (!box.clip(r, t0, t1))
+      return false;
+  }
 
   // The hit going in and out of the boundary
   hitRecord rec1, rec2;
+  if (!boundary->hit(r, rec1, DBL_NEG_INF, DBL_INF))
+    return false;
+  double enter = rec1.t;
+  double leave;
+  if (boundary->hit(r, rec2, rec1.t + 0.0001, DBL_INF)) {
+    leave = rec2.t;
+  } else {
+    // Primitives don't report hits behind the ray's origin, so a single hit
+    // means the ray starts inside (scattered in the medium, or from a
+    // surface it contains)
+    enter = 0;
+    leave = rec1.t;
+  }
 
-  // 
-  if(!boundary->hit(r, rec1, DBL_NEG_INF, DBL_INF)) return false;
-  if(!boundary->hit(r, rec2, rec1.t + 0.0001, DBL_INF)) return false;
-
-  // The total time is stretched to match the time the ray has spent inside the medium
-  if(rec1.t < tMin) rec1.t = tMin;
-  if(rec2.t > tMax) rec2.t = tMax;
+  // The total time is stretched to match the time the ray has spent inside
+  // the medium
+  tIn = std::fmax(std::fmax(enter, tMin), 0.0);
+  tOut = std::fmin(leave, tMax);
+  return tIn < tOut;
+}
 
-  // Impossible or edge case
-  if(rec1.t >= rec2.t) return false;
+bool ConstantMedium::hit(const Ray &r, hitRecord &rec, double tMin,
+                         double tMax) const {
+  // Shadow rays are attenuated by transmittance() instead
+  if (r.shadow)
+    return false;
 
-  // If the time is negative
-  if(rec1.t < 0) rec1.t = 0;
+  double tIn, tOut;
+  if (!inside(r, tMin, tMax, tIn, tOut))
+    return false;
 
   // Length of the ray
   const float rayLength = length(r.direction);
   // Distance that it travels inside the boundary
-  const float distanceInsideBoundary = (rec2.t - rec1.t) * rayLength;
+  const float distanceInsideBoundary = (tOut - tIn) * rayLength;
   // - 1/d * log(rand(0, 1))
-  // Lower density means higher probability that the medium will pass straight through
-  const float hitDistance = negativeInvertedDensity * log(joetracer::randomOne());
+  // Lower density means higher probability that the medium will pass straight
+  // through. Rays that don't belong to a path have no sampler and get the
+  // median distance.
+  const float u = r.sampler ? 1 - r.sampler->next() : 0.5f;
+  const float hitDistance = negativeInvertedDensity * log(u);
 
   if(hitDistance > distanceInsideBoundary) return false;
 
-  rec.t = rec1.t + hitDistance / rayLength;
+  rec.t = tIn + hitDistance / rayLength;
   rec.p = r.pointAtTime(rec.t);
 
   rec.normal = Vec(1, 0, 0); // arbitrary
+  rec.dpdu = rec.dpdv = Vec(0, 0, 0);
+  rec.dndu = rec.dndv = Vec(0, 0, 0);
   rec.matPtr = phaseFunction;
 
   return true;
 }
 
+double ConstantMedium::transmittance(const Ray &r, double tMin, double tMax,
+                                     Sampler &sampler) const {
+  double tIn, tOut;
+  if (!inside(r, tMin, tMax, tIn, tOut))
+    return 1;
+  return std::exp((tOut - tIn) * length(r.direction) /
+                  negativeInvertedDensity);
+}
+
 bool ConstantMedium::boundingBox(double t0, double t1, aabb &outputBox) const {
   return boundary->boundingBox(t0, t1, outputBox);
 }
@@ -19,10 +19,25 @@ public:
   bool boundingBox(double t0, double t1,
                            aabb &outputBox) const override;
 
+  bool participating() const override { return true; }
+
+  // exp(-density * distance) over the part of the ray inside the boundary
+  double transmittance(const Ray &r, double tMin, double tMax,
+                       Sampler &sampler) const override;
+
+  // Where the ray enters and leaves the boundary, clamped to tMin and tMax.
+  // False if it doesn't spend any time inside.
+  bool inside(const Ray &r, double tMin, double tMax, double &tIn,
+              double &tOut) const;
+
   // The fog
+  Isotropic phase;
   Materials *phaseFunction;
   // The boundary between the medium and outside
   Hittable *boundary;
+  // The boundary's box, to turn most rays away without intersecting it
+  bool hasBox;
+  aabb box;
   double negativeInvertedDensity;
 };
 
@@ -0,0 +1,218 @@
+#include "Denoiser.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+// The 5 taps of the cubic B-spline, which the filter spreads apart
+static const float KERNEL[5] = {1 / 16.0f, 1 / 4.0f, 3 / 8.0f, 1 / 4.0f,
+                                1 / 16.0f};
+
+static inline float luminance(float r, float g, float b) {
+  return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+}
+
+void Denoiser::load(const Scene &s) {
+  width = s.getWidth();
+  height = s.getHeight();
+  const size_t count = (size_t)width * height;
+  for (int b = 0; b < 2; b++) {
+    for (int c = 0; c < 3; c++)
+      colour[b][c].resize(count);
+    variance[b].resize(count);
+  }
+  for (int c = 0; c < 3; c++) {
+    albedo[c].resize(count);
+    normal[c].resize(count);
+  }
+  depth.resize(count);
+  valid.resize(count);
+
+  const bool features = s.featureSamples.size() == count;
+  const float *sums = features ? s.featureSums.data() : nullptr;
+#pragma omp parallel for schedule(static)
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      const size_t i = (size_t)y * width + x;
+      const unsigned int n = s.pixelSamples[i];
+      for (int c = 0; c < 3; c++)
+        colour[0][c][i] = n > 0 ? (float)(s.raw[i * 3 + c] / n) : 0.0f;
+      const unsigned int m = features ? s.featureSamples[i] : 0;
+      valid[i] = n > 0 && m > 0 ? 1.0f : 0.0f;
+      if (valid[i] == 0) {
+        for (int c = 0; c < 3; c++)
+          albedo[c][i] = normal[c][i] = 0;
+        depth[i] = 1;
+        variance[0][i] = 0;
+        continue;
+      }
+
+      const float *f = sums + i * FEATURE_CHANNELS;
+      const float nx = f[FEATURE_NORMAL], ny = f[FEATURE_NORMAL + 1],
+                  nz = f[FEATURE_NORMAL + 2];
+      // Edges average normals apart, shortening them
+      const float norm = std::sqrt(nx * nx + ny * ny + nz * nz);
+      const float toUnit = norm > 0 ? 1 / norm : 0;
+      for (int c = 0; c < 3; c++)
+        albedo[c][i] = f[FEATURE_ALBEDO + c] / m;
+      normal[0][i] = nx * toUnit;
+      normal[1][i] = ny * toUnit;
+      normal[2][i] = nz * toUnit;
+      depth[i] = f[FEATURE_DEPTH] / m;
+
+      // The variance of the samples, pooled over the pixel and its
+      // neighbours so that a pixel with one sample has one too, over the
+      // number of samples in the pixel's mean
+      float sum = 0, squares = 0, total = 0;
+      for (int yy = std::max(0, y - 1); yy <= std::min(height - 1, y + 1);
+           yy++)
+        for (int xx = std::max(0, x - 1); xx <= std::min(width - 1, x + 1);
+             xx++) {
+          const size_t j = (size_t)yy * width + xx;
+          sum += sums[j * FEATURE_CHANNELS + FEATURE_LUMINANCE];
+          squares += sums[j * FEATURE_CHANNELS + FEATURE_LUMINANCE_SQUARED];
+          total += s.featureSamples[j];
+        }
+      const float mean = sum / total;
+      variance[0][i] = std::max(0.0f, squares / total - mean * mean) / n;
+    }
+  }
+}
+
+// Where the filter reads its input, one plane per channel
+struct Planes {
+  const float *r, *g, *b, *v;
+  const float *ar, *ag, *ab;
+  const float *nx, *ny, *nz;
+  const float *z, *ok;
+};
+
+// The weighted sums of a row, and per pixel of the row how far its depth may
+// be from a neighbour's
+struct RowSums {
+  std::vector<float> w, r, g, b, v;
+  std::vector<float> invDepth;
+
+  explicit RowSums(int width)
+      : w(width), r(width), g(width), b(width), v(width), invDepth(width) {}
+};
+
+// Adds the tap of weight k that is offset pixels along the row above or
+// below, tap, for the pixels of row in [x0, x1)
+static void addTap(const Planes &in, ptrdiff_t row, ptrdiff_t tap, int x0,
+                   int x1, float k, float invDistance, float normalPower,
+                   float invAlbedo, float colourSigma, RowSums &sums) {
+  const float *r = in.r, *g = in.g, *b = in.b, *v = in.v;
+  const float *ar = in.ar, *ag = in.ag, *ab = in.ab;
+  const float *nx = in.nx, *ny = in.ny, *nz = in.nz;
+  const float *z = in.z, *ok = in.ok;
+  const float *invDepth = sums.invDepth.data();
+  float *sumW = sums.w.data(), *sumR = sums.r.data(), *sumG = sums.g.data(),
+        *sumB = sums.b.data(), *sumV = sums.v.data();
+  // Too many planes for the compiler to prove they don't overlap
+#pragma omp simd
+  for (int x = x0; x < x1; x++) {
+    const ptrdiff_t i = row + x;
+    const ptrdiff_t j = tap + x;
+    const float dl = std::fabs(luminance(r[i], g[i], b[i]) -
+                               luminance(r[j], g[j], b[j]));
+    const float dar = ar[i] - ar[j], dag = ag[i] - ag[j], dab = ab[i] - ab[j];
+    const float cosine = nx[i] * nx[j] + ny[i] * ny[j] + nz[i] * nz[j];
+    // Held to the noise of the quieter of the two, so a pixel that is noisy
+    // because it straddles an edge doesn't take in the flat side
+    const float sigma = colourSigma * std::sqrt(std::min(v[i], v[j])) + 1e-4f;
+    // All the weights but the kernel's as one exponential
+    const float exponent = normalPower * std::log(std::max(cosine, 1e-4f)) -
+                           dl / sigma -
+                           std::fabs(z[i] - z[j]) * invDepth[x] * invDistance -
+                           (dar * dar + dag * dag + dab * dab) * invAlbedo;
+    const float w = k * ok[j] * std::exp(exponent);
+    sumW[x] += w;
+    sumR[x] += w * r[j];
+    sumG[x] += w * g[j];
+    sumB[x] += w * b[j];
+    sumV[x] += w * w * v[j];
+  }
+}
+
+void Denoiser::filter(int from, int step, const DenoiseSettings &settings) {
+  const int to = 1 - from;
+  const float invAlbedo = 1 / (settings.albedoSigma * settings.albedoSigma);
+  const Planes in = {colour[from][0].data(), colour[from][1].data(),
+                     colour[from][2].data(), variance[from].data(),
+                     albedo[0].data(),       albedo[1].data(),
+                     albedo[2].data(),       normal[0].data(),
+                     normal[1].data(),       normal[2].data(),
+                     depth.data(),           valid.data()};
+  float *outR = colour[to][0].data(), *outG = colour[to][1].data(),
+        *outB = colour[to][2].data(), *outV = variance[to].data();
+#pragma omp parallel
+  {
+    RowSums sums(width);
+
+#pragma omp for schedule(static)
+    for (int y = 0; y < height; y++) {
+      const ptrdiff_t row = (ptrdiff_t)y * width;
+      // The centre tap counts whatever the pixel's features
+      const float centre = KERNEL[2] * KERNEL[2];
+      for (int x = 0; x < width; x++) {
+        const ptrdiff_t i = row + x;
+        sums.w[x] = centre;
+        sums.r[x] = centre * in.r[i];
+        sums.g[x] = centre * in.g[i];
+        sums.b[x] = centre * in.b[i];
+        sums.v[x] = centre * centre * in.v[i];
+        sums.invDepth[x] = 1 / (settings.depthSigma * in.z[i] + 1e-4f);
+      }
+
+      for (int dy = -2; dy <= 2; dy++) {
+        const int yy = y + dy * step;
+        if (yy < 0 || yy >= height)
+          continue;
+        for (int dx = -2; dx <= 2; dx++) {
+          if (dx == 0 && dy == 0)
+            continue;
+          const int offset = dx * step;
+          // Only the pixels whose tap lands in the image, so the loop has no
+          // branches
+          addTap(in, row, (ptrdiff_t)yy * width + offset,
+                 std::max(0, -offset), std::min(width, width - offset),
+                 KERNEL[dy + 2] * KERNEL[dx + 2],
+                 1 / (step * std::sqrt((float)(dx * dx + dy * dy))),
+                 settings.normalPower, invAlbedo, settings.colourSigma, sums);
+        }
+      }
+
+      for (int x = 0; x < width; x++) {
+        const ptrdiff_t i = row + x;
+        const float inv = in.ok[i] / sums.w[x];
+        const float keep = 1 - in.ok[i];
+        outR[i] = keep * in.r[i] + inv * sums.r[x];
+        outG[i] = keep * in.g[i] + inv * sums.g[x];
+        outB[i] = keep * in.b[i] + inv * sums.b[x];
+        outV[i] = keep * in.v[i] + inv * inv * sums.v[x];
+      }
+    }
+  }
+}
+
+void Denoiser::run(const Scene &s, const DenoiseSettings &settings) {
+  const size_t count = (size_t)s.getWidth() * s.getHeight();
+  if (s.pixelSamples.size() != count)
+    return;
+  load(s);
+  int from = 0;
+  for (int i = 0; i < settings.iterations; i++) {
+    filter(from, 1 << i, settings);
+    from = 1 - from;
+  }
+
+  sums.resize(count * 3);
+#pragma omp parallel for schedule(static)
+  for (int y = 0; y < height; y++)
+    for (int x = 0; x < width; x++) {
+      const size_t i = (size_t)y * width + x;
+      for (int c = 0; c < 3; c++)
+        sums[i * 3 + c] = (double)colour[from][c][i] * s.pixelSamples[i];
+    }
+}
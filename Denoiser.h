@@ -0,0 +1,71 @@
+#ifndef _DENOISER_H
+#define _DENOISER_H
+
+#include <vector>
+
+#include "Scene.h"
+
+// How strongly the denoiser smooths. Each weight falls off as two pixels
+// differ in one of their features, so edges between surfaces stay sharp.
+struct DenoiseSettings {
+  bool enabled = false;
+  // Passes of the filter, each reaching twice as far as the last
+  int iterations = 5;
+  // How many standard deviations of their noise two pixels' luminances can
+  // be apart and still be averaged
+  float colourSigma = 4;
+  // Exponent on the cosine between two pixels' normals
+  float normalPower = 64;
+  float albedoSigma = 0.1f;
+  // Difference in depth allowed per pixel apart, relative to the depth
+  float depthSigma = 0.02f;
+
+  bool operator==(const DenoiseSettings &o) const {
+    return enabled == o.enabled && iterations == o.iterations &&
+           colourSigma == o.colourSigma && normalPower == o.normalPower &&
+           albedoSigma == o.albedoSigma && depthSigma == o.depthSigma;
+  }
+
+  bool operator!=(const DenoiseSettings &o) const { return !(*this == o); }
+};
+
+// An edge-avoiding a-trous wavelet filter: a 5x5 B-spline kernel applied
+// several times with its taps spread further apart each time, every tap
+// weighted by how alike the two pixels' albedo, normal, depth and luminance
+// are. The luminance is allowed to differ by more where the samples of both
+// pixels vary more, so noisy pixels are smoothed more than converged ones. It
+// reads what a scene has accumulated so far, with its features, and can be
+// run after every pass.
+class Denoiser {
+public:
+  // Filters the image s has accumulated into sums. Pixels without samples or
+  // features are left as they are.
+  void run(const Scene &s, const DenoiseSettings &settings);
+
+  // The filtered image as sums over each pixel's samples, like Scene::raw,
+  // so it develops the same way
+  std::vector<double> sums;
+
+private:
+  int width = 0;
+  int height = 0;
+  // One plane per channel, so every loop over a row is over floats: the
+  // colour being filtered and its variance, twice to go back and forth, and
+  // the features
+  std::vector<float> colour[2][3];
+  std::vector<float> variance[2];
+  std::vector<float> albedo[3];
+  std::vector<float> normal[3];
+  std::vector<float> depth;
+  // 1 for pixels with features, 0 for the rest, which get no weight
+  std::vector<float> valid;
+
+  // Loads the mean radiance and features of every pixel of s
+  void load(const Scene &s);
+
+  // One pass of the filter with its taps step pixels apart, from buffer
+  // from into the other one
+  void filter(int from, int step, const DenoiseSettings &settings);
+};
+
+#endif
@@ -0,0 +1,115 @@
+#include "DensityField.h"
+#include "Functions.h"
+
+#include <algorithm>
+#include <cmath>
+
+GridDensity::GridDensity(const aabb &box, int nx, int ny, int nz,
+                         const std::vector<float> &values)
+    : box(box), nx(nx), ny(ny), nz(nz), values(values) {}
+
+float GridDensity::density(const Point &p) const {
+  // Position in grid points
+  const float gx = (p.x - box.min.x) / (box.max.x - box.min.x) * (nx - 1);
+  const float gy = (p.y - box.min.y) / (box.max.y - box.min.y) * (ny - 1);
+  const float gz = (p.z - box.min.z) / (box.max.z - box.min.z) * (nz - 1);
+  if (!(gx >= 0 && gy >= 0 && gz >= 0 && gx <= nx - 1 && gy <= ny - 1 &&
+        gz <= nz - 1))
+    return 0;
+
+  const int x = std::min((int)gx, nx - 2);
+  const int y = std::min((int)gy, ny - 2);
+  const int z = std::min((int)gz, nz - 2);
+  const float fx = gx - x;
+  const float fy = gy - y;
+  const float fz = gz - z;
+  const float x00 = at(x, y, z) + fx * (at(x + 1, y, z) - at(x, y, z));
+  const float x10 =
+      at(x, y + 1, z) + fx * (at(x + 1, y + 1, z) - at(x, y + 1, z));
+  const float x01 =
+      at(x, y, z + 1) + fx * (at(x + 1, y, z + 1) - at(x, y, z + 1));
+  const float x11 = at(x, y + 1, z + 1) +
+                    fx * (at(x + 1, y + 1, z + 1) - at(x, y + 1, z + 1));
+  const float y0 = x00 + fy * (x10 - x00);
+  const float y1 = x01 + fy * (x11 - x01);
+  return y0 + fz * (y1 - y0);
+}
+
+float GridDensity::maxDensity(const aabb &region) const {
+  // Every grid point whose cells reach into the region
+  const float sx = (nx - 1) / (box.max.x - box.min.x);
+  const float sy = (ny - 1) / (box.max.y - box.min.y);
+  const float sz = (nz - 1) / (box.max.z - box.min.z);
+  const int x0 = std::max(0, (int)std::floor((region.min.x - box.min.x) * sx));
+  const int y0 = std::max(0, (int)std::floor((region.min.y - box.min.y) * sy));
+  const int z0 = std::max(0, (int)std::floor((region.min.z - box.min.z) * sz));
+  const int x1 =
+      std::min(nx - 1, (int)std::ceil((region.max.x - box.min.x) * sx));
+  const int y1 =
+      std::min(ny - 1, (int)std::ceil((region.max.y - box.min.y) * sy));
+  const int z1 =
+      std::min(nz - 1, (int)std::ceil((region.max.z - box.min.z) * sz));
+
+  float highest = 0;
+  for (int z = z0; z <= z1; z++)
+    for (int y = y0; y <= y1; y++)
+      for (int x = x0; x <= x1; x++)
+        highest = std::max(highest, at(x, y, z));
+  return highest;
+}
+
+NoiseDensity::NoiseDensity(const aabb &box, float frequency, float bias,
+                           int octaves, uint64_t seed)
+    : box(box), frequency(frequency), bias(bias), octaves(octaves),
+      perlin(seed) {
+  centre = findCentre(box.min, box.max);
+  radius = 0.5f * std::min(box.max.x - box.min.x,
+                           std::min(box.max.y - box.min.y,
+                                    box.max.z - box.min.z));
+}
+
+float NoiseDensity::density(const Point &p) const {
+  const float dx = p.x - centre.x;
+  const float dy = p.y - centre.y;
+  const float dz = p.z - centre.z;
+  const float falloff =
+      1 - std::sqrt(dx * dx + dy * dy + dz * dz) / radius;
+  if (falloff <= 0)
+    return 0;
+
+  float sum = 0;
+  float amplitude = 1;
+  float f = frequency;
+  for (int i = 0; i < octaves; i++) {
+    sum += amplitude * perlin.noise(f * p.x, f * p.y, f * p.z);
+    amplitude *= 0.5f;
+    f *= 2;
+  }
+  return std::max(0.0f, sum + bias) * std::min(1.0f, 2 * falloff);
+}
+
+float NoiseDensity::maxDensity(const aabb &region) const {
+  const int samples = 4;
+  float highest = 0;
+  for (int k = 0; k <= samples; k++)
+    for (int j = 0; j <= samples; j++)
+      for (int i = 0; i <= samples; i++)
+        highest = std::max(
+            highest,
+            density(Point(
+                region.min.x + (region.max.x - region.min.x) * i / samples,
+                region.min.y + (region.max.y - region.min.y) * j / samples,
+                region.min.z + (region.max.z - region.min.z) * k / samples)));
+
+  // Improved noise changes by less than about 2.5 per lattice cell, per
+  // octave summed with halving amplitudes and doubling frequencies. Between
+  // samples the density can rise by up to that slope times half a sample
+  // spacing along each axis.
+  const float spacing =
+      std::max(region.max.x - region.min.x,
+               std::max(region.max.y - region.min.y,
+                        region.max.z - region.min.z)) /
+      samples;
+  const float slope = 2.5f * frequency * octaves;
+  return highest + slope * spacing * 0.5f * std::sqrt(3.0f);
+}
@@ -0,0 +1,75 @@
+#ifndef _DENSITY_FIELD_H
+#define _DENSITY_FIELD_H
+
+#include <cstdint>
+#include <vector>
+
+#include "Noise.h"
+#include "Point.h"
+#include "aabb.h"
+
+// Density of a participating medium at each point of space, zero outside of
+// bounds()
+class DensityField {
+public:
+  virtual ~DensityField() {}
+
+  virtual float density(const Point &p) const = 0;
+
+  // The largest density anywhere in region. Media use it to build their
+  // majorant grid, so it must not come out lower than density() does.
+  virtual float maxDensity(const aabb &region) const = 0;
+
+  virtual aabb bounds() const = 0;
+};
+
+// Densities given on a regular grid of points over a box, read back with
+// trilinear interpolation
+class GridDensity : public DensityField {
+public:
+  // values holds nx * ny * nz densities, x varying fastest
+  GridDensity(const aabb &box, int nx, int ny, int nz,
+              const std::vector<float> &values);
+
+  float density(const Point &p) const override;
+
+  float maxDensity(const aabb &region) const override;
+
+  aabb bounds() const override { return box; }
+
+private:
+  float at(int x, int y, int z) const {
+    return values[(z * ny + y) * nx + x];
+  }
+
+  aabb box;
+  int nx, ny, nz;
+  std::vector<float> values;
+};
+
+// Billowing smoke: a few octaves of Perlin noise, shifted by bias, cut off
+// below zero and faded out towards the edge of a sphere that fits the box
+class NoiseDensity : public DensityField {
+public:
+  NoiseDensity(const aabb &box, float frequency, float bias, int octaves = 3,
+               uint64_t seed = 0);
+
+  float density(const Point &p) const override;
+
+  // Found by sampling the region and adding how far the noise can change
+  // between samples
+  float maxDensity(const aabb &region) const override;
+
+  aabb bounds() const override { return box; }
+
+private:
+  aabb box;
+  Point centre;
+  float radius;
+  float frequency;
+  float bias;
+  int octaves;
+  PerlinNoise perlin;
+};
+
+#endif
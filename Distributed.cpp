@@ -0,0 +1,217 @@
+#include "Distributed.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const char PARTIAL_MAGIC[8] = {'J', 'T', 'P', 'A', 'R', 'T', '0', '2'};
+
+// What has to match between a partial and the scene it is merged into, and
+// the last pass the worker rendered
+struct PartialHeader {
+  int32_t width, height;
+  int32_t filter, splat;
+  float filterRadius;
+  uint32_t aovs;
+  int32_t lastPass;
+};
+
+int renderShare(Scene &s, int worker, int count, int passes) {
+  int last = -1;
+  for (int pass = worker; pass < passes; pass += count) {
+    s.passIndex = pass;
+    s.render();
+    last = pass;
+  }
+  s.passIndex = passes;
+  return last;
+}
+
+// Pipes take writes and reads in pieces
+static bool writeAll(int fd, const void *data, size_t size) {
+  const char *at = (const char *)data;
+  while (size > 0) {
+    const ssize_t written = write(fd, at, size);
+    if (written <= 0)
+      return false;
+    at += written;
+    size -= written;
+  }
+  return true;
+}
+
+static bool readAll(int fd, void *data, size_t size) {
+  char *at = (char *)data;
+  while (size > 0) {
+    const ssize_t got = read(fd, at, size);
+    if (got <= 0)
+      return false;
+    at += got;
+    size -= got;
+  }
+  return true;
+}
+
+// The magic and the header, then raw and the sample counts, then the sums of
+// each AOV pass and their sample counts if there are any
+bool writePartial(int fd, const Scene &s, int lastPass) {
+  const size_t count = (size_t)s.getWidth() * s.getHeight();
+  if (s.pixelSamples.size() != count ||
+      (s.aovs != 0 && s.aovSamples.size() != count))
+    return false;
+  PartialHeader header;
+  memset(&header, 0, sizeof(header));
+  header.width = s.getWidth();
+  header.height = s.getHeight();
+  header.filter = s.film.filter;
+  header.splat = s.film.splat;
+  header.filterRadius = s.film.radius;
+  header.aovs = s.aovs;
+  header.lastPass = lastPass;
+  bool ok = writeAll(fd, PARTIAL_MAGIC, sizeof(PARTIAL_MAGIC)) &&
+            writeAll(fd, &header, sizeof(header)) &&
+            writeAll(fd, s.raw, count * 3 * sizeof(double)) &&
+            writeAll(fd, s.pixelSamples.data(), count * sizeof(unsigned int));
+  for (int p = 0; ok && p < AOV_COUNT; p++)
+    if (s.aovs & aovBit((AovPass)p))
+      ok = writeAll(fd, s.aovSums[p].data(),
+                    s.aovSums[p].size() * sizeof(float));
+  if (ok && s.aovs != 0)
+    ok = writeAll(fd, s.aovSamples.data(), count * sizeof(unsigned int));
+  return ok;
+}
+
+bool mergePartial(int fd, Scene &s) {
+  const size_t count = (size_t)s.getWidth() * s.getHeight();
+  char magic[sizeof(PARTIAL_MAGIC)];
+  PartialHeader header;
+  if (!readAll(fd, magic, sizeof(magic)) ||
+      memcmp(magic, PARTIAL_MAGIC, sizeof(magic)) != 0 ||
+      !readAll(fd, &header, sizeof(header)))
+    return false;
+  if (header.width != s.getWidth() || header.height != s.getHeight() ||
+      header.filter != s.film.filter || header.splat != s.film.splat ||
+      header.filterRadius != s.film.radius || header.aovs != s.aovs) {
+    printf("Partial is of another render\n");
+    return false;
+  }
+
+  // Read aside, so a truncated partial changes nothing
+  std::vector<double> raw(count * 3);
+  std::vector<unsigned int> samples(count);
+  std::vector<float> aovSums[AOV_COUNT];
+  std::vector<unsigned int> aovSamples(s.aovs != 0 ? count : 0);
+  bool ok = readAll(fd, raw.data(), raw.size() * sizeof(double)) &&
+            readAll(fd, samples.data(), samples.size() * sizeof(unsigned int));
+  for (int p = 0; ok && p < AOV_COUNT; p++) {
+    if (!(s.aovs & aovBit((AovPass)p)))
+      continue;
+    aovSums[p].resize(count * aovChannels((AovPass)p));
+    ok = readAll(fd, aovSums[p].data(), aovSums[p].size() * sizeof(float));
+  }
+  ok = ok && readAll(fd, aovSamples.data(),
+                     aovSamples.size() * sizeof(unsigned int));
+  if (!ok)
+    return false;
+
+  if (s.pixelSamples.size() != count)
+    s.resetAccumulation();
+  s.allocateAovs();
+  for (size_t i = 0; i < count * 3; i++)
+    s.raw[i] += raw[i];
+  for (size_t i = 0; i < count; i++)
+    s.pixelSamples[i] += samples[i];
+  // Object IDs are those of the last pass, as if one process rendered them
+  const bool newest =
+      header.lastPass >= 0 && (unsigned int)header.lastPass >= s.passIndex;
+  for (int p = 0; p < AOV_COUNT; p++) {
+    if (aovSums[p].empty())
+      continue;
+    if (p != AOV_OBJECT_ID)
+      for (size_t i = 0; i < aovSums[p].size(); i++)
+        s.aovSums[p][i] += aovSums[p][i];
+    else if (newest)
+      s.aovSums[p].swap(aovSums[p]);
+  }
+  for (size_t i = 0; i < aovSamples.size(); i++)
+    s.aovSamples[i] += aovSamples[i];
+  if (header.lastPass >= 0)
+    s.passIndex = std::max(s.passIndex, (unsigned int)header.lastPass + 1);
+  for (unsigned int &version : s.rowVersions)
+    version++;
+  return true;
+}
+
+// Starts command with its standard output on a pipe and returns the end to
+// read, or -1
+static int startWorker(const std::vector<std::string> &command, pid_t &pid) {
+  int ends[2];
+  if (pipe(ends) != 0)
+    return -1;
+  pid = fork();
+  if (pid < 0) {
+    close(ends[0]);
+    close(ends[1]);
+    return -1;
+  }
+  if (pid == 0) {
+    // A fresh program rather than a copy of this one, which may have
+    // OpenMP threads that didn't come along
+    dup2(ends[1], STDOUT_FILENO);
+    close(ends[0]);
+    close(ends[1]);
+    std::vector<char *> argv;
+    for (const std::string &arg : command)
+      argv.push_back(const_cast<char *>(arg.c_str()));
+    argv.push_back(nullptr);
+    execv(argv[0], argv.data());
+    _exit(127);
+  }
+  close(ends[1]);
+  return ends[0];
+}
+
+bool renderWithWorkers(Scene &s, const std::vector<std::string> &command,
+                       int workers) {
+  if (command.empty() || workers <= 0)
+    return false;
+  std::vector<int> pipes(workers, -1);
+  std::vector<pid_t> pids(workers, -1);
+  bool ok = true;
+  for (int i = 0; i < workers; i++) {
+    std::vector<std::string> args = command;
+    args.push_back(std::to_string(i));
+    args.push_back(std::to_string(workers));
+    pipes[i] = startWorker(args, pids[i]);
+    if (pipes[i] < 0) {
+      printf("Unable to start worker %d\n", i);
+      ok = false;
+    }
+  }
+
+  // Each worker only writes once it has rendered its share, and blocks until
+  // it is read, so reading them in turn doesn't hold any of them up long
+  s.resetAccumulation();
+  for (int i = 0; i < workers; i++) {
+    if (pipes[i] < 0)
+      continue;
+    if (!mergePartial(pipes[i], s)) {
+      printf("Worker %d sent no image\n", i);
+      ok = false;
+    }
+    close(pipes[i]);
+  }
+  for (int i = 0; i < workers; i++) {
+    int status = 0;
+    if (pids[i] > 0 &&
+        (waitpid(pids[i], &status, 0) != pids[i] || !WIFEXITED(status) ||
+         WEXITSTATUS(status) != 0)) {
+      printf("Worker %d failed\n", i);
+      ok = false;
+    }
+  }
+  return ok;
+}
@@ -0,0 +1,38 @@
+#ifndef _DISTRIBUTED_H
+#define _DISTRIBUTED_H
+
+#include <string>
+#include <vector>
+
+#include "Scene.h"
+
+// Splitting a render across processes by passes. Every sample is seeded from
+// its pixel, its pass and the scene's seed, so a pass renders the same in
+// any process, and the passes of a frame can be shared out and added back up:
+// the sums of raw and of the sample counts are those of one process
+// rendering every pass, up to the order of the additions.
+
+// Renders worker's share of passes passes of s: every count-th pass starting
+// from pass worker. Returns the last pass it rendered, or -1 for none.
+int renderShare(Scene &s, int worker, int count, int passes);
+
+// Writes what s has accumulated to the file descriptor fd, for a coordinator
+// to merge, AOV passes included: all a worker sends back. lastPass is what
+// renderShare() returned.
+bool writePartial(int fd, const Scene &s, int lastPass);
+
+// Reads what a worker wrote with writePartial() from fd and adds it to s,
+// sample counts included. Object IDs are taken from the worker that rendered
+// the latest pass, and passIndex moves past it. Fails if the partial is of
+// another image size, film or set of AOV passes than s.
+bool mergePartial(int fd, Scene &s);
+
+// Runs workers processes of command, each with its index and the number of
+// workers appended to its arguments and its standard output on a pipe, and
+// merges what they write into s. A worker has to build the same scene as s
+// and render its share with renderShare(), so command is usually this
+// program in its worker mode. Returns false if a worker failed.
+bool renderWithWorkers(Scene &s, const std::vector<std::string> &command,
+                       int workers);
+
+#endif
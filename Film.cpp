@@ -0,0 +1,172 @@
+#include "Film.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+float defaultFilterRadius(FilterType type) {
+  switch (type) {
+  case FILTER_GAUSSIAN:
+    return 1.5f;
+  case FILTER_MITCHELL:
+  case FILTER_BLACKMAN_HARRIS:
+    return 2.0f;
+  default:
+    return 0.5f;
+  }
+}
+
+const char *filterName(FilterType type) {
+  static const char *const NAMES[FILTER_COUNT] = {"box", "gaussian",
+                                                  "mitchell", "blackman"};
+  return NAMES[type];
+}
+
+FilterType filterFromName(const char *name) {
+  for (int f = 0; f < FILTER_COUNT; f++)
+    if (strcmp(name, filterName((FilterType)f)) == 0)
+      return (FilterType)f;
+  return FILTER_COUNT;
+}
+
+// The filters before scaling, at offset x in [-radius, radius]
+static double filterShape(FilterType type, double x, double radius) {
+  switch (type) {
+  case FILTER_GAUSSIAN: {
+    const double sigma = radius / 3;
+    const double k = -0.5 / (sigma * sigma);
+    return std::exp(k * x * x) - std::exp(k * radius * radius);
+  }
+  case FILTER_MITCHELL: {
+    // The cubic is defined over [-2, 2]
+    const double t = std::fabs(2 * x / radius);
+    const double b = 1.0 / 3, c = 1.0 / 3;
+    if (t < 1)
+      return ((12 - 9 * b - 6 * c) * t * t * t +
+              (-18 + 12 * b + 6 * c) * t * t + (6 - 2 * b)) /
+             6;
+    if (t < 2)
+      return ((-b - 6 * c) * t * t * t + (6 * b + 30 * c) * t * t +
+              (-12 * b - 48 * c) * t + (8 * b + 24 * c)) /
+             6;
+    return 0;
+  }
+  case FILTER_BLACKMAN_HARRIS: {
+    const double t = 2 * M_PI * (x + radius) / (2 * radius);
+    return 0.35875 - 0.48829 * std::cos(t) + 0.14128 * std::cos(2 * t) -
+           0.01168 * std::cos(3 * t);
+  }
+  default:
+    return 1;
+  }
+}
+
+FilterTable::FilterTable(FilterType type, float radius)
+    : kind(type), r(std::min(std::max(radius, 0.5f), 8.0f)) {
+  const double step = 2.0 * r / ENTRIES;
+  toEntry = 1 / step;
+  // Each entry holds the filter at its middle
+  double sum = 0;
+  for (int i = 0; i < ENTRIES; i++) {
+    values[i] = filterShape(type, -r + (i + 0.5) * step, r);
+    sum += values[i] * step;
+  }
+  double running = 0, absRunning = 0;
+  for (int i = 0; i < ENTRIES; i++) {
+    values[i] /= sum;
+    integrals[i] = running;
+    cdf[i] = absRunning;
+    running += values[i] * step;
+    absRunning += std::fabs(values[i]) * step;
+  }
+  integrals[ENTRIES] = running;
+  absIntegral = absRunning;
+  for (int i = 0; i < ENTRIES; i++)
+    cdf[i] /= absIntegral;
+  cdf[ENTRIES] = 1;
+}
+
+float FilterTable::integral(float a, float b) const {
+  // The integral from -radius to d
+  const auto upTo = [this](float d) {
+    const float at = std::min(std::max((d + r) * toEntry, 0.0f),
+                              (float)ENTRIES);
+    const int i = std::min((int)at, ENTRIES - 1);
+    return integrals[i] + (at - i) * values[i] / toEntry;
+  };
+  return b > a ? upTo(b) - upTo(a) : 0.0f;
+}
+
+float FilterTable::sample(float u, float &weight) const {
+  const int i =
+      std::min((int)(std::upper_bound(cdf, cdf + ENTRIES + 1, u) - cdf) - 1,
+               ENTRIES - 1);
+  const float width = cdf[i + 1] - cdf[i];
+  const float t = width > 0 ? (u - cdf[i]) / width : 0.5f;
+  weight = values[i] < 0 ? -absIntegral : absIntegral;
+  return -r + (i + t) / toEntry;
+}
+
+// Pixels whose centres are within radius of a sample, which can land
+// anywhere from y to y + 1 in its row
+static int splatReach(const FilterTable &filter) {
+  return (int)std::ceil(filter.radius() + 0.5f);
+}
+
+void FilmTile::reset(int imageWidth, int height, int from, int to,
+                     const FilterTable &filter) {
+  const int reach = splatReach(filter);
+  width = imageWidth;
+  y0 = from < to ? std::max(0, from - reach) : 0;
+  y1 = from < to ? std::min(height, to + reach) : 0;
+  // Keeps what was allocated for earlier passes
+  sums.assign((size_t)(y1 - y0) * width * 3, 0.0);
+}
+
+void FilmTile::splat(float fx, float fy, const Point &c,
+                     const FilterTable &filter) {
+  const float radius = filter.radius();
+  // The pixels whose centres, at + 0.5, are within the radius
+  const int xFrom = std::max(0, (int)std::ceil(fx - 0.5f - radius));
+  const int xTo = std::min(width - 1, (int)std::floor(fx - 0.5f + radius));
+  const int yFrom = std::max(y0, (int)std::ceil(fy - 0.5f - radius));
+  const int yTo = std::min(y1 - 1, (int)std::floor(fy - 0.5f + radius));
+  float wx[2 * 8 + 2];
+  const int columns = xTo - xFrom + 1;
+  for (int i = 0; i < columns; i++)
+    wx[i] = filter.evaluate(fx - (xFrom + i + 0.5f));
+  for (int y = yFrom; y <= yTo; y++) {
+    const float wy = filter.evaluate(fy - (y + 0.5f));
+    if (wy == 0)
+      continue;
+    double *row = sums.data() + ((size_t)(y - y0) * width + xFrom) * 3;
+    for (int i = 0; i < columns; i++) {
+      const double w = (double)wx[i] * wy;
+      row[i * 3] += w * c.x;
+      row[i * 3 + 1] += w * c.y;
+      row[i * 3 + 2] += w * c.z;
+    }
+  }
+}
+
+void FilmTile::addRow(int y, double *out, const float *coverage,
+                      double scale) const {
+  if (y < y0 || y >= y1)
+    return;
+  const double *row = sums.data() + (size_t)(y - y0) * width * 3;
+  for (int x = 0; x < width; x++) {
+    const double s = scale / coverage[x];
+    out[x * 3] += row[x * 3] * s;
+    out[x * 3 + 1] += row[x * 3 + 1] * s;
+    out[x * 3 + 2] += row[x * 3 + 2] * s;
+  }
+}
+
+void filterCoverage(const FilterTable &filter, int size,
+                    std::vector<float> &coverage) {
+  coverage.resize(size);
+  // Samples cover [0, size), offsets from the centre of pixel i
+  for (int i = 0; i < size; i++)
+    coverage[i] = std::max(filter.integral(-(i + 0.5f), size - (i + 0.5f)),
+                           1e-6f);
+}
@@ -0,0 +1,131 @@
+#ifndef _FILM_H
+#define _FILM_H
+
+#include <vector>
+
+#include "Point.h"
+
+// How the samples of a pass are turned into pixels. A pixel's value is the
+// image around its centre weighted by a reconstruction filter: f(x) f(y) for
+// offsets x and y in pixels, nothing past the filter's radius. Every filter
+// is separable, so one table along an axis describes it.
+
+enum FilterType {
+  // 1 over the pixel, a plain average of its samples
+  FILTER_BOX,
+  // A Gaussian with a standard deviation of a third of the radius, shifted
+  // down to reach 0 at the radius
+  FILTER_GAUSSIAN,
+  // Mitchell-Netravali with B = C = 1/3, with slightly negative lobes that
+  // sharpen edges
+  FILTER_MITCHELL,
+  // The Blackman-Harris window: close to the Gaussian, with less blur
+  FILTER_BLACKMAN_HARRIS,
+  FILTER_COUNT
+};
+
+// The radius each filter is usually used with, in pixels
+float defaultFilterRadius(FilterType type);
+
+const char *filterName(FilterType type);
+
+// The filter called name, or FILTER_COUNT if there is none
+FilterType filterFromName(const char *name);
+
+struct FilmSettings {
+  FilterType filter = FILTER_BOX;
+  float radius = 0.5f;
+  // Spread every sample over all the pixels its filter reaches, instead of
+  // placing it by the filter in the pixel it belongs to. Every pixel gets a
+  // share of more samples, so it is a little less noisy, but each pass takes
+  // more memory and a merge at its end. It is also what contributions that
+  // can land anywhere on the film, like those of paths traced from the
+  // lights, would need.
+  bool splat = false;
+
+  bool operator==(const FilmSettings &o) const {
+    return filter == o.filter && radius == o.radius && splat == o.splat;
+  }
+
+  bool operator!=(const FilmSettings &o) const { return !(*this == o); }
+};
+
+// A filter tabulated along one axis over [-radius, radius], scaled to
+// integrate to 1, with what it takes to sample offsets from it
+class FilterTable {
+public:
+  FilterTable() : FilterTable(FILTER_BOX, 0.5f) {}
+
+  // The radius is held to [0.5, 8] pixels
+  FilterTable(FilterType type, float radius);
+
+  FilterType type() const { return kind; }
+
+  float radius() const { return r; }
+
+  // The filter at offset d from a pixel's centre
+  float evaluate(float d) const {
+    const int i = (int)((d + r) * toEntry);
+    return i >= 0 && i < ENTRIES ? values[i] : 0.0f;
+  }
+
+  // The integral of evaluate() over [a, b]
+  float integral(float a, float b) const;
+
+  // An offset from a pixel's centre picked from u in [0, 1) with a density
+  // in proportion to |evaluate()|, and in weight what the sample counts for:
+  // the sign of the filter there times the integral of its magnitude. The
+  // weights average to 1, and are 1 throughout for filters that are never
+  // negative.
+  float sample(float u, float &weight) const;
+
+private:
+  static const int ENTRIES = 256;
+
+  FilterType kind;
+  float r;
+  float toEntry;
+  float values[ENTRIES];
+  // The integral of values, and of their magnitudes over that of all of
+  // them, up to the start of each entry
+  float integrals[ENTRIES + 1];
+  float cdf[ENTRIES + 1];
+  float absIntegral;
+};
+
+// What one thread splats over a band of rows of an image, added to the
+// image once the pass is done. Each thread has its own, so splats that
+// reach into rows rendered by another thread need no atomics or locks, and
+// keeps it from pass to pass so its memory is only allocated once.
+class FilmTile {
+public:
+  explicit FilmTile(int width = 0) : width(width) {}
+
+  // Clears the tile for a pass over rows [from, to) of an image width by
+  // height, holding those rows and the ones their splats reach
+  void reset(int width, int height, int from, int to,
+             const FilterTable &filter);
+
+  // Adds c at film position (fx, fy), in pixels from the image's top left,
+  // to every pixel whose filter reaches it
+  void splat(float fx, float fy, const Point &c, const FilterTable &filter);
+
+  // Adds what was splatted into row y, if anything, to the row's pixels in
+  // out, 3 doubles each, times scale and over each pixel's column coverage
+  void addRow(int y, double *out, const float *coverage, double scale) const;
+
+private:
+  int width;
+  // The rows held, [y0, y1)
+  int y0 = 0;
+  int y1 = 0;
+  std::vector<double> sums;
+};
+
+// How much of the filter of each of size pixels along an axis falls on the
+// film, which samples only cover up to its edges. Splats are divided by it,
+// so pixels at the edges aren't darker.
+void filterCoverage(const FilterTable &filter, int size,
+                    std::vector<float> &coverage);
+
+#endif
@@ -0,0 +1,131 @@
+#include "FrameDisplay.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+FrameDisplay::FrameDisplay(SDL_Renderer *renderer, int width, int height)
+    : width(width), height(height), shownVersions(height, 0) {
+  tex = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                          SDL_TEXTUREACCESS_STREAMING, width, height);
+  if (tex == nullptr)
+    printf("Unable to create the display texture: %s\n", SDL_GetError());
+}
+
+FrameDisplay::~FrameDisplay() {
+  if (tex != nullptr)
+    SDL_DestroyTexture(tex);
+}
+
+void FrameDisplay::invalidate() { everything = true; }
+
+template <class Fill>
+int FrameDisplay::upload(const std::vector<unsigned int> &versions,
+                         Fill fill) {
+  // Contiguous changed rows are uploaded with one lock. Locked memory may not
+  // hold the old pixels, so only changed rows are locked.
+  int uploaded = 0;
+  int y = 0;
+  while (y < height) {
+    if (!everything && versions[y] == shownVersions[y]) {
+      y++;
+      continue;
+    }
+    const int first = y;
+    while (y < height && (everything || versions[y] != shownVersions[y])) {
+      shownVersions[y] = versions[y];
+      y++;
+    }
+
+    const SDL_Rect rect = {0, first, width, y - first};
+    void *pixels;
+    int pitch;
+    if (SDL_LockTexture(tex, &rect, &pixels, &pitch) != 0) {
+      printf("Unable to lock the display texture: %s\n", SDL_GetError());
+      return uploaded;
+    }
+    fill(first, y, (unsigned char *)pixels, pitch);
+    SDL_UnlockTexture(tex);
+    uploaded += y - first;
+  }
+  everything = false;
+  return uploaded;
+}
+
+int FrameDisplay::update(const Scene &s) {
+  if (tex == nullptr || (int)s.rowVersions.size() != height ||
+      s.pixelSamples.size() != (size_t)width * height)
+    return 0;
+  if (s.tone != tone) {
+    tone = s.tone;
+    everything = true;
+  }
+  return upload(s.rowVersions, [&](int first, int end, unsigned char *pixels,
+                                   int pitch) {
+    developRows(s.raw, s.pixelSamples.data(), width, first, end, s.tone,
+                pixels, pitch);
+  });
+}
+
+int FrameDisplay::update(const FrameBuffer &buffer) {
+  if (tex == nullptr || buffer.width != width || buffer.height != height)
+    return 0;
+  return upload(buffer.versions, [&](int first, int end,
+                                     unsigned char *pixels, int pitch) {
+    for (int y = first; y < end; y++)
+      memcpy(pixels + (size_t)(y - first) * pitch,
+             buffer.pixels.data() + (size_t)y * width * 4, width * 4);
+  });
+}
+
+void FrameBuffer::update(const Scene &s, const double *sums) {
+  const int w = s.getWidth();
+  const int h = s.getHeight();
+  if ((int)s.rowVersions.size() != h ||
+      s.pixelSamples.size() != (size_t)w * h)
+    return;
+  if (w != width || h != height || s.tone != tone) {
+    width = w;
+    height = h;
+    tone = s.tone;
+    pixels.resize((size_t)w * h * 4);
+    // Different from any version, so every row is converted
+    versions.resize(h);
+    for (int y = 0; y < h; y++)
+      versions[y] = s.rowVersions[y] - 1;
+  }
+
+  int y = 0;
+  while (y < height) {
+    if (versions[y] == s.rowVersions[y]) {
+      y++;
+      continue;
+    }
+    const int first = y;
+    while (y < height && versions[y] != s.rowVersions[y]) {
+      versions[y] = s.rowVersions[y];
+      y++;
+    }
+    developRows(sums != nullptr ? sums : s.raw, s.pixelSamples.data(), width,
+                first, y, tone, pixels.data() + (size_t)first * width * 4,
+                width * 4);
+  }
+}
+
+bool FrameDisplay::save(const Scene &s, const char *path) {
+  const int width = s.getWidth();
+  const int height = s.getHeight();
+  if (s.pixelSamples.size() != (size_t)width * height)
+    return false;
+  std::vector<unsigned char> pixels((size_t)width * height * 4);
+  developRows(s.raw, s.pixelSamples.data(), width, 0, height, s.tone,
+              pixels.data(), width * 4);
+  SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormatFrom(
+      pixels.data(), width, height, 32, width * 4, SDL_PIXELFORMAT_ARGB8888);
+  const bool saved = surface != nullptr && SDL_SaveBMP(surface, path) == 0;
+  SDL_FreeSurface(surface);
+  if (!saved)
+    printf("Unable to save %s: %s\n", path, SDL_GetError());
+  return saved;
+}
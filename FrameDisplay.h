@@ -0,0 +1,71 @@
+#ifndef _FRAME_DISPLAY_H
+#define _FRAME_DISPLAY_H
+
+#include <SDL2/SDL.h>
+#include <vector>
+
+#include "Scene.h"
+#include "Tonemap.h"
+
+// An 8 bit ARGB8888 copy of a scene's image, for handing finished frames to
+// another thread
+struct FrameBuffer {
+  int width = 0;
+  int height = 0;
+  std::vector<unsigned char> pixels;
+  // Scene::rowVersions of the rows when they were converted
+  std::vector<unsigned int> versions;
+  // What they were developed with
+  ToneSettings tone;
+
+  // Converts the rows of s that changed since this buffer last saw them, or
+  // every row if its tone settings changed. sums, if not null, is converted
+  // in place of s.raw.
+  void update(const Scene &s, const double *sums = nullptr);
+};
+
+// Shows a scene's accumulated image in a streaming texture. Only the rows
+// that changed since the last update are converted, straight into the
+// texture's memory, so nothing is allocated or copied per frame.
+class FrameDisplay {
+public:
+  FrameDisplay(SDL_Renderer *renderer, int width, int height);
+
+  ~FrameDisplay();
+
+  FrameDisplay(const FrameDisplay &) = delete;
+
+  FrameDisplay &operator=(const FrameDisplay &) = delete;
+
+  // Uploads the rows of s that changed, developed with its tone settings.
+  // Returns how many were uploaded.
+  int update(const Scene &s);
+
+  // The same from an image already converted, by copying its rows
+  int update(const FrameBuffer &buffer);
+
+  // Uploads every row on the next update
+  void invalidate();
+
+  SDL_Texture *texture() const { return tex; }
+
+  // Writes the whole image of s to a BMP file
+  static bool save(const Scene &s, const char *path);
+
+private:
+  SDL_Texture *tex;
+  int width;
+  int height;
+  // Locks the changed rows in runs and calls fill(first, end, pixels,
+  // pitch) for each
+  template <class Fill>
+  int upload(const std::vector<unsigned int> &versions, Fill fill);
+
+  // Scene::rowVersions when each row was last uploaded
+  std::vector<unsigned int> shownVersions;
+  bool everything = true;
+  // The tone settings of the scene last uploaded
+  ToneSettings tone;
+};
+
+#endif
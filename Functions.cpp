@@ -34,17 +34,47 @@ float schlick(const float cosine, const float refractIdx) {
 // I'm not totally sure how this works, but it returns a ray in the direction of
 // Z with a PDF of cosine(theta). See Peter Shirley's book
 Vec randomCosinePDFRay() {
-  double r1 = joetracer::randomOne();
-  double r2 = joetracer::randomOne();
-  double z = sqrt(1 - r2);
+  return cosineDirection(joetracer::randomOne(), joetracer::randomOne());
+}
+
+Vec cosineDirection(double u1, double u2) {
+  double z = sqrt(1 - u2);
 
-  double phi = 2 * PI * r1;
-  double x = cos(phi) * sqrt(r2);
-  double y = sin(phi) * sqrt(r2);
+  double phi = 2 * PI * u1;
+  double x = cos(phi) * sqrt(u2);
+  double y = sin(phi) * sqrt(u2);
   // Range: -1 < x, y, z < 1
   return Vec(x, y, z);
 }
 
+Vec sphereDirection(double u1, double u2) {
+  double z = 1 - 2 * u1;
+  double r = sqrt(fmax(0.0, 1 - z * z));
+  double phi = 2 * PI * u2;
+  return Vec(r * cos(phi), r * sin(phi), z);
+}
+
+// The cube root keeps the points uniform in volume rather than radius
+Vec ballPoint(double u1, double u2, double u3) {
+  return scale(cbrt(u3), sphereDirection(u1, u2));
+}
+
+Vec diskPoint(double u1, double u2) {
+  const double a = 2 * u1 - 1;
+  const double b = 2 * u2 - 1;
+  if (a == 0 && b == 0)
+    return Vec(0, 0, 0);
+  double r, phi;
+  if (std::fabs(a) > std::fabs(b)) {
+    r = a;
+    phi = (PI / 4) * (b / a);
+  } else {
+    r = b;
+    phi = PI / 2 - (PI / 4) * (a / b);
+  }
+  return Vec(r * cos(phi), r * sin(phi), 0);
+}
+
 // Returns a random ray in the upper hemisphere
 Vec randomRayInSphere(const Vec &n) {
   Vec w;
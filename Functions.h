@@ -76,6 +76,25 @@ Vec randomRayInUnitVector();
 
 Vec randomCosinePDFRay();
 
+// Cosine weighted direction around +Z from two uniform numbers
+Vec cosineDirection(double u1, double u2);
+
+// Uniformly distributed unit vector from two uniform numbers
+Vec sphereDirection(double u1, double u2);
+
+// Uniformly distributed point inside the unit ball from three uniform numbers
+Vec ballPoint(double u1, double u2, double u3);
+
+// Uniformly distributed point on the unit disk (z = 0) from two uniform
+// numbers, with the concentric mapping so nearby numbers give nearby points
+Vec diskPoint(double u1, double u2);
+
+// Multiple importance sampling weight of a sample taken with density f, when
+// it could also have been taken with density g
+inline double powerHeuristic(double f, double g) {
+  return (f * f) / (f * f + g * g);
+}
+
 template <class T> bool isDegenerate(T v) {
   const double nearZero = 0.00000001;
   return (std::fabs(v.x) <= nearZero && std::fabs(v.y) <= nearZero &&
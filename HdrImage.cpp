@@ -0,0 +1,567 @@
+#include "HdrImage.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+
+uint16_t floatToHalf(float f) {
+  uint32_t x;
+  memcpy(&x, &f, sizeof(x));
+  const uint16_t sign = (x >> 16) & 0x8000;
+  const uint32_t mag = x & 0x7fffffff;
+  // Infinity and NaN
+  if (mag >= 0x7f800000)
+    return sign | (mag > 0x7f800000 ? 0x7e00 : 0x7c00);
+  // Rounds to 65520 or more
+  if (mag >= 0x477ff000)
+    return sign | 0x7c00;
+  // Below the smallest normal half, 2^-14
+  if (mag < 0x38800000) {
+    if (mag < 0x33000000)
+      return sign;
+    const int shift = 126 - (int)(mag >> 23);
+    const uint32_t m = (mag & 0x7fffff) | 0x800000;
+    uint32_t h = m >> shift;
+    const uint32_t rest = m & ((1u << shift) - 1);
+    const uint32_t half = 1u << (shift - 1);
+    if (rest > half || (rest == half && (h & 1)))
+      h++;
+    return sign | h;
+  }
+  // Rebias the exponent from 127 to 15 and round the mantissa to even. A
+  // carry moves into the exponent, which is still right.
+  uint32_t h = (mag - 0x38000000) >> 13;
+  const uint32_t rest = mag & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+    h++;
+  return sign | h;
+}
+
+float halfToFloat(uint16_t h) {
+  const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  const uint32_t exponent = (h >> 10) & 0x1f;
+  const uint32_t mantissa = h & 0x3ff;
+  uint32_t x;
+  if (exponent == 0) {
+    const float v = std::ldexp((float)mantissa, -24);
+    return sign ? -v : v;
+  }
+  if (exponent == 31)
+    x = sign | 0x7f800000 | (mantissa << 13);
+  else
+    x = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  float f;
+  memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+// The average radiance of the w x h pixels of s from (x0, y0), 3 floats each
+// with rows stride floats apart
+static void resolve(const Scene &s, int x0, int y0, int w, int h, float *out,
+                    int stride) {
+  const int width = s.getWidth();
+  for (int y = 0; y < h; y++) {
+    const double *in = s.raw + ((size_t)(y0 + y) * width + x0) * 3;
+    const unsigned int *counts =
+        s.pixelSamples.data() + (size_t)(y0 + y) * width + x0;
+    float *row = out + (size_t)y * stride;
+    for (int x = 0; x < w; x++) {
+      const double scale = 1.0 / (counts[x] > 0 ? counts[x] : 1);
+      row[x * 3] = in[x * 3] * scale;
+      row[x * 3 + 1] = in[x * 3 + 1] * scale;
+      row[x * 3 + 2] = in[x * 3 + 2] * scale;
+    }
+  }
+}
+
+static bool hasImage(const Scene &s) {
+  return s.getWidth() > 0 && s.getHeight() > 0 &&
+         s.pixelSamples.size() == (size_t)s.getWidth() * s.getHeight();
+}
+
+bool writePFM(const Scene &s, const char *path) {
+  if (!hasImage(s))
+    return false;
+  FILE *f = fopen(path, "wb");
+  if (f == nullptr) {
+    printf("Unable to write %s\n", path);
+    return false;
+  }
+  const int width = s.getWidth();
+  const int height = s.getHeight();
+  // A negative scale means little endian
+  bool ok = fprintf(f, "PF\n%d %d\n-1.0\n", width, height) > 0;
+  std::vector<float> row((size_t)width * 3);
+  for (int y = height - 1; ok && y >= 0; y--) {
+    resolve(s, 0, y, width, 1, row.data(), width * 3);
+    ok = fwrite(row.data(), sizeof(float), row.size(), f) == row.size();
+  }
+  if (fclose(f) != 0 || !ok) {
+    printf("Unable to write %s\n", path);
+    return false;
+  }
+  return true;
+}
+
+// EXR header attributes: a name, a type, the size of the value and the value
+static void attribute(std::string &header, const char *name, const char *type,
+                      const void *value, int size) {
+  header.append(name, strlen(name) + 1);
+  header.append(type, strlen(type) + 1);
+  header.append((const char *)&size, sizeof(size));
+  header.append((const char *)value, size);
+}
+
+static const int EXR_HALF = 1;
+static const int EXR_FLOAT = 2;
+// The widest and tallest image, and tile, read
+static const int64_t EXR_MAX_SIZE = 1 << 16;
+
+ExrTileWriter::ExrTileWriter(const char *path, int width, int height,
+                             int tileSize)
+    : ExrTileWriter(path, width, height,
+                    {{"R", false}, {"G", false}, {"B", false}}, tileSize) {}
+
+ExrTileWriter::ExrTileWriter(const char *path, int width, int height,
+                             const std::vector<ExrChannel> &channels,
+                             int tileSize)
+    : f(fopen(path, "wb")), width(width), height(height),
+      tileSize(std::max(1, tileSize)), channels(channels) {
+  if (f == nullptr) {
+    printf("Unable to write %s\n", path);
+    return;
+  }
+  // Channels are stored in alphabetical order
+  for (size_t i = 0; i < channels.size(); i++)
+    order.push_back(i);
+  std::sort(order.begin(), order.end(), [&channels](int a, int b) {
+    return channels[a].name < channels[b].name;
+  });
+  size_t pixelBytes = 0;
+  for (const ExrChannel &channel : channels)
+    pixelBytes += channel.full ? sizeof(float) : sizeof(uint16_t);
+  chunk.resize((size_t)this->tileSize * this->tileSize * pixelBytes);
+
+  std::string header;
+  // The magic number, then version 2 with the flag for a single tiled part
+  const int32_t magic = 20000630;
+  const int32_t version = 2 | 0x200;
+  header.append((const char *)&magic, sizeof(magic));
+  header.append((const char *)&version, sizeof(version));
+
+  std::string list;
+  for (int i : order) {
+    // Type, linear flag and padding, and no subsampling
+    const int32_t layout[4] = {channels[i].full ? EXR_FLOAT : EXR_HALF, 0, 1,
+                               1};
+    list.append(channels[i].name.c_str(), channels[i].name.size() + 1);
+    list.append((const char *)layout, sizeof(layout));
+  }
+  list.push_back('\0');
+  attribute(header, "channels", "chlist", list.data(), list.size());
+  const unsigned char noCompression = 0;
+  attribute(header, "compression", "compression", &noCompression, 1);
+  const int32_t window[4] = {0, 0, width - 1, height - 1};
+  attribute(header, "dataWindow", "box2i", window, sizeof(window));
+  attribute(header, "displayWindow", "box2i", window, sizeof(window));
+  // Tiles may be written in any order
+  const unsigned char randomY = 2;
+  attribute(header, "lineOrder", "lineOrder", &randomY, 1);
+  const float aspect = 1;
+  attribute(header, "pixelAspectRatio", "float", &aspect, sizeof(aspect));
+  const float centre[2] = {0, 0};
+  attribute(header, "screenWindowCenter", "v2f", centre, sizeof(centre));
+  attribute(header, "screenWindowWidth", "float", &aspect, sizeof(aspect));
+  // Tile size and a single level
+  unsigned char tiles[9];
+  const uint32_t size[2] = {(uint32_t)this->tileSize,
+                            (uint32_t)this->tileSize};
+  memcpy(tiles, size, sizeof(size));
+  tiles[8] = 0;
+  attribute(header, "tiles", "tiledesc", tiles, sizeof(tiles));
+  header.push_back('\0');
+
+  offsets.assign((size_t)tilesX() * tilesY(), 0);
+  ok = fwrite(header.data(), 1, header.size(), f) == header.size();
+  tableOffset = header.size();
+  // Room for the offsets, filled in by close()
+  ok = ok && fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), f) ==
+                 offsets.size();
+}
+
+ExrTileWriter::~ExrTileWriter() {
+  if (f != nullptr)
+    fclose(f);
+}
+
+bool ExrTileWriter::writeTile(int tx, int ty, const float *pixels,
+                              int stride) {
+  if (!good() || tx < 0 || ty < 0 || tx >= tilesX() || ty >= tilesY())
+    return false;
+  const int w = std::min(tileSize, width - tx * tileSize);
+  const int h = std::min(tileSize, height - ty * tileSize);
+  // Each line holds all of the values of its first channel, then all of the
+  // second's, and so on
+  const int count = channels.size();
+  unsigned char *at = chunk.data();
+  for (int y = 0; y < h; y++) {
+    const float *row = pixels + (size_t)y * stride;
+    for (int c : order) {
+      for (int x = 0; x < w; x++) {
+        const float v = row[x * count + c];
+        if (channels[c].full) {
+          memcpy(at, &v, sizeof(v));
+          at += sizeof(v);
+        } else {
+          const uint16_t half = floatToHalf(v);
+          memcpy(at, &half, sizeof(half));
+          at += sizeof(half);
+        }
+      }
+    }
+  }
+
+  const size_t size = at - chunk.data();
+  const int32_t tile[5] = {tx, ty, 0, 0, (int32_t)size};
+  offsets[(size_t)ty * tilesX() + tx] = ftell(f);
+  ok = fwrite(tile, sizeof(tile), 1, f) == 1 &&
+       fwrite(chunk.data(), 1, size, f) == size;
+  return ok;
+}
+
+bool ExrTileWriter::close() {
+  if (f == nullptr)
+    return false;
+  bool complete = true;
+  for (uint64_t offset : offsets)
+    complete = complete && offset != 0;
+  if (ok && complete)
+    ok = fseek(f, tableOffset, SEEK_SET) == 0 &&
+         fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), f) ==
+             offsets.size();
+  ok = fclose(f) == 0 && ok && complete;
+  f = nullptr;
+  return ok;
+}
+
+// The passes of s that have been gathered for every pixel
+static std::vector<AovPass> gatheredAovs(const Scene &s) {
+  const size_t count = (size_t)s.getWidth() * s.getHeight();
+  std::vector<AovPass> passes;
+  if (s.aovSamples.size() != count)
+    return passes;
+  for (int p = 0; p < AOV_COUNT; p++) {
+    const AovPass pass = (AovPass)p;
+    if (s.aovSums[pass].size() == count * aovChannels(pass))
+      passes.push_back(pass);
+  }
+  return passes;
+}
+
+// The EXR channels of pass, in the order its values are stored
+static void addAovChannels(AovPass pass, std::vector<ExrChannel> &channels) {
+  const std::string name = aovName(pass);
+  if (pass == AOV_DEPTH) {
+    channels.push_back({"Z", true});
+  } else if (pass == AOV_OBJECT_ID) {
+    channels.push_back({name, true});
+  } else {
+    const char *components = pass == AOV_NORMAL ? "XYZ" : "RGB";
+    for (int c = 0; c < 3; c++)
+      channels.push_back({name + "." + components[c], false});
+  }
+}
+
+// Appends the average of pass over each of the w x h pixels of s from
+// (x0, y0) to the pixels of out, which have stride floats and are filled up
+// to at
+static void resolveAov(const Scene &s, AovPass pass, int x0, int y0, int w,
+                       int h, float *out, int stride, int at) {
+  const int width = s.getWidth();
+  const int channels = aovChannels(pass);
+  for (int y = 0; y < h; y++) {
+    const size_t row = (size_t)(y0 + y) * width + x0;
+    const float *in = s.aovSums[pass].data() + row * channels;
+    const unsigned int *counts = s.aovSamples.data() + row;
+    for (int x = 0; x < w; x++) {
+      // IDs are not sums
+      const float scale = pass == AOV_OBJECT_ID
+                              ? 1.0f
+                              : 1.0f / (counts[x] > 0 ? counts[x] : 1);
+      float *to = out + (size_t)(y * w + x) * stride + at;
+      for (int c = 0; c < channels; c++)
+        to[c] = in[x * channels + c] * scale;
+    }
+  }
+}
+
+bool writeEXR(const Scene &s, const char *path) {
+  if (!hasImage(s))
+    return false;
+  const int tileSize = 64;
+  const std::vector<AovPass> passes = gatheredAovs(s);
+  std::vector<ExrChannel> channels = {
+      {"R", false}, {"G", false}, {"B", false}};
+  for (AovPass pass : passes)
+    addAovChannels(pass, channels);
+  const int stride = channels.size();
+  ExrTileWriter writer(path, s.getWidth(), s.getHeight(), channels, tileSize);
+  std::vector<float> rgb((size_t)tileSize * tileSize * 3);
+  std::vector<float> tile((size_t)tileSize * tileSize * stride);
+  for (int ty = 0; writer.good() && ty < writer.tilesY(); ty++) {
+    for (int tx = 0; writer.good() && tx < writer.tilesX(); tx++) {
+      const int x0 = tx * tileSize, y0 = ty * tileSize;
+      const int w = std::min(tileSize, s.getWidth() - x0);
+      const int h = std::min(tileSize, s.getHeight() - y0);
+      resolve(s, x0, y0, w, h, rgb.data(), w * 3);
+      for (int i = 0; i < w * h; i++)
+        for (int c = 0; c < 3; c++)
+          tile[(size_t)i * stride + c] = rgb[(size_t)i * 3 + c];
+      int at = 3;
+      for (AovPass pass : passes) {
+        resolveAov(s, pass, x0, y0, w, h, tile.data(), stride, at);
+        at += aovChannels(pass);
+      }
+      writer.writeTile(tx, ty, tile.data(), w * stride);
+    }
+  }
+  if (!writer.close()) {
+    printf("Unable to write %s\n", path);
+    return false;
+  }
+  return true;
+}
+
+static bool readFile(const char *path, std::vector<unsigned char> &data) {
+  FILE *f = fopen(path, "rb");
+  if (f == nullptr) {
+    printf("Unable to open %s\n", path);
+    return false;
+  }
+  bool ok = fseek(f, 0, SEEK_END) == 0;
+  const long size = ok ? ftell(f) : -1;
+  ok = ok && size >= 0 && fseek(f, 0, SEEK_SET) == 0;
+  if (ok) {
+    data.resize(size);
+    ok = fread(data.data(), 1, size, f) == (size_t)size;
+  }
+  fclose(f);
+  if (!ok)
+    printf("Unable to read %s\n", path);
+  return ok;
+}
+
+bool readPFM(const char *path, HdrImage &image) {
+  FILE *f = fopen(path, "rb");
+  if (f == nullptr) {
+    printf("Unable to open %s\n", path);
+    return false;
+  }
+  char type[3] = {0};
+  int width = 0, height = 0;
+  float scale = 0;
+  bool ok = fscanf(f, "%2s %d %d %f", type, &width, &height, &scale) == 4 &&
+            fgetc(f) != EOF && width > 0 && height > 0 && scale != 0 &&
+            (strcmp(type, "PF") == 0 || strcmp(type, "Pf") == 0);
+  const int channels = type[1] == 'F' ? 3 : 1;
+  std::vector<float> row;
+  if (ok) {
+    image.width = width;
+    image.height = height;
+    image.rgb.assign((size_t)width * height * 3, 0.0f);
+    row.resize((size_t)width * channels);
+  }
+  // Rows go from the bottom up
+  for (int y = height - 1; ok && y >= 0; y--) {
+    ok = fread(row.data(), sizeof(float), row.size(), f) == row.size();
+    for (int x = 0; ok && x < width; x++) {
+      for (int c = 0; c < 3; c++) {
+        float v = row[(size_t)x * channels + (channels == 3 ? c : 0)];
+        // A positive scale means big endian
+        if (scale > 0) {
+          uint32_t bits;
+          memcpy(&bits, &v, sizeof(bits));
+          bits = (bits >> 24) | ((bits >> 8) & 0xff00) |
+                 ((bits << 8) & 0xff0000) | (bits << 24);
+          memcpy(&v, &bits, sizeof(v));
+        }
+        image.rgb[((size_t)y * width + x) * 3 + c] = v;
+      }
+    }
+  }
+  fclose(f);
+  if (!ok)
+    printf("%s is not a valid PFM\n", path);
+  return ok;
+}
+
+// Reads values from a buffer, failing instead of reading past its end
+struct ExrReader {
+  const std::vector<unsigned char> &data;
+  size_t at = 0;
+  bool ok = true;
+
+  ExrReader(const std::vector<unsigned char> &data) : data(data) {}
+
+  template <class T> T read() {
+    T value = T();
+    if (at + sizeof(T) > data.size()) {
+      ok = false;
+      return value;
+    }
+    memcpy(&value, data.data() + at, sizeof(T));
+    at += sizeof(T);
+    return value;
+  }
+
+  std::string string() {
+    std::string s;
+    while (at < data.size() && data[at] != 0)
+      s.push_back(data[at++]);
+    ok = ok && at < data.size();
+    at++;
+    return s;
+  }
+};
+
+bool readEXR(const char *path, HdrImage &image) {
+  std::vector<unsigned char> data;
+  if (!readFile(path, data))
+    return false;
+
+  ExrReader in(data);
+  const int32_t magic = in.read<int32_t>();
+  const int32_t version = in.read<int32_t>();
+  // Multi-part and deep files aren't read
+  bool ok = in.ok && magic == 20000630 && (version & 0xff) == 2 &&
+            (version & 0x1800) == 0;
+  const bool tiled = (version & 0x200) != 0;
+
+  // Channel name, type and position in a line
+  std::vector<std::string> names;
+  std::vector<int> types;
+  int compression = -1;
+  int32_t window[4] = {0, 0, -1, -1};
+  uint32_t tileSize[2] = {0, 0};
+  while (ok) {
+    const std::string name = in.string();
+    if (name.empty())
+      break;
+    const std::string type = in.string();
+    const int32_t size = in.read<int32_t>();
+    const size_t end = in.at + size;
+    ok = in.ok && size >= 0 && end <= data.size();
+    if (!ok)
+      break;
+    if (name == "channels") {
+      while (in.at < end) {
+        const std::string channel = in.string();
+        if (channel.empty())
+          break;
+        names.push_back(channel);
+        types.push_back(in.read<int32_t>());
+        in.read<int32_t>();
+        in.read<int32_t>();
+        in.read<int32_t>();
+      }
+    } else if (name == "compression" && size >= 1) {
+      compression = data[in.at];
+    } else if (name == "dataWindow" && size == sizeof(window)) {
+      memcpy(window, data.data() + in.at, sizeof(window));
+    } else if (name == "tiles" && size == 9) {
+      memcpy(tileSize, data.data() + in.at, sizeof(tileSize));
+      // Only single level images
+      ok = (data[in.at + 8] & 0xf) == 0;
+    }
+    in.at = end;
+    ok = ok && in.ok;
+  }
+
+  // Worked out wide enough not to overflow, whatever the file says
+  const int64_t wide = (int64_t)window[2] - window[0] + 1;
+  const int64_t high = (int64_t)window[3] - window[1] + 1;
+  ok = ok && wide > 0 && high > 0 && wide <= EXR_MAX_SIZE &&
+       high <= EXR_MAX_SIZE && tileSize[0] <= EXR_MAX_SIZE &&
+       tileSize[1] <= EXR_MAX_SIZE;
+  const int width = ok ? wide : 0;
+  const int height = ok ? high : 0;
+  int rgb[3] = {-1, -1, -1};
+  for (size_t i = 0; i < names.size(); i++) {
+    ok = ok && (types[i] == EXR_HALF || types[i] == EXR_FLOAT);
+    for (int c = 0; c < 3; c++)
+      if (names[i] == std::string(1, "RGB"[c]))
+        rgb[c] = i;
+  }
+  ok = ok && compression == 0 && width > 0 && height > 0 && rgb[0] >= 0 &&
+       rgb[1] >= 0 && rgb[2] >= 0 && (!tiled || (tileSize[0] > 0 &&
+                                                  tileSize[1] > 0));
+  if (!ok) {
+    printf("%s is not an uncompressed RGB EXR\n", path);
+    return false;
+  }
+
+  // Scanline files have a chunk per line
+  const int chunkWidth = tiled ? tileSize[0] : width;
+  const int chunkHeight = tiled ? tileSize[1] : 1;
+  const int chunksX = (width + chunkWidth - 1) / chunkWidth;
+  const int chunksY = (height + chunkHeight - 1) / chunkHeight;
+  std::vector<uint64_t> offsets((size_t)chunksX * chunksY);
+  for (uint64_t &offset : offsets)
+    offset = in.read<uint64_t>();
+
+  image.width = width;
+  image.height = height;
+  image.rgb.assign((size_t)width * height * 3, 0.0f);
+  ok = in.ok;
+  for (size_t i = 0; ok && i < offsets.size(); i++) {
+    if (offsets[i] >= data.size()) {
+      ok = false;
+      break;
+    }
+    in.at = offsets[i];
+    int64_t x = 0, y = 0;
+    if (tiled) {
+      x = (int64_t)in.read<int32_t>() * chunkWidth;
+      y = (int64_t)in.read<int32_t>() * chunkHeight;
+      in.read<int32_t>();
+      in.read<int32_t>();
+    } else {
+      y = (int64_t)in.read<int32_t>() - window[1];
+    }
+    in.read<int32_t>();
+    ok = in.ok && x >= 0 && y >= 0 && x < width && y < height;
+    const int x0 = ok ? x : 0, y0 = ok ? y : 0;
+    const int w = std::min(chunkWidth, width - x0);
+    const int h = std::min(chunkHeight, height - y0);
+    for (int y = 0; ok && y < h; y++) {
+      for (size_t channel = 0; ok && channel < names.size(); channel++) {
+        const int c = channel == (size_t)rgb[0]   ? 0
+                      : channel == (size_t)rgb[1] ? 1
+                      : channel == (size_t)rgb[2] ? 2
+                                                  : -1;
+        for (int x = 0; x < w; x++) {
+          const float v = types[channel] == EXR_HALF
+                              ? halfToFloat(in.read<uint16_t>())
+                              : in.read<float>();
+          if (c >= 0)
+            image.rgb[((size_t)(y0 + y) * width + x0 + x) * 3 + c] = v;
+        }
+        ok = in.ok;
+      }
+    }
+  }
+  if (!ok)
+    printf("%s is truncated\n", path);
+  return ok;
+}
+
+bool readHDR(const char *path, HdrImage &image) {
+  const char *extension = strrchr(path, '.');
+  if (extension != nullptr && strcmp(extension, ".pfm") == 0)
+    return readPFM(path, image);
+  if (extension != nullptr && strcmp(extension, ".exr") == 0)
+    return readEXR(path, image);
+  printf("%s is neither a .pfm nor an .exr\n", path);
+  return false;
+}
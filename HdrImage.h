@@ -0,0 +1,103 @@
+#ifndef _HDR_IMAGE_H
+#define _HDR_IMAGE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "Scene.h"
+
+// Lossless output of the linear radiance a scene accumulated, and of its AOV
+// passes, for compositing and for comparing renders against references.
+// Nothing is tonemapped.
+
+// A linear RGB image read back from a file, rows from the top, 3 floats a
+// pixel
+struct HdrImage {
+  int width = 0;
+  int height = 0;
+  std::vector<float> rgb;
+};
+
+// IEEE half precision, rounding to the nearest
+uint16_t floatToHalf(float f);
+
+float halfToFloat(uint16_t h);
+
+// A channel of an EXR file, stored as a full float or a half
+struct ExrChannel {
+  std::string name;
+  bool full;
+};
+
+// Writes an OpenEXR file of the given channels, half float R, G and B by
+// default, uncompressed and cut into square tiles, one tile at a time. Tiles
+// can be written in any order as they finish, so a huge image never has to be
+// held in memory; the offsets of the tiles are filled in by close().
+class ExrTileWriter {
+public:
+  ExrTileWriter(const char *path, int width, int height, int tileSize = 64);
+
+  ExrTileWriter(const char *path, int width, int height,
+                const std::vector<ExrChannel> &channels, int tileSize = 64);
+
+  // Closes the file if close() wasn't called, leaving it incomplete
+  ~ExrTileWriter();
+
+  ExrTileWriter(const ExrTileWriter &) = delete;
+
+  ExrTileWriter &operator=(const ExrTileWriter &) = delete;
+
+  // Whether the file is open and every write so far has worked
+  bool good() const { return f != nullptr && ok; }
+
+  int tilesX() const { return (width + tileSize - 1) / tileSize; }
+
+  int tilesY() const { return (height + tileSize - 1) / tileSize; }
+
+  // The pixels of tile (tx, ty), cut off at the edges of the image, as a
+  // float per channel each, in the order the channels were given, with rows
+  // stride floats apart
+  bool writeTile(int tx, int ty, const float *pixels, int stride);
+
+  // Writes the table of tile offsets and closes the file. Fails if a tile
+  // was never written.
+  bool close();
+
+private:
+  FILE *f;
+  int width;
+  int height;
+  int tileSize;
+  std::vector<ExrChannel> channels;
+  // The channels in the order the file stores them, alphabetical
+  std::vector<int> order;
+  bool ok = true;
+  // Where the table of offsets starts, and where each tile was written
+  long tableOffset = 0;
+  std::vector<uint64_t> offsets;
+  // One tile as it is stored, reused
+  std::vector<unsigned char> chunk;
+};
+
+// The average radiance of every pixel of s, written as a PFM (rows from the
+// bottom, 32 bit floats) a row at a time, or as a tiled half float EXR a tile
+// at a time. The EXR also holds every AOV pass s has gathered, averaged the
+// same way: a colour pass as the layer named after it ("direct.R" and so on,
+// "normal.X" to "normal.Z" for normals), the depth as Z and object IDs as id,
+// both full floats.
+bool writePFM(const Scene &s, const char *path);
+
+bool writeEXR(const Scene &s, const char *path);
+
+// Reads a PFM (colour or grey), or an uncompressed EXR of half or float
+// channels that has R, G and B, tiled or in scanlines
+bool readPFM(const char *path, HdrImage &image);
+
+bool readEXR(const char *path, HdrImage &image);
+
+// One of the above, picked by the extension
+bool readHDR(const char *path, HdrImage &image);
+
+#endif
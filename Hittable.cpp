@@ -0,0 +1,134 @@
+#include "Hittable.h"
+
+#include <cmath>
+
+static double component(const Vec &v, int axis) {
+  return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+// Solves dp = dpdu * du + dpdv * dv for du and dv, using the two axes the
+// surface is least edge on to
+static bool solveUV(const hitRecord &rec, const Vec &dp, double &du,
+                    double &dv) {
+  int a0, a1;
+  if (std::fabs(rec.normal.x) > std::fabs(rec.normal.y) &&
+      std::fabs(rec.normal.x) > std::fabs(rec.normal.z)) {
+    a0 = 1;
+    a1 = 2;
+  } else if (std::fabs(rec.normal.y) > std::fabs(rec.normal.z)) {
+    a0 = 0;
+    a1 = 2;
+  } else {
+    a0 = 0;
+    a1 = 1;
+  }
+
+  const double m00 = component(rec.dpdu, a0), m01 = component(rec.dpdv, a0);
+  const double m10 = component(rec.dpdu, a1), m11 = component(rec.dpdv, a1);
+  const double det = m00 * m11 - m01 * m10;
+  if (std::fabs(det) < 1e-12)
+    return false;
+  du = (m11 * component(dp, a0) - m01 * component(dp, a1)) / det;
+  dv = (m00 * component(dp, a1) - m10 * component(dp, a0)) / det;
+  return true;
+}
+
+void computeDifferentials(const Ray &r, hitRecord &rec) {
+  rec.dpdx = Vec(0, 0, 0);
+  rec.dpdy = Vec(0, 0, 0);
+  rec.dudx = rec.dvdx = rec.dudy = rec.dvdy = 0;
+  if (!r.hasDifferentials)
+    return;
+
+  // Where the neighbouring rays meet the tangent plane
+  const double plane = dotProduct(rec.normal, rec.p.direction());
+  const double nx = dotProduct(rec.normal, r.rxDirection);
+  const double ny = dotProduct(rec.normal, r.ryDirection);
+  if (nx == 0 || ny == 0)
+    return;
+  const double tx =
+      (plane - dotProduct(rec.normal, r.rxOrigin.direction())) / nx;
+  const double ty =
+      (plane - dotProduct(rec.normal, r.ryOrigin.direction())) / ny;
+  rec.dpdx = sub(add(r.rxOrigin.direction(), scale(tx, r.rxDirection)),
+                 rec.p.direction());
+  rec.dpdy = sub(add(r.ryOrigin.direction(), scale(ty, r.ryDirection)),
+                 rec.p.direction());
+
+  if (!solveUV(rec, rec.dpdx, rec.dudx, rec.dvdx) ||
+      !solveUV(rec, rec.dpdy, rec.dudy, rec.dvdy)) {
+    rec.dudx = rec.dvdx = rec.dudy = rec.dvdy = 0;
+  }
+}
+
+// Change of the normal across a pixel
+static Vec normalChange(const hitRecord &rec, double du, double dv) {
+  return add(scale(du, rec.dndu), scale(dv, rec.dndv));
+}
+
+void reflectDifferentials(const Ray &in, const hitRecord &rec, const Vec &wo,
+                          const Vec &wi, Ray &out) {
+  out.hasDifferentials = in.hasDifferentials;
+  if (!in.hasDifferentials)
+    return;
+
+  const Vec &n = rec.normal;
+  const Vec d = unitVec(in.direction);
+  const Vec dndx = normalChange(rec, rec.dudx, rec.dvdx);
+  const Vec dndy = normalChange(rec, rec.dudy, rec.dvdy);
+  const Vec dwodx = sub(d, unitVec(in.rxDirection));
+  const Vec dwody = sub(d, unitVec(in.ryDirection));
+  const double dDNdx = dotProduct(dwodx, n) + dotProduct(wo, dndx);
+  const double dDNdy = dotProduct(dwody, n) + dotProduct(wo, dndy);
+  const double cosine = dotProduct(wo, n);
+
+  // Derivative of wi = -wo + 2 (wo . n) n
+  out.rxOrigin = add(rec.p, point(rec.dpdx));
+  out.ryOrigin = add(rec.p, point(rec.dpdy));
+  out.rxDirection =
+      add(sub(wi, dwodx),
+          scale(2, add(scale(cosine, dndx), scale(dDNdx, n))));
+  out.ryDirection =
+      add(sub(wi, dwody),
+          scale(2, add(scale(cosine, dndy), scale(dDNdy, n))));
+}
+
+void refractDifferentials(const Ray &in, const hitRecord &rec, const Vec &wo,
+                          const Vec &wi, float eta, Ray &out) {
+  out.hasDifferentials = in.hasDifferentials;
+  if (!in.hasDifferentials)
+    return;
+
+  // The formulas want the normal on wo's side
+  const bool flip = dotProduct(wo, rec.normal) < 0;
+  const Vec n = flip ? -rec.normal : rec.normal;
+  Vec dndx = normalChange(rec, rec.dudx, rec.dvdx);
+  Vec dndy = normalChange(rec, rec.dudy, rec.dvdy);
+  if (flip) {
+    dndx = -dndx;
+    dndy = -dndy;
+  }
+
+  const Vec d = unitVec(in.direction);
+  const Vec dwodx = sub(d, unitVec(in.rxDirection));
+  const Vec dwody = sub(d, unitVec(in.ryDirection));
+  const double dDNdx = dotProduct(dwodx, n) + dotProduct(wo, dndx);
+  const double dDNdy = dotProduct(dwody, n) + dotProduct(wo, dndy);
+
+  const double cosO = dotProduct(wo, n);
+  const double cosI = std::fabs(dotProduct(wi, n));
+  if (cosI == 0) {
+    out.hasDifferentials = false;
+    return;
+  }
+  // Derivative of wi = -eta wo + mu n
+  const double mu = eta * cosO - cosI;
+  const double dmu = eta - (eta * eta * cosO) / cosI;
+
+  out.rxOrigin = add(rec.p, point(rec.dpdx));
+  out.ryOrigin = add(rec.p, point(rec.dpdy));
+  out.rxDirection = add(sub(wi, scale(eta, dwodx)),
+                        add(scale(mu, dndx), scale(dmu * dDNdx, n)));
+  out.ryDirection = add(sub(wi, scale(eta, dwody)),
+                        add(scale(mu, dndy), scale(dmu * dDNdy, n)));
+}
@@ -1,11 +1,13 @@
 #ifndef _HITTABLE_H
 #define _HITTABLE_H
 
+#include <cmath>
 #include <vector>
 
 #include "./Functions.h"
 #include "./Point.h"
 #include "./Ray.h"
+#include "./Sampler.h"
 #include "./Vec.h"
 #include "./aabb.h"
 
@@ -14,17 +16,52 @@ class Materials;
 // Stores time, the point, the normal, material of the object that was hit.
 // Normal is always outside, so a dot product needs to be taken to ensure
 // correct orientation.
+class Hittable;
+
 struct hitRecord {
   float t;
   Point p;
   Vec normal;
   Materials *matPtr;
+  // The scene object that was hit, filled in by the BVH
+  const Hittable *object = nullptr;
   
   double u;
   double v;
   // bool front_face;		
+
+  // How the point and the normal change with u and v. Every primitive sets
+  // these; they are zero where there is no parameterisation (media).
+  Vec dpdu, dpdv;
+  Vec dndu, dndv;
+
+  // Filled in by computeDifferentials() for rays that have differentials:
+  // how the point, u and v change from one pixel to the next
+  Vec dpdx, dpdy;
+  double dudx = 0, dvdx = 0, dudy = 0, dvdy = 0;
+
+  // Width of the pixel's footprint in uv space, for texture filtering
+  double uvWidth() const {
+    return 2 * std::fmax(std::fmax(std::fabs(dudx), std::fabs(dudy)),
+                         std::fmax(std::fabs(dvdx), std::fabs(dvdy)));
+  }
 };
 
+// Works out the dpdx/dudx... of rec from the differentials of r, by meeting
+// the neighbouring rays with the plane tangent to the hit. Sets them to zero
+// if r has none.
+void computeDifferentials(const Ray &r, hitRecord &rec);
+
+// Differentials of out, the ray that leaves rec after a mirror reflection of
+// wo into wi. in is the ray that arrived at rec.
+void reflectDifferentials(const Ray &in, const hitRecord &rec, const Vec &wo,
+                          const Vec &wi, Ray &out);
+
+// Differentials of out after refraction of wo into wi, where eta is the ratio
+// of refractive indices on wo's side over wi's side
+void refractDifferentials(const Ray &in, const hitRecord &rec, const Vec &wo,
+                          const Vec &wi, float eta, Ray &out);
+
 class Hittable {
 public:
   // Returns true if the ray has hit an object within tMin and tMax, and stores
@@ -36,15 +73,39 @@ public:
   // bounding box of the hittable object in outputBox
   virtual bool boundingBox(double t0, double t1, aabb &outputBox) const = 0;
 
+  // Boxes around the object at times t0 and t1, for objects that move in a
+  // straight line: at any time in between, the box interpolated between them
+  // must still hold the object. Anything else gives its box over the whole
+  // interval for both.
+  virtual bool motionBounds(double t0, double t1, aabb &start,
+                            aabb &end) const {
+    if (!boundingBox(t0, t1, start))
+      return false;
+    end = start;
+    return true;
+  }
+
   // The PDF value of the hittable object
   virtual double pdfValue(const Point& origin, const Vec& v) const {
     return 0.0;
   }
 
-  // random 
-  virtual Vec random(const Point& origin) const {
+  // A direction from origin towards a random point on the object, for
+  // sampling it as a light
+  virtual Vec random(const Point &origin, Sampler &sampler) const {
     return Vec(1, 0, 0);
   }
+
+  // True for participating media. Shadow rays pass through them, and the
+  // light they carry is scaled by transmittance() instead.
+  virtual bool participating() const { return false; }
+
+  // The fraction of light that gets through the object between tMin and tMax
+  // along the ray. Media may estimate it with random numbers.
+  virtual double transmittance(const Ray &r, double tMin, double tMax,
+                               Sampler &sampler) const {
+    return 1;
+  }
 };
 
 #endif // _HITTABLE_H
@@ -52,20 +113,66 @@ public:
 #ifndef _MATERIALS_H
 #define _MATERIALS_H
 
+// The lobes a material has, or the lobe a sample was taken from. Specular
+// lobes are delta distributions: they can be sampled but not evaluated, so
+// light sampling is skipped for them.
+enum BSDFFlags {
+  BSDF_NONE = 0,
+  BSDF_REFLECTION = 1,
+  BSDF_TRANSMISSION = 2,
+  BSDF_DIFFUSE = 4,
+  BSDF_GLOSSY = 8,
+  BSDF_SPECULAR = 16
+};
+
+// A sampled incoming direction. f already includes the cosine term, so the
+// sample is weighted by f / pdf. Specular samples use pdf = 1.
+struct BSDFSample {
+  Vec wi;
+  Point f;
+  double pdf;
+  int flags;
+};
+
+// Directions are unit vectors pointing away from the hit point: wo back along
+// the incoming ray, wi towards where the light comes from.
 class Materials {
 public:
-  virtual bool scatter(const Ray &ray, const hitRecord &rec, Point &attenuation,
-                       Ray &scattered, double &pdf) const = 0;
+  // The BSDF times |cos| of wi with the normal (just the phase function for
+  // media). Zero for specular lobes.
+  virtual Point eval(const hitRecord &rec, const Vec &wo, const Vec &wi) const {
+    return Point(0, 0, 0);
+  }
+
+  // Picks wi for wo, taking random numbers from the path's sampler. Returns
+  // false if the ray is absorbed.
+  virtual bool sample(const hitRecord &rec, const Vec &wo, Sampler &sampler,
+                      BSDFSample &s) const {
+    return false;
+  }
+
+  // Solid angle density of sample() picking wi. Zero for specular lobes.
+  virtual double pdf(const hitRecord &rec, const Vec &wo,
+                     const Vec &wi) const {
+    return 0;
+  }
+
+  // The lobes of the material
+  virtual int flags() const { return BSDF_NONE; }
+
+  // Gives out, the ray continuing along s, the differentials of in. Only
+  // specular lobes keep them; a diffuse bounce spreads over so much of the
+  // scene that they no longer mean anything.
+  virtual void differentials(const hitRecord &rec, const Vec &wo,
+                             const BSDFSample &s, const Ray &in,
+                             Ray &out) const {
+    out.hasDifferentials = false;
+  }
 
   virtual Point emitted(double u, double v, const Point &p, const hitRecord,
                         const Ray) const {
     return Point(0, 0, 0);
   };
-
-  virtual double scatteringPDF(const Ray &rIn, const hitRecord &rec,
-                               const Ray &rOut) const {
-    return 0;
-  }
 };
 
 #endif // _MATERIALS_H
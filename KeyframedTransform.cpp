@@ -0,0 +1,84 @@
+#include "KeyframedTransform.h"
+#include "Functions.h"
+#include "Ray.h"
+
+#include <algorithm>
+
+KeyframedTransform::KeyframedTransform(Hittable *hittablePtr,
+                                       const std::vector<Keyframe> &keyframes)
+    : hittablePtr(hittablePtr), keyframes(keyframes) {
+  std::sort(this->keyframes.begin(), this->keyframes.end(),
+            [](const Keyframe &a, const Keyframe &b) {
+              return a.time < b.time;
+            });
+}
+
+Vec KeyframedTransform::offset(double time) const {
+  if (keyframes.empty())
+    return Vec(0, 0, 0);
+  if (time <= keyframes.front().time)
+    return keyframes.front().offset;
+  if (time >= keyframes.back().time)
+    return keyframes.back().offset;
+
+  // The first keyframe after the time
+  auto next = std::upper_bound(
+      keyframes.begin(), keyframes.end(), time,
+      [](double t, const Keyframe &k) { return t < k.time; });
+  auto previous = next - 1;
+  const float f = (time - previous->time) / (next->time - previous->time);
+  return add(previous->offset, scale(f, sub(next->offset, previous->offset)));
+}
+
+bool KeyframedTransform::hit(const Ray &r, hitRecord &rec, double tMin,
+                             double tMax) const {
+  const Vec moveBy = offset(r.time);
+  // Copied so the ray keeps its sampler and time
+  Ray moved = r;
+  moved.origin = sub(r.origin, moveBy);
+  if (!hittablePtr->hit(moved, rec, tMin, tMax))
+    return false;
+
+  rec.p = add(rec.p, moveBy);
+  if (dotProduct(rec.normal, moved.direction) > 0) {
+    rec.normal = scale(-1, rec.normal);
+    rec.dndu = scale(-1, rec.dndu);
+    rec.dndv = scale(-1, rec.dndv);
+  }
+  return true;
+}
+
+bool KeyframedTransform::boundingBox(double t0, double t1,
+                                     aabb &outputBox) const {
+  aabb start, end;
+  if (!motionBounds(t0, t1, start, end))
+    return false;
+  outputBox = surroundingBox(start, end);
+  return true;
+}
+
+bool KeyframedTransform::motionBounds(double t0, double t1, aabb &start,
+                                      aabb &end) const {
+  aabb box;
+  if (!hittablePtr->boundingBox(t0, t1, box))
+    return false;
+
+  const Vec first = offset(t0);
+  const Vec last = offset(t1);
+  start = aabb(add(box.min, first), add(box.max, first));
+  end = aabb(add(box.min, last), add(box.max, last));
+
+  bool bent = false;
+  for (const Keyframe &k : keyframes) {
+    if (k.time > t0 && k.time < t1) {
+      start = surroundingBox(
+          start, aabb(add(box.min, k.offset), add(box.max, k.offset)));
+      bent = true;
+    }
+  }
+  if (bent) {
+    start = surroundingBox(start, end);
+    end = start;
+  }
+  return true;
+}
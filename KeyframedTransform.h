@@ -0,0 +1,43 @@
+#ifndef _KEYFRAMED_TRANSFORM_H
+#define _KEYFRAMED_TRANSFORM_H
+
+#include <vector>
+
+#include "Hittable.h"
+#include "Vec.h"
+
+// A position of a KeyframedTransform at a moment in time
+struct Keyframe {
+  double time;
+  Vec offset;
+};
+
+// An instance of a hittable object that is translated along a path. The
+// offset is interpolated linearly between keyframes and held at the first and
+// last keyframe outside of them.
+class KeyframedTransform : public Hittable {
+public:
+  // keyframes doesn't need to be sorted, but needs at least one entry
+  KeyframedTransform(Hittable *hittablePtr,
+                     const std::vector<Keyframe> &keyframes);
+
+  // The offset at a time
+  Vec offset(double time) const;
+
+  virtual bool hit(const Ray &r, hitRecord &rec, double tMin,
+                   double tMax) const override;
+
+  virtual bool boundingBox(double t0, double t1,
+                           aabb &outputBox) const override;
+
+  // Between two keyframes the path is a straight line, so the ends of the
+  // interval are enough. Keyframes inside the interval bend the path, and the
+  // union of every position is used for both.
+  virtual bool motionBounds(double t0, double t1, aabb &start,
+                            aabb &end) const override;
+
+  Hittable *hittablePtr;
+  std::vector<Keyframe> keyframes;
+};
+
+#endif
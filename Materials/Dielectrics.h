@@ -10,35 +10,58 @@ class Dielectrics : public Materials {
 public:
   Dielectrics(float refractIdx) : refractIdx(refractIdx) {}
 
-  virtual bool scatter(const Ray &ray, const hitRecord &rec, Point &attenuation,
-                       Ray &scattered, double &pdf) const {
-    attenuation = Point(1, 1, 1);
+  // Picks between reflection and refraction with the Fresnel factor
+  bool sample(const hitRecord &rec, const Vec &wo, Sampler &sampler,
+              BSDFSample &s) const override {
+    const Vec direction = -wo;
+    s.f = Point(1, 1, 1);
+    s.pdf = 1;
+    const float uc = sampler.next();
     // Ray is going out of a dielectric
-    if (dotProduct(ray.direction, rec.normal) > 0.0) {
-      float cosine =
-          refractIdx * dotProduct(unitVec(ray.direction), rec.normal);
+    if (dotProduct(direction, rec.normal) > 0.0) {
+      float cosine = refractIdx * dotProduct(direction, rec.normal);
       float sine = sqrt(1.0 - cosine * cosine);
-      if ((refractIdx * sine > 1.0) || drand48() < schlick(cosine, refractIdx))
-        scattered =
-            Ray(rec.p, reflection(scale(-1, rec.normal), ray.direction));
-      else
-        scattered = Ray(
-            rec.p, refract(ray.direction, scale(-1, rec.normal), refractIdx));
+      if ((refractIdx * sine > 1.0) || uc < schlick(cosine, refractIdx)) {
+        s.wi = reflection(scale(-1, rec.normal), direction);
+        s.flags = BSDF_SPECULAR | BSDF_REFLECTION;
+      } else {
+        s.wi = refract(direction, scale(-1, rec.normal), refractIdx);
+        s.flags = BSDF_SPECULAR | BSDF_TRANSMISSION;
+      }
     } else {
-      float cosine = -dotProduct(unitVec(ray.direction), rec.normal);
+      float cosine = -dotProduct(direction, rec.normal);
       float sine = sqrt(1.0 - cosine * cosine);
       // If there is total internal reflection || fresnel effect on glancing
       // edges
       if (((1.0f / refractIdx) * sine > 1.0) ||
-          drand48() < schlick(cosine, (1.0f / refractIdx)))
-        scattered = Ray(rec.p, reflection(rec.normal, ray.direction));
-      else
-        scattered =
-            Ray(rec.p, refract(ray.direction, rec.normal, (1.0f / refractIdx)));
+          uc < schlick(cosine, (1.0f / refractIdx))) {
+        s.wi = reflection(rec.normal, direction);
+        s.flags = BSDF_SPECULAR | BSDF_REFLECTION;
+      } else {
+        s.wi = refract(direction, rec.normal, (1.0f / refractIdx));
+        s.flags = BSDF_SPECULAR | BSDF_TRANSMISSION;
+      }
     }
+    s.wi = unitVec(s.wi);
     return true;
   }
 
+  int flags() const override {
+    return BSDF_SPECULAR | BSDF_REFLECTION | BSDF_TRANSMISSION;
+  }
+
+  void differentials(const hitRecord &rec, const Vec &wo, const BSDFSample &s,
+                     const Ray &in, Ray &out) const override {
+    if (s.flags & BSDF_REFLECTION) {
+      reflectDifferentials(in, rec, wo, s.wi, out);
+    } else {
+      // The same ratio sample() refracted with
+      const float eta = dotProduct(wo, rec.normal) < 0.0 ? refractIdx
+                                                          : 1.0f / refractIdx;
+      refractDifferentials(in, rec, wo, s.wi, eta, out);
+    }
+  }
+
   float refractIdx;
 };
 
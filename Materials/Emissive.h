@@ -4,27 +4,23 @@
 #include "../Functions.h"
 #include "../Hittable.h"
 #include "../Ray.h"
-#include "../Textures/SolidColour.h"
-#include "../Textures/Texture.h"
+#include "../Textures/TextureInput.h"
 #include "../Vec.h"
 
 class Emissive : public Materials {
 public:
-  Emissive(const Point &a) : emit(new SolidColour(a)) {}
+  Emissive(const Point &a) : emit(a) {}
   Emissive(const Texture *a) : emit(a){};
-  bool scatter(const Ray &ray, const hitRecord &rec, Point &attenuation,
-               Ray &scattered, double& pdf) const {
-    return false; // never scatters, duh
-  }
+  // never scatters, duh, so sample() keeps returning false
 
   // unidirectional light 
   Point emitted(double u, double v, const Point &p, const hitRecord rec, const Ray ray) const override {
     if(dotProduct(rec.normal, ray.direction) >= 0) return Point(0, 0, 0);
     else
-      return emit->value(u, v, p);
+      return emit.at(u, v, p);
   }
 
-  const Texture *emit;
+  TextureInput emit;
 };
 
 #endif
@@ -4,23 +4,40 @@
 #include "../Functions.h"
 #include "../Hittable.h"
 #include "../Ray.h"
-#include "../Textures/SolidColour.h"
-#include "../Textures/Texture.h"
+#include "../Textures/TextureInput.h"
 #include "../Vec.h"
 
-// Scatters a randomrayinsphere
+// Scatters uniformly in every direction. Used as the phase function of
+// participating media, so there is no cosine term.
 class Isotropic : public Materials {
 public:
-  Isotropic(Point c) : albedo(new SolidColour(c)) {}
-  Isotropic(Texture *t) : albedo(t) {}
-  Texture *albedo;
+  Isotropic(Point c) : albedo(c) {}
+  Isotropic(const Texture *t) : albedo(t) {}
+  TextureInput albedo;
 
-  virtual bool scatter(const Ray &ray, const hitRecord &rec, Point &attenuation,
-                       Ray &scattered, double& pdf) const override {
-    scattered = Ray(rec.p, randomRayInSphere(rec.normal));
-    attenuation = albedo->value(rec.u, rec.v, rec.p);
+  Point eval(const hitRecord &rec, const Vec &wo,
+             const Vec &wi) const override {
+    return scale(1 / (4 * PI),
+                 albedo.at(rec.u, rec.v, rec.p, rec.uvWidth()));
+  }
+
+  bool sample(const hitRecord &rec, const Vec &wo, Sampler &sampler,
+              BSDFSample &s) const override {
+    const float u1 = sampler.next();
+    s.wi = sphereDirection(u1, sampler.next());
+    s.pdf = 1 / (4 * PI);
+    s.f = scale(s.pdf,
+                albedo.at(rec.u, rec.v, rec.p, rec.uvWidth()));
+    s.flags = BSDF_DIFFUSE;
     return true;
   }
+
+  double pdf(const hitRecord &rec, const Vec &wo,
+             const Vec &wi) const override {
+    return 1 / (4 * PI);
+  }
+
+  int flags() const override { return BSDF_DIFFUSE; }
 };
 
 #endif
@@ -4,37 +4,53 @@
 #include "../Functions.h"
 #include "../Hittable.h"
 #include "../Ray.h"
-#include "../Textures/SolidColour.h"
-#include "../Textures/Texture.h"
+#include "../Textures/TextureInput.h"
 #include "../Vec.h"
 #include <limits>
 class Lambertian : public Materials {
 public:
-  Lambertian(const Point &a) : albedo(new SolidColour(a)) {}
+  Lambertian(const Point &a) : albedo(a) {}
   Lambertian(const Texture *a) : albedo(a){};
-  virtual bool scatter(const Ray &ray, const hitRecord &rec, Point &alb,
-                       Ray &scattered, double &pdf) const override {
-    // direction, follows a cosine distribution
-    Vec scatterDirection = add(rec.normal, randomRayInUnitVector());
+
+  Point eval(const hitRecord &rec, const Vec &wo,
+             const Vec &wi) const override {
+    double cosine = dotProduct(rec.normal, wi);
+    // absorb case where the cosine is negative
+    if (cosine <= 0)
+      return Point(0, 0, 0);
+    return scale(cosine / PI,
+                 albedo.at(rec.u, rec.v, rec.p, rec.uvWidth()));
+  }
+
+  bool sample(const hitRecord &rec, const Vec &wo, Sampler &sampler,
+              BSDFSample &s) const override {
+    // direction, follows a cosine distribution (the normal plus a point on
+    // the unit sphere)
+    const float u1 = sampler.next();
+    Vec scatterDirection = add(rec.normal, sphereDirection(u1, sampler.next()));
     if (isDegenerate(scatterDirection))
       scatterDirection = rec.normal;
-    scattered = Ray(rec.p, unitVec(scatterDirection));
-    alb = albedo->value(rec.u, rec.v, rec.p);
+    s.wi = unitVec(scatterDirection);
     // pdf of a lambertian reflectance model (same as the scattering
-    // reflectance) allowed to be negative to not throw divide by zero errors
-    pdf = dotProduct(rec.normal, scattered.direction) / PI;
+    // reflectance)
+    s.pdf = dotProduct(rec.normal, s.wi) / PI;
+    if (s.pdf <= 0)
+      return false;
+    s.f = scale(s.pdf,
+                albedo.at(rec.u, rec.v, rec.p, rec.uvWidth()));
+    s.flags = BSDF_DIFFUSE | BSDF_REFLECTION;
     return true;
   }
 
-  double scatteringPDF(const Ray &rIn, const hitRecord &rec,
-                       const Ray &rOut) const override {
-    double cosine = dotProduct(rec.normal, unitVec(rOut.direction));
-    // absorb case where the cosine is negative
-    // otherwise return scattering pdf of lambertian reflectance
-    return cosine / PI;
+  double pdf(const hitRecord &rec, const Vec &wo,
+             const Vec &wi) const override {
+    double cosine = dotProduct(rec.normal, wi);
+    return cosine <= 0 ? 0 : cosine / PI;
   }
 
-  const Texture *albedo;
+  int flags() const override { return BSDF_DIFFUSE | BSDF_REFLECTION; }
+
+  TextureInput albedo;
 };
 
 #endif
@@ -5,50 +5,56 @@
 #include "../Functions.h"
 #include "../Hittable.h"
 #include "../Ray.h"
-#include "../Textures/SolidColour.h"
-#include "../Textures/Texture.h"
+#include "../Textures/TextureInput.h"
 #include "../Vec.h"
 #include "../onb.h"
 
 class Lambertian_ONB : public Materials {
 public:
-  Lambertian_ONB(const Point &a) : albedo(new SolidColour(a)) {}
+  Lambertian_ONB(const Point &a) : albedo(a) {}
   Lambertian_ONB(const Texture *a) : albedo(a){};
-  virtual bool scatter(const Ray &ray, const hitRecord &rec, Point &alb,
-                       Ray &scattered, double &pdf) const override {
-    // direction, follows a cosine distribution
-    // std::cout << rec.normal << std::endl;
+
+  Point eval(const hitRecord &rec, const Vec &wo,
+             const Vec &wi) const override {
+    double cosine = dotProduct(rec.normal, wi);
+    if (cosine <= 0)
+      return Point(0, 0, 0);
+    return scale(cosine / PI,
+                 albedo.at(rec.u, rec.v, rec.p, rec.uvWidth()));
+  }
+
+  bool sample(const hitRecord &rec, const Vec &wo, Sampler &sampler,
+              BSDFSample &s) const override {
+    // direction, follows a cosine distribution around the normal
     onb uvw;
     uvw.buildFromW(rec.normal);
-    Vec rcpr = randomCosinePDFRay();
-    // std::cout << uvw.u() << std::endl;
-    // std::cout << uvw.v() << std::endl; //
-    // std::cout << uvw.w() << std::endl; //
-    // std::cout << rcpr << std::endl;
-    Vec scatterDirection = uvw.local(rcpr);
-    // std::cout << scatterDirection << std::endl;
+    const float u1 = sampler.next();
+    Vec scatterDirection = uvw.local(cosineDirection(u1, sampler.next()));
     if (isDegenerate(scatterDirection))
       scatterDirection = rec.normal;
-    scattered = Ray(rec.p, unitVec(scatterDirection));
-    alb = albedo->value(rec.u, rec.v, rec.p);
-    // std::cout << alb << std::endl; //
+    s.wi = unitVec(scatterDirection);
     // pdf of a lambertian reflectance model (same as the scattering
-    // reflectance) allowed to be negative to not throw divide by zero errors
-    // std::cout << scattered.direction << std::endl;
-    pdf = dotProduct(uvw.w(), scattered.direction) / PI;
-    // std::cout << pdf << std::endl;
+    // reflectance)
+    s.pdf = dotProduct(uvw.w(), s.wi) / PI;
+    if (s.pdf <= 0)
+      return false;
+    s.f = scale(s.pdf,
+                albedo.at(rec.u, rec.v, rec.p, rec.uvWidth()));
+    s.flags = BSDF_DIFFUSE | BSDF_REFLECTION;
     return true;
   }
 
-  double scatteringPDF(const Ray &rIn, const hitRecord &rec,
-                       const Ray &rOut) const override {
-    double cosine = dotProduct(rec.normal, unitVec(rOut.direction));
+  double pdf(const hitRecord &rec, const Vec &wo,
+             const Vec &wi) const override {
+    double cosine = dotProduct(rec.normal, wi);
     // absorb case where the cosine is negative
     // otherwise return scattering pdf of lambertian reflectance
     return cosine < 0 ? 0 : cosine / PI;
   }
 
-  const Texture *albedo;
+  int flags() const override { return BSDF_DIFFUSE | BSDF_REFLECTION; }
+
+  TextureInput albedo;
 };
 
 #endif
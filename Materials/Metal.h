@@ -7,6 +7,9 @@
 #include "../Vec.h"
 #include <iostream>
 
+// Mirror reflection, blurred by moving the reflected direction by up to fuzz.
+// The blurred lobe has no closed form density, so the whole material is
+// treated as specular: it is only ever sampled.
 class Metal : public Materials {
 public:
   Metal(const Point &a, float f) : albedo(a) {
@@ -15,15 +18,29 @@ public:
     else
       fuzz = 1;
   }
-  virtual bool scatter(const Ray &ray, const hitRecord &rec, Point &attenuation,
-                       Ray &scattered, double& pdf) const {
-    // std::cout << rec.normal.z << " " << ray.direction.x << " " <<
-    // ray.direction.y << " " << ray.direction.z << std::endl;
-    const Vec reflected = reflection(rec.normal, ray.direction);
-    scattered =
-        Ray(rec.p, add(reflected, scale(fuzz, randomRayInSphere(rec.normal))));
-    attenuation = albedo;
-    return (dotProduct(scattered.direction, rec.normal) > 0);
+
+  bool sample(const hitRecord &rec, const Vec &wo, Sampler &sampler,
+              BSDFSample &s) const override {
+    const Vec direction = -wo;
+    const Vec reflected = reflection(rec.normal, direction);
+    const float u1 = sampler.next();
+    const float u2 = sampler.next();
+    Vec offset = ballPoint(u1, u2, sampler.next());
+    // Keep the offset in the same hemisphere as the normal
+    if (dotProduct(offset, rec.normal) < 0)
+      offset = -offset;
+    s.wi = unitVec(add(reflected, scale(fuzz, offset)));
+    s.f = albedo;
+    s.pdf = 1;
+    s.flags = BSDF_SPECULAR | BSDF_REFLECTION;
+    return (dotProduct(s.wi, rec.normal) > 0);
+  }
+
+  int flags() const override { return BSDF_SPECULAR | BSDF_REFLECTION; }
+
+  void differentials(const hitRecord &rec, const Vec &wo, const BSDFSample &s,
+                     const Ray &in, Ray &out) const override {
+    reflectDifferentials(in, rec, wo, s.wi, out);
   }
 
   Point albedo;
@@ -0,0 +1,168 @@
+#include "Medium.h"
+#include "Functions.h"
+
+#include <algorithm>
+#include <cmath>
+
+HeterogeneousMedium::HeterogeneousMedium(const DensityField *field,
+                                         double densityScale,
+                                         const Point &albedo, int resolution)
+    : phase(albedo), field(field), densityScale(densityScale),
+      box(field->bounds()), resolution(resolution) {
+  phaseFunction = &phase;
+  cellSize = Vec((box.max.x - box.min.x) / resolution,
+                 (box.max.y - box.min.y) / resolution,
+                 (box.max.z - box.min.z) / resolution);
+
+  majorants.resize(resolution * resolution * resolution);
+  for (int z = 0; z < resolution; z++) {
+    for (int y = 0; y < resolution; y++) {
+      for (int x = 0; x < resolution; x++) {
+        const Point low(box.min.x + x * cellSize.x, box.min.y + y * cellSize.y,
+                        box.min.z + z * cellSize.z);
+        const Point high(low.x + cellSize.x, low.y + cellSize.y,
+                         low.z + cellSize.z);
+        majorants[(z * resolution + y) * resolution + x] =
+            field->maxDensity(aabb(low, high));
+      }
+    }
+  }
+}
+
+template <class Step>
+bool HeterogeneousMedium::track(const Ray &r, double tMin, double tMax,
+                                Sampler &sampler, Step step) const {
+  if (!box.clip(r, tMin, tMax))
+    return true;
+  const double rayLength = length(r.direction);
+
+  // Set up a 3D DDA through the majorant cells, starting where the ray
+  // enters the box
+  const float origin[3] = {r.origin.x, r.origin.y, r.origin.z};
+  const float direction[3] = {r.direction.x, r.direction.y, r.direction.z};
+  const float low[3] = {box.min.x, box.min.y, box.min.z};
+  const float size[3] = {cellSize.x, cellSize.y, cellSize.z};
+  const Point entry = r.pointAtTime(tMin);
+  const float start[3] = {entry.x, entry.y, entry.z};
+
+  int cell[3];
+  int stepSign[3];
+  double next[3];
+  double delta[3];
+  for (int axis = 0; axis < 3; axis++) {
+    cell[axis] = std::min(
+        resolution - 1,
+        std::max(0, (int)((start[axis] - low[axis]) / size[axis])));
+    if (direction[axis] > 0) {
+      stepSign[axis] = 1;
+      next[axis] =
+          (low[axis] + (cell[axis] + 1) * size[axis] - origin[axis]) /
+          direction[axis];
+      delta[axis] = size[axis] / direction[axis];
+    } else if (direction[axis] < 0) {
+      stepSign[axis] = -1;
+      next[axis] =
+          (low[axis] + cell[axis] * size[axis] - origin[axis]) /
+          direction[axis];
+      delta[axis] = -size[axis] / direction[axis];
+    } else {
+      stepSign[axis] = 0;
+      next[axis] = DBL_INF;
+      delta[axis] = DBL_INF;
+    }
+  }
+
+  double t = tMin;
+  while (true) {
+    const int axis = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2)
+                                       : (next[1] < next[2] ? 1 : 2);
+    const double exit = std::fmin(next[axis], tMax);
+
+    // Free flight through the cell with the majorant's density. Distances
+    // past the end of the cell are thrown away and sampling starts again in
+    // the next one, which the exponential distribution allows.
+    const double majorantDensity =
+        majorant(cell[0], cell[1], cell[2]) * densityScale;
+    if (majorantDensity > 0) {
+      const double perT = majorantDensity * rayLength;
+      while (true) {
+        t -= std::log(1 - sampler.next()) / perT;
+        if (t >= exit)
+          break;
+        if (!step(t, majorantDensity))
+          return false;
+      }
+    }
+
+    if (next[axis] >= tMax)
+      return true;
+    t = next[axis];
+    cell[axis] += stepSign[axis];
+    if (cell[axis] < 0 || cell[axis] >= resolution)
+      return true;
+    next[axis] += delta[axis];
+  }
+}
+
+bool HeterogeneousMedium::hit(const Ray &r, hitRecord &rec, double tMin,
+                              double tMax) const {
+  if (r.shadow || r.sampler == nullptr)
+    return false;
+
+  // Delta tracking: a tentative collision is real with probability
+  // density / majorant, otherwise the ray carries on
+  Sampler &sampler = *r.sampler;
+  double tHit = 0;
+  const bool missed = track(r, tMin, tMax, sampler,
+                            [&](double t, double majorantDensity) {
+                              const double d =
+                                  field->density(r.pointAtTime(t)) *
+                                  densityScale;
+                              if (sampler.next() * majorantDensity < d) {
+                                tHit = t;
+                                return false;
+                              }
+                              return true;
+                            });
+  if (missed)
+    return false;
+
+  rec.t = tHit;
+  rec.p = r.pointAtTime(tHit);
+  rec.normal = Vec(1, 0, 0); // arbitrary
+  rec.u = rec.v = 0;
+  rec.dpdu = rec.dpdv = Vec(0, 0, 0);
+  rec.dndu = rec.dndv = Vec(0, 0, 0);
+  rec.matPtr = phaseFunction;
+  return true;
+}
+
+double HeterogeneousMedium::transmittance(const Ray &r, double tMin,
+                                          double tMax,
+                                          Sampler &sampler) const {
+  // Ratio tracking: every tentative collision keeps the fraction of light
+  // that the null part of the majorant lets through. Once little is left,
+  // Russian roulette decides whether to keep going.
+  double result = 1;
+  track(r, tMin, tMax, sampler, [&](double t, double majorantDensity) {
+    const double d = field->density(r.pointAtTime(t)) * densityScale;
+    result *= std::fmax(0.0, 1 - d / majorantDensity);
+    if (result == 0)
+      return false;
+    if (result < 0.1) {
+      if (sampler.next() < 0.5) {
+        result = 0;
+        return false;
+      }
+      result *= 2;
+    }
+    return true;
+  });
+  return result;
+}
+
+bool HeterogeneousMedium::boundingBox(double t0, double t1,
+                                      aabb &outputBox) const {
+  outputBox = box;
+  return true;
+}
@@ -0,0 +1,58 @@
+#ifndef _MEDIUM_H
+#define _MEDIUM_H
+
+#include <vector>
+
+#include "DensityField.h"
+#include "Hittable.h"
+#include "Materials/Isotropic.h"
+#include "aabb.h"
+
+// A participating medium whose density varies through space. Collisions are
+// found with delta tracking and shadow rays are attenuated with ratio
+// tracking. Both step through a coarse grid of majorants (the largest density
+// in each cell), so empty cells are skipped and thin cells take long steps.
+class HeterogeneousMedium : public Hittable {
+public:
+  // densityScale multiplies the field's densities, which are per unit of
+  // distance. resolution is the number of majorant cells along each axis.
+  HeterogeneousMedium(const DensityField *field, double densityScale,
+                      const Point &albedo, int resolution = 16);
+
+  // Returns a scattering event inside the medium, if there is one before
+  // tMax. Shadow rays and rays without a sampler go straight through.
+  bool hit(const Ray &r, hitRecord &rec, double tMin,
+           double tMax) const override;
+
+  bool boundingBox(double t0, double t1, aabb &outputBox) const override;
+
+  bool participating() const override { return true; }
+
+  double transmittance(const Ray &r, double tMin, double tMax,
+                       Sampler &sampler) const override;
+
+  // The phase function
+  Isotropic phase;
+  Materials *phaseFunction;
+
+private:
+  // Walks the majorant cells the ray crosses between tMin and tMax. For each
+  // tentative collision it calls step(), which returns false to stop. Returns
+  // false if it was stopped.
+  template <class Step>
+  bool track(const Ray &r, double tMin, double tMax, Sampler &sampler,
+             Step step) const;
+
+  float majorant(int x, int y, int z) const {
+    return majorants[(z * resolution + y) * resolution + x];
+  }
+
+  const DensityField *field;
+  double densityScale;
+  aabb box;
+  int resolution;
+  Vec cellSize;
+  std::vector<float> majorants;
+};
+
+#endif
@@ -18,14 +18,18 @@ Move::Move(Hittable *hittablePtr, const Point &move) {
 }
 
 bool Move::hit(const Ray &r, hitRecord &rec, double tMin, double tMax) const {
-  Ray moved(sub(r.origin, offset), r.direction);
+  // Copied so the ray keeps its sampler
+  Ray moved = r;
+  moved.origin = sub(r.origin, offset);
   if (!hittablePtr->hit(moved, rec, tMin, tMax))
     return false;
   else {
     rec.p = add(rec.p, offset);
-    rec.normal = (dotProduct(rec.normal, moved.direction) > 0)
-                     ? scale(-1, rec.normal)
-                     : rec.normal;
+    if (dotProduct(rec.normal, moved.direction) > 0) {
+      rec.normal = scale(-1, rec.normal);
+      rec.dndu = scale(-1, rec.dndu);
+      rec.dndv = scale(-1, rec.dndv);
+    }
     return true;
   }
 }
@@ -0,0 +1,38 @@
+#include "MovingSphere.h"
+#include "./Functions.h"
+
+MovingSphere::MovingSphere(float rad, Point centre0, Point centre1,
+                           double time0, double time1, Materials *material)
+    : shape(rad, centre0, material), centre1(centre1), time0(time0),
+      time1(time1) {}
+
+Point MovingSphere::centre(double time) const {
+  if (time1 == time0)
+    return shape.location;
+  const float f = (time - time0) / (time1 - time0);
+  return add(shape.location, scale(f, sub(centre1, shape.location)));
+}
+
+bool MovingSphere::hit(const Ray &r, hitRecord &rec, double tMin,
+                       double tMax) const {
+  Sphere at = shape;
+  at.location = centre(r.time);
+  return at.hit(r, rec, tMin, tMax);
+}
+
+bool MovingSphere::boundingBox(double t0, double t1, aabb &outputBox) const {
+  aabb start, end;
+  motionBounds(t0, t1, start, end);
+  outputBox = surroundingBox(start, end);
+  return true;
+}
+
+bool MovingSphere::motionBounds(double t0, double t1, aabb &start,
+                                aabb &end) const {
+  const Point extent(shape.rad, shape.rad, shape.rad);
+  const Point c0 = centre(t0);
+  const Point c1 = centre(t1);
+  start = aabb(sub(c0, extent), add(c0, extent));
+  end = aabb(sub(c1, extent), add(c1, extent));
+  return true;
+}
@@ -0,0 +1,33 @@
+#ifndef _MOVING_SPHERE_H
+#define _MOVING_SPHERE_H
+
+#include "./Hittable.h"
+#include "./Point.h"
+#include "./Sphere.h"
+#include "./aabb.h"
+
+// A sphere whose centre moves in a straight line from centre0 at time0 to
+// centre1 at time1, and keeps going at the same speed outside that interval
+class MovingSphere : public Hittable {
+public:
+  MovingSphere(float rad, Point centre0, Point centre1, double time0,
+               double time1, Materials *material);
+
+  // Where the centre is at a time
+  Point centre(double time) const;
+
+  bool hit(const Ray &r, hitRecord &rec, double tMin,
+           double tMax) const override;
+
+  bool boundingBox(double t0, double t1, aabb &outputBox) const override;
+
+  bool motionBounds(double t0, double t1, aabb &start,
+                    aabb &end) const override;
+
+  // The sphere at time0, moved to the ray's time for each test
+  Sphere shape;
+  Point centre1;
+  double time0, time1;
+};
+
+#endif
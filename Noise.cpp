@@ -0,0 +1,180 @@
+#include "Noise.h"
+#include "Sampler.h"
+
+#include <cmath>
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+PerlinNoise::PerlinNoise(uint64_t seed) {
+  Sampler sampler(seed);
+  for (int i = 0; i < 256; i++)
+    perm[i] = i;
+  for (int i = 255; i > 0; i--) {
+    const int target = sampler.nextInt(0, i);
+    const int tmp = perm[i];
+    perm[i] = perm[target];
+    perm[target] = tmp;
+  }
+  for (int i = 0; i < 256; i++)
+    perm[256 + i] = perm[i];
+}
+
+static inline float fade(float t) {
+  return t * t * t * (t * (t * 6 - 15) + 10);
+}
+
+static inline float lerp(float t, float a, float b) { return a + t * (b - a); }
+
+// The 12 cube edge directions, padded to 16 with four of them again. Read
+// from a table rather than picked with branches, which the hash makes
+// impossible to predict.
+static const float gradients[16][3] = {
+    {1, 1, 0}, {-1, 1, 0}, {1, -1, 0}, {-1, -1, 0}, {1, 0, 1},  {-1, 0, 1},
+    {1, 0, -1}, {-1, 0, -1}, {0, 1, 1}, {0, -1, 1}, {0, 1, -1}, {0, -1, -1},
+    {1, 1, 0}, {0, -1, 1}, {-1, 1, 0}, {0, -1, -1}};
+
+// Dot product of (x, y, z) with the gradient the hash picks
+static inline float grad(int hash, float x, float y, float z) {
+  const float *g = gradients[hash & 15];
+  return g[0] * x + g[1] * y + g[2] * z;
+}
+
+float PerlinNoise::noise(float x, float y, float z) const {
+  const float fx = std::floor(x);
+  const float fy = std::floor(y);
+  const float fz = std::floor(z);
+  const int X = (int)fx & 255;
+  const int Y = (int)fy & 255;
+  const int Z = (int)fz & 255;
+  x -= fx;
+  y -= fy;
+  z -= fz;
+  const float u = fade(x);
+  const float v = fade(y);
+  const float w = fade(z);
+
+  // Hashes of the eight corners of the cell
+  const int A = perm[X] + Y, AA = perm[A] + Z, AB = perm[A + 1] + Z;
+  const int B = perm[X + 1] + Y, BA = perm[B] + Z, BB = perm[B + 1] + Z;
+
+  return lerp(
+      w,
+      lerp(v, lerp(u, grad(perm[AA], x, y, z), grad(perm[BA], x - 1, y, z)),
+           lerp(u, grad(perm[AB], x, y - 1, z),
+                grad(perm[BB], x - 1, y - 1, z))),
+      lerp(v,
+           lerp(u, grad(perm[AA + 1], x, y, z - 1),
+                grad(perm[BA + 1], x - 1, y, z - 1)),
+           lerp(u, grad(perm[AB + 1], x, y - 1, z - 1),
+                grad(perm[BB + 1], x - 1, y - 1, z - 1))));
+}
+
+void PerlinNoise::noise(const float *x, const float *y, const float *z,
+                        float *out, int count) const {
+  int i = 0;
+  for (; i + 8 <= count; i += 8)
+    noise8(x + i, y + i, z + i, out + i);
+  for (; i < count; i++)
+    out[i] = noise(x[i], y[i], z[i]);
+}
+
+#if defined(__AVX2__) && defined(__FMA__)
+
+static inline __m256 fade8(__m256 t) {
+  const __m256 inner = _mm256_fmadd_ps(
+      t, _mm256_fmadd_ps(t, _mm256_set1_ps(6), _mm256_set1_ps(-15)),
+      _mm256_set1_ps(10));
+  return _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(t, t), t), inner);
+}
+
+static inline __m256 lerp8(__m256 t, __m256 a, __m256 b) {
+  return _mm256_fmadd_ps(t, _mm256_sub_ps(b, a), a);
+}
+
+// The same gradients as the table, chosen with blends
+static inline __m256 grad8(__m256i hash, __m256 x, __m256 y, __m256 z) {
+  const __m256i h = _mm256_and_si256(hash, _mm256_set1_epi32(15));
+  const __m256 hLess8 =
+      _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(8), h));
+  const __m256 hLess4 =
+      _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(4), h));
+  const __m256 h12or14 = _mm256_castsi256_ps(_mm256_or_si256(
+      _mm256_cmpeq_epi32(h, _mm256_set1_epi32(12)),
+      _mm256_cmpeq_epi32(h, _mm256_set1_epi32(14))));
+
+  const __m256 u = _mm256_blendv_ps(y, x, hLess8);
+  const __m256 v = _mm256_blendv_ps(_mm256_blendv_ps(z, x, h12or14), y, hLess4);
+  // Bits 0 and 1 of the hash flip the signs of u and v
+  const __m256 signU = _mm256_castsi256_ps(
+      _mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(1)), 31));
+  const __m256 signV = _mm256_castsi256_ps(
+      _mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(2)), 30));
+  return _mm256_add_ps(_mm256_xor_ps(u, signU), _mm256_xor_ps(v, signV));
+}
+
+void PerlinNoise::noise8(const float *px, const float *py, const float *pz,
+                         float *out) const {
+  __m256 x = _mm256_loadu_ps(px);
+  __m256 y = _mm256_loadu_ps(py);
+  __m256 z = _mm256_loadu_ps(pz);
+  const __m256 fx = _mm256_floor_ps(x);
+  const __m256 fy = _mm256_floor_ps(y);
+  const __m256 fz = _mm256_floor_ps(z);
+  const __m256i mask = _mm256_set1_epi32(255);
+  const __m256i X = _mm256_and_si256(_mm256_cvttps_epi32(fx), mask);
+  const __m256i Y = _mm256_and_si256(_mm256_cvttps_epi32(fy), mask);
+  const __m256i Z = _mm256_and_si256(_mm256_cvttps_epi32(fz), mask);
+  x = _mm256_sub_ps(x, fx);
+  y = _mm256_sub_ps(y, fy);
+  z = _mm256_sub_ps(z, fz);
+  const __m256 u = fade8(x);
+  const __m256 v = fade8(y);
+  const __m256 w = fade8(z);
+
+  const __m256i one = _mm256_set1_epi32(1);
+  const int *p = perm;
+  const __m256i A = _mm256_add_epi32(_mm256_i32gather_epi32(p, X, 4), Y);
+  const __m256i B = _mm256_add_epi32(
+      _mm256_i32gather_epi32(p, _mm256_add_epi32(X, one), 4), Y);
+  const __m256i AA = _mm256_add_epi32(_mm256_i32gather_epi32(p, A, 4), Z);
+  const __m256i AB = _mm256_add_epi32(
+      _mm256_i32gather_epi32(p, _mm256_add_epi32(A, one), 4), Z);
+  const __m256i BA = _mm256_add_epi32(_mm256_i32gather_epi32(p, B, 4), Z);
+  const __m256i BB = _mm256_add_epi32(
+      _mm256_i32gather_epi32(p, _mm256_add_epi32(B, one), 4), Z);
+
+  const __m256 x1 = _mm256_sub_ps(x, _mm256_set1_ps(1));
+  const __m256 y1 = _mm256_sub_ps(y, _mm256_set1_ps(1));
+  const __m256 z1 = _mm256_sub_ps(z, _mm256_set1_ps(1));
+
+  const __m256 g000 = grad8(_mm256_i32gather_epi32(p, AA, 4), x, y, z);
+  const __m256 g100 = grad8(_mm256_i32gather_epi32(p, BA, 4), x1, y, z);
+  const __m256 g010 = grad8(_mm256_i32gather_epi32(p, AB, 4), x, y1, z);
+  const __m256 g110 = grad8(_mm256_i32gather_epi32(p, BB, 4), x1, y1, z);
+  const __m256 g001 = grad8(
+      _mm256_i32gather_epi32(p, _mm256_add_epi32(AA, one), 4), x, y, z1);
+  const __m256 g101 = grad8(
+      _mm256_i32gather_epi32(p, _mm256_add_epi32(BA, one), 4), x1, y, z1);
+  const __m256 g011 = grad8(
+      _mm256_i32gather_epi32(p, _mm256_add_epi32(AB, one), 4), x, y1, z1);
+  const __m256 g111 = grad8(
+      _mm256_i32gather_epi32(p, _mm256_add_epi32(BB, one), 4), x1, y1, z1);
+
+  const __m256 result =
+      lerp8(w, lerp8(v, lerp8(u, g000, g100), lerp8(u, g010, g110)),
+            lerp8(v, lerp8(u, g001, g101), lerp8(u, g011, g111)));
+  _mm256_storeu_ps(out, result);
+}
+
+#else
+
+// Without AVX2 (and FMA) the eight points are done one at a time
+void PerlinNoise::noise8(const float *x, const float *y, const float *z,
+                         float *out) const {
+  for (int i = 0; i < 8; i++)
+    out[i] = noise(x[i], y[i], z[i]);
+}
+
+#endif
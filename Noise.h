@@ -0,0 +1,30 @@
+#ifndef _NOISE_H
+#define _NOISE_H
+
+#include <cstdint>
+
+// Ken Perlin's improved noise, in floats: quintic fade curve and gradients
+// picked from the 12 edges of a cube by the hash, so no gradient table has to
+// be read. Roughly in [-1, 1].
+class PerlinNoise {
+public:
+  // The permutation is shuffled with a Sampler seeded from seed, so the same
+  // seed always gives the same noise
+  PerlinNoise(uint64_t seed = 0);
+
+  float noise(float x, float y, float z) const;
+
+  // noise() at count points given as separate x, y and z arrays. Eight points
+  // are done at once with AVX2.
+  void noise(const float *x, const float *y, const float *z, float *out,
+             int count) const;
+
+private:
+  void noise8(const float *x, const float *y, const float *z,
+              float *out) const;
+
+  // The permutation twice over, so perm[i + 1] never has to wrap
+  int32_t perm[512];
+};
+
+#endif
@@ -4,7 +4,40 @@
 
 #include <iostream>
 
+static float component(const Vec &v, int axis)
+{
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+void RayBatch::resize(int n, bool differentials)
+{
+    count = n;
+    hasDifferentials = differentials;
+    std::vector<float> *main[6] = {&ox, &oy, &oz, &dx, &dy, &dz};
+    std::vector<float> *extra[12] = {&rxox, &rxoy, &rxoz, &rxdx, &rxdy, &rxdz,
+                                     &ryox, &ryoy, &ryoz, &rydx, &rydy, &rydz};
+    for (int i = 0; i < 6; i++)
+        main[i]->resize(n);
+    for (int i = 0; i < 12; i++)
+        extra[i]->resize(differentials ? n : 0);
+}
+
+void RayBatch::get(int i, Ray &r) const
+{
+    r.origin = Point(ox[i], oy[i], oz[i]);
+    r.direction = Vec(dx[i], dy[i], dz[i]);
+    r.hasDifferentials = hasDifferentials;
+    if (hasDifferentials)
+    {
+        r.rxOrigin = Point(rxox[i], rxoy[i], rxoz[i]);
+        r.rxDirection = Vec(rxdx[i], rxdy[i], rxdz[i]);
+        r.ryOrigin = Point(ryox[i], ryoy[i], ryoz[i]);
+        r.ryDirection = Vec(rydx[i], rydy[i], rydz[i]);
+    }
+}
+
 PinholeCamera::PinholeCamera()
+    : PinholeCamera(1, 1, 90.0f, Point(0, 0, 0), Point(0, 0, -1))
 {
 }
 
@@ -18,10 +51,14 @@ PinholeCamera::PinholeCamera(int width, int height, float verticalFOV, Point loc
     this->view = view;
     this->width = width;
     this->height = height;
+    update();
+}
 
+void PinholeCamera::update()
+{
     // Reference
-    vUp = Vec(0, 1, 0); 
-	
+    vUp = Vec(0, 1, 0);
+
     // Get u, v, w
     w = unitVec(sub(location, view).direction());
     u = unitVec(crossProduct(vUp, w));
@@ -35,24 +72,255 @@ PinholeCamera::PinholeCamera(int width, int height, float verticalFOV, Point loc
     vertical = scale(viewportHeight, v);                                                                    // height scaled to the direction of the v vector
     lowerLeftCorner = sub(location.direction(), add(w, add(scale(0.5, horizontal), scale(0.5, vertical)))); // add focal distance (currently w = 1 so focal distance is 1)
 
+    if (projection == CAMERA_ORTHOGRAPHIC)
+    {
+        // Offsets from the location rather than directions
+        const float orthographicWidth = orthographicHeight * width / height;
+        pixelOrigin = add(scale(-0.5f * orthographicWidth, u), scale(0.5f * orthographicHeight, v));
+        pixelRight = scale(orthographicWidth / width, u);
+        pixelDown = scale(-orthographicHeight / height, v);
+    }
+    else
+    {
+        // The viewport is moved out to the focus distance, so that points on
+        // it are where rays through any part of the lens meet
+        pixelOrigin = scale(focusDistance, add(sub(lowerLeftCorner, location.direction()), vertical));
+        pixelRight = scale(focusDistance / width, horizontal);
+        pixelDown = scale(-focusDistance / height, vertical);
+    }
+}
+
+void PinholeCamera::ray(float x, float y, float lensU, float lensV, Point &origin, Vec &direction) const
+{
+    switch (projection)
+    {
+    case CAMERA_ORTHOGRAPHIC:
+        origin = add(location, point(add(pixelOrigin, add(scale(x, pixelRight), scale(y, pixelDown)))));
+        direction = -w;
+        return;
+    case CAMERA_PANORAMIC:
+    {
+        const double longitude = (x / width - 0.5) * 2 * PI;
+        const double latitude = (0.5 - y / height) * PI;
+        origin = location;
+        direction = add(scale(cos(latitude), sub(scale(sin(longitude), u), scale(cos(longitude), w))),
+                        scale(sin(latitude), v));
+        return;
+    }
+    case CAMERA_PERSPECTIVE:
+    default:
+        direction = add(pixelOrigin, add(scale(x, pixelRight), scale(y, pixelDown)));
+        origin = location;
+        if (lensRadius > 0)
+        {
+            // Start from a point of the lens and aim at the same point of the
+            // focus plane
+            const Vec disk = diskPoint(lensU, lensV);
+            const Vec offset = scale(lensRadius, add(scale(disk.x, u), scale(disk.y, v)));
+            origin = add(location, point(offset));
+            direction = sub(direction, offset);
+        }
+        return;
+    }
 }
 
 void PinholeCamera::getPrimaryRay(float x, float y, Ray &r) const
 {
+    getPrimaryRay(x, y, 0.5f, 0.5f, r);
+}
 
-    // the scaling that depends on the fov of the camera; greater values means that the rays are projected farther away from the centre of the screen
-    // const float side = -2 * tan(verticalFOV * PI / 360.0f);
+void PinholeCamera::getPrimaryRay(float x, float y, float lensU, float lensV, Ray &r) const
+{
+    ray(x, y, lensU, lensV, r.origin, r.direction);
+}
 
-    // float rot_mtx[4][4][4][4];
-    // float trans_mtx[4][4][4][4];
-    // std::cout << x << " " << width << std::endl;
+void PinholeCamera::getPrimaryRayDifferential(float x, float y, Ray &r) const
+{
+    getPrimaryRayDifferential(x, y, 0.5f, 0.5f, r);
+}
 
-    r.origin = location;
-    r.direction = sub(add(lowerLeftCorner, add(scale(x / width, horizontal), scale((height  - y) / height, vertical))), location.direction()); 
+void PinholeCamera::getPrimaryRayDifferential(float x, float y, float lensU, float lensV, Ray &r) const
+{
+    // The neighbouring rays go through the same point of the lens
+    ray(x, y, lensU, lensV, r.origin, r.direction);
+    ray(x + 1, y, lensU, lensV, r.rxOrigin, r.rxDirection);
+    ray(x, y + 1, lensU, lensV, r.ryOrigin, r.ryDirection);
+    r.hasDifferentials = true;
 }
 
-void PinholeCamera::changeLocation(Point p) { location = p; }
+void PinholeCamera::getPrimaryRays(int x0, int y0, int tileWidth, int tileHeight,
+                                   const float *jitterX, const float *jitterY,
+                                   const float *lensU, const float *lensV,
+                                   bool differentials, RayBatch &rays) const
+{
+    const int count = tileWidth * tileHeight;
+    rays.resize(count, differentials);
+
+    if (projection == CAMERA_PANORAMIC)
+    {
+        for (int j = 0, i = 0; j < tileHeight; j++)
+        {
+            for (int k = 0; k < tileWidth; k++, i++)
+            {
+                Ray r;
+                const float px = x0 + k + (jitterX ? jitterX[i] : 0.5f);
+                const float py = y0 + j + (jitterY ? jitterY[i] : 0.5f);
+                if (differentials)
+                    getPrimaryRayDifferential(px, py, r);
+                else
+                    getPrimaryRay(px, py, r);
+                rays.ox[i] = r.origin.x;
+                rays.oy[i] = r.origin.y;
+                rays.oz[i] = r.origin.z;
+                rays.dx[i] = r.direction.x;
+                rays.dy[i] = r.direction.y;
+                rays.dz[i] = r.direction.z;
+                if (differentials)
+                {
+                    rays.rxox[i] = r.rxOrigin.x;
+                    rays.rxoy[i] = r.rxOrigin.y;
+                    rays.rxoz[i] = r.rxOrigin.z;
+                    rays.rxdx[i] = r.rxDirection.x;
+                    rays.rxdy[i] = r.rxDirection.y;
+                    rays.rxdz[i] = r.rxDirection.z;
+                    rays.ryox[i] = r.ryOrigin.x;
+                    rays.ryoy[i] = r.ryOrigin.y;
+                    rays.ryoz[i] = r.ryOrigin.z;
+                    rays.rydx[i] = r.ryDirection.x;
+                    rays.rydy[i] = r.ryDirection.y;
+                    rays.rydz[i] = r.ryDirection.z;
+                }
+            }
+        }
+        return;
+    }
+
+    // Everything else is linear in the pixel position: a base per row plus a
+    // step per pixel, and a fixed offset to the neighbouring pixels
+    const bool orthographic = projection == CAMERA_ORTHOGRAPHIC;
+    const bool lens = hasLens();
+    const float right[3] = {pixelRight.x, pixelRight.y, pixelRight.z};
+    const float down[3] = {pixelDown.x, pixelDown.y, pixelDown.z};
+    const float lensRight[3] = {lensRadius * u.x, lensRadius * u.y, lensRadius * u.z};
+    const float lensUp[3] = {lensRadius * v.x, lensRadius * v.y, lensRadius * v.z};
+    const float eye[3] = {location.x, location.y, location.z};
+    float *origin[3] = {rays.ox.data(), rays.oy.data(), rays.oz.data()};
+    float *direction[3] = {rays.dx.data(), rays.dy.data(), rays.dz.data()};
+    const Vec back = -w;
+    const float fixed[3] = {back.x, back.y, back.z};
 
-void PinholeCamera::changeView(Point P) {
-  view = P;
+    // Lens samples mapped to the disk once for all three axes
+    std::vector<float> diskX, diskY;
+    if (lens)
+    {
+        diskX.resize(count);
+        diskY.resize(count);
+        for (int i = 0; i < count; i++)
+        {
+            const Vec disk = diskPoint(lensU ? lensU[i] : 0.5f, lensV ? lensV[i] : 0.5f);
+            diskX[i] = disk.x;
+            diskY[i] = disk.y;
+        }
+    }
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        const float start = component(pixelOrigin, axis);
+        // The plane (origins or directions) that moves with the pixel
+        float *moving = orthographic ? origin[axis] : direction[axis];
+        float *other = orthographic ? direction[axis] : origin[axis];
+        const float otherValue = orthographic ? fixed[axis] : eye[axis];
+        const float offset = orthographic ? eye[axis] : 0;
+
+        for (int j = 0, i = 0; j < tileHeight; j++)
+        {
+            const float row = offset + start + (y0 + j) * down[axis];
+            for (int k = 0; k < tileWidth; k++, i++)
+            {
+                const float jx = jitterX ? jitterX[i] : 0.5f;
+                const float jy = jitterY ? jitterY[i] : 0.5f;
+                moving[i] = row + (x0 + k + jx) * right[axis] + jy * down[axis];
+                other[i] = otherValue;
+            }
+        }
+
+        if (lens)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                const float shift = diskX[i] * lensRight[axis] + diskY[i] * lensUp[axis];
+                origin[axis][i] += shift;
+                direction[axis][i] -= shift;
+            }
+        }
+
+        if (differentials)
+        {
+            float *rxOrigin[3] = {rays.rxox.data(), rays.rxoy.data(), rays.rxoz.data()};
+            float *rxDirection[3] = {rays.rxdx.data(), rays.rxdy.data(), rays.rxdz.data()};
+            float *ryOrigin[3] = {rays.ryox.data(), rays.ryoy.data(), rays.ryoz.data()};
+            float *ryDirection[3] = {rays.rydx.data(), rays.rydy.data(), rays.rydz.data()};
+            const float stepOrigin[2] = {orthographic ? right[axis] : 0, orthographic ? down[axis] : 0};
+            const float stepDirection[2] = {orthographic ? 0 : right[axis], orthographic ? 0 : down[axis]};
+            for (int i = 0; i < count; i++)
+            {
+                rxOrigin[axis][i] = origin[axis][i] + stepOrigin[0];
+                rxDirection[axis][i] = direction[axis][i] + stepDirection[0];
+                ryOrigin[axis][i] = origin[axis][i] + stepOrigin[1];
+                ryDirection[axis][i] = direction[axis][i] + stepDirection[1];
+            }
+        }
+    }
+}
+
+bool PinholeCamera::project(const Point &p, float &x, float &y) const
+{
+    if (projection == CAMERA_PANORAMIC)
+        return false;
+
+    // Offset from the top left corner of the pixel grid, on the focus plane
+    // for perspective
+    Vec offset = sub(p, location).direction();
+    if (projection == CAMERA_PERSPECTIVE)
+    {
+        const double depth = -dotProduct(offset, w);
+        if (depth <= 0)
+            return false;
+        offset = scale(focusDistance / depth, offset);
+    }
+    offset = sub(offset, pixelOrigin);
+    x = dotProduct(offset, pixelRight) / dotProduct(pixelRight, pixelRight);
+    y = dotProduct(offset, pixelDown) / dotProduct(pixelDown, pixelDown);
+    return true;
+}
+
+void PinholeCamera::changeLocation(Point p)
+{
+    location = p;
+    update();
+}
+
+void PinholeCamera::changeView(Point P)
+{
+    view = P;
+    update();
+}
+
+void PinholeCamera::setProjection(CameraProjection p)
+{
+    projection = p;
+    update();
+}
+
+void PinholeCamera::setLens(float aperture, float focusDistance)
+{
+    lensRadius = aperture / 2;
+    this->focusDistance = focusDistance > 0 ? focusDistance : 1;
+    update();
+}
+
+void PinholeCamera::setOrthographicHeight(float h)
+{
+    orthographicHeight = h;
+    update();
 }
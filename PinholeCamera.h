@@ -2,6 +2,35 @@
 #define _PINHOLE_CAMERA_H
 #include "./Ray.h"
 #include <cmath>
+#include <vector>
+
+// How the camera maps pixels to rays
+enum CameraProjection {
+  // Rays fan out from the location (through a lens if it has an aperture)
+  CAMERA_PERSPECTIVE,
+  // Parallel rays from a rectangle around the location
+  CAMERA_ORTHOGRAPHIC,
+  // Every direction around the location, longitude across the image and
+  // latitude down it
+  CAMERA_PANORAMIC
+};
+
+// Camera rays for a block of pixels as a structure of arrays, filled in by
+// PinholeCamera::getPrimaryRays()
+struct RayBatch {
+  std::vector<float> ox, oy, oz;
+  std::vector<float> dx, dy, dz;
+  // Differentials, only filled in if asked for
+  std::vector<float> rxox, rxoy, rxoz, rxdx, rxdy, rxdz;
+  std::vector<float> ryox, ryoy, ryoz, rydx, rydy, rydz;
+  bool hasDifferentials = false;
+  int count = 0;
+
+  void resize(int n, bool differentials);
+
+  // Copies the i-th ray out
+  void get(int i, Ray &r) const;
+};
 
 class PinholeCamera {
 protected:
@@ -23,6 +52,28 @@ protected:
 
   float viewportHeight, viewportWidth;
 
+  CameraProjection projection = CAMERA_PERSPECTIVE;
+
+  // Lens radius and the distance that is in focus. A radius of 0 is a
+  // pinhole, where everything is sharp.
+  float lensRadius = 0;
+  float focusDistance = 1;
+
+  // Height of what the orthographic projection sees, in scene units
+  float orthographicHeight = 2;
+
+  // Precomputed by update(). The direction through pixel (x, y) from the
+  // centre of the lens is pixelOrigin + x * pixelRight + y * pixelDown, and
+  // for the orthographic projection that is where the ray starts instead.
+  Vec pixelOrigin, pixelRight, pixelDown;
+
+  // Recomputes the basis and the viewport after a setting changed
+  void update();
+
+  // A ray for a continuous pixel position and a lens sample
+  void ray(float x, float y, float lensU, float lensV, Point &origin,
+           Vec &direction) const;
+
 public:
   PinholeCamera();
 
@@ -37,9 +88,52 @@ public:
    */
   void getPrimaryRay(float x, float y, Ray &r) const;
 
+  // The same through the point (lensU, lensV) of the lens, both in [0, 1)
+  void getPrimaryRay(float x, float y, float lensU, float lensV,
+                     Ray &r) const;
+
+  // The same ray, with differentials through the pixel to the right and the
+  // pixel below
+  void getPrimaryRayDifferential(float x, float y, Ray &r) const;
+
+  void getPrimaryRayDifferential(float x, float y, float lensU, float lensV,
+                                 Ray &r) const;
+
+  // Rays for the tileWidth x tileHeight pixels from (x0, y0), row by row.
+  // jitterX and jitterY are offsets inside each pixel and lensU and lensV the
+  // lens samples, one per pixel; any of them may be null for the pixel centre
+  // and the centre of the lens. Perspective and orthographic rays are built
+  // from per-row and per-column steps without going through Ray.
+  void getPrimaryRays(int x0, int y0, int tileWidth, int tileHeight,
+                      const float *jitterX, const float *jitterY,
+                      const float *lensU, const float *lensV,
+                      bool differentials, RayBatch &rays) const;
+
+  // The continuous pixel position p is seen at through the centre of the
+  // lens. Returns false for points behind the camera and for the panoramic
+  // projection.
+  bool project(const Point &p, float &x, float &y) const;
+
+  // Whether project() can ever succeed
+  bool canProject() const { return projection != CAMERA_PANORAMIC; }
+
+  Point getLocation() const { return location; }
+
+  // Whether rays need a lens sample, so renderers can skip drawing one
+  bool hasLens() const {
+    return projection == CAMERA_PERSPECTIVE && lensRadius > 0;
+  }
+
   void changeLocation(Point p);
 
   void changeView(Point p);
+
+  void setProjection(CameraProjection p);
+
+  // aperture is the diameter of the lens, 0 for a pinhole
+  void setLens(float aperture, float focusDistance);
+
+  void setOrthographicHeight(float h);
 };
 
 #endif
@@ -0,0 +1,445 @@
+#include "PrimitiveBVH.h"
+#include "Functions.h"
+
+#include <algorithm>
+#include <cstdio>
+
+static inline float axisValue(const Point &p, int axis) {
+  return axis == 0 ? p.x : (axis == 1 ? p.y : p.z);
+}
+
+static inline double surfaceArea(const aabb &b) {
+  const double dx = b.max.x - b.min.x;
+  const double dy = b.max.y - b.min.y;
+  const double dz = b.max.z - b.min.z;
+  return 2 * (dx * dy + dy * dz + dz * dx);
+}
+
+static inline aabb lerp(const aabb &a, const aabb &b, float f) {
+  return aabb(Point(a.min.x + f * (b.min.x - a.min.x),
+                    a.min.y + f * (b.min.y - a.min.y),
+                    a.min.z + f * (b.min.z - a.min.z)),
+              Point(a.max.x + f * (b.max.x - a.max.x),
+                    a.max.y + f * (b.max.y - a.max.y),
+                    a.max.z + f * (b.max.z - a.max.z)));
+}
+
+// Average area of a box moving linearly between start and end, for the
+// surface area heuristic. Rays are spread evenly over the shutter, and the
+// area is quadratic in time, so Simpson's rule gives it exactly.
+static inline double motionArea(const aabb &start, const aabb &end) {
+  return (surfaceArea(start) + 4 * surfaceArea(lerp(start, end, 0.5f)) +
+          surfaceArea(end)) /
+         6;
+}
+
+// Number of buckets the centres are sorted into when looking for a split
+static const int SAH_BINS = 12;
+
+// Entries in the stack hit() walks the tree with, one a level
+static const int TRAVERSAL_STACK = 64;
+
+// Levels split by the surface area heuristic. Below them nodes are split at
+// their median, which halves them, so even a tree the heuristic makes very
+// lopsided fits the traversal stack.
+static const int SAH_DEPTH = 32;
+
+// Moves the lower half of the centres along axis to the front of [start, end)
+// and returns where the upper half starts
+template <class Ref>
+static size_t medianSplit(std::vector<Ref> &refs, size_t start, size_t end,
+                          int axis) {
+  const size_t mid = start + (end - start) / 2;
+  std::nth_element(refs.begin() + start, refs.begin() + mid,
+                   refs.begin() + end, [axis](const Ref &a, const Ref &b) {
+                     return axisValue(a.centre, axis) <
+                            axisValue(b.centre, axis);
+                   });
+  return mid;
+}
+
+// How much smaller than the swept box the interpolated boxes have to be on
+// average for a node to interpolate them
+static const double MOTION_GAIN = 1.25;
+
+// Cost of one pass of the sphere kernel, relative to testing one primitive
+static const double SPHERE_ROW_COST = 2.0;
+
+void PrimitiveBVH::build(const std::vector<Hittable *> &objects, double t0,
+                         double t1, int maxLeafSize) {
+  clear();
+  shutterOpen = t0;
+  shutterClose = t1;
+
+  // Sort every object into a typed array first, the final arrays are filled
+  // in leaf order while flattening
+  PrimitiveStore unsorted;
+  std::vector<BuildRef> refs;
+  refs.reserve(objects.size());
+  for (Hittable *o : objects) {
+    BuildRef b;
+    if (!o->motionBounds(t0, t1, b.start, b.end)) {
+      printf("Bounding box not possible for an object\n");
+      continue;
+    }
+    moving = moving || !(b.start.min == b.end.min && b.start.max == b.end.max);
+    b.ref = unsorted.add(o);
+    // Centred halfway through the shutter
+    const aabb middle = lerp(b.start, b.end, 0.5f);
+    b.centre = findCentre(middle.min, middle.max);
+    refs.push_back(b);
+  }
+
+  if (refs.empty())
+    return;
+  nodes.reserve(2 * refs.size() / maxLeafSize + 1);
+  buildNode(refs, 0, refs.size(), unsorted, maxLeafSize, 0);
+  store.packSpheres();
+
+  // Children come after their parent, so walking backwards visits them first
+  std::vector<bool> holdsCustom(nodes.size(), false);
+  parents.assign(nodes.size(), -1);
+  for (int i = nodes.size() - 1; i >= 0; i--) {
+    const BVHFlatNode &node = nodes[i];
+    if (node.runCount > 0) {
+      for (int r = node.firstRun; r < node.firstRun + node.runCount; r++)
+        holdsCustom[i] = holdsCustom[i] || runs[r].type == PRIM_CUSTOM;
+    } else {
+      holdsCustom[i] = holdsCustom[i + 1] || holdsCustom[node.rightChild];
+      parents[i + 1] = i;
+      parents[node.rightChild] = i;
+    }
+    if (holdsCustom[i])
+      refitOrder.push_back(i);
+  }
+  builtCost = cost();
+}
+
+void PrimitiveBVH::refit(double t0, double t1) {
+  shutterOpen = t0;
+  shutterClose = t1;
+  moving = false;
+  for (int i : refitOrder)
+    refitNode(i);
+}
+
+void PrimitiveBVH::refitNode(int i) {
+  BVHFlatNode &node = nodes[i];
+  aabb start, end;
+  if (node.runCount > 0) {
+    bool found = false;
+    for (int r = node.firstRun; r < node.firstRun + node.runCount; r++) {
+      for (int p = runs[r].start; p < runs[r].start + runs[r].count; p++) {
+        aabb s, e;
+        if (!store.motionBounds(PrimitiveRef{runs[r].type, p}, shutterOpen,
+                                shutterClose, s, e))
+          continue;
+        moving = moving || !(s.min == e.min && s.max == e.max);
+        start = found ? surroundingBox(start, s) : s;
+        end = found ? surroundingBox(end, e) : e;
+        found = true;
+      }
+    }
+    if (!found)
+      return;
+  } else {
+    const BVHFlatNode &left = nodes[i + 1];
+    const BVHFlatNode &right = nodes[node.rightChild];
+    start = surroundingBox(left.box, right.box);
+    end = surroundingBox(left.endBox, right.endBox);
+  }
+  setBounds(node, start, end);
+}
+
+bool PrimitiveBVH::find(const Hittable *o, int &leaf, int &run,
+                        int &index) const {
+  const PrimitiveType type = primitiveType(o);
+  const std::vector<const Hittable *> &sources = store.sources[type];
+  for (int i = 0; i < (int)nodes.size(); i++) {
+    const BVHFlatNode &node = nodes[i];
+    for (int r = node.firstRun; r < node.firstRun + node.runCount; r++) {
+      if (runs[r].type != type)
+        continue;
+      for (int p = runs[r].start; p < runs[r].start + runs[r].count; p++) {
+        if (sources[p] == o) {
+          leaf = i;
+          run = r;
+          index = p;
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+bool PrimitiveBVH::update(const Hittable *o) {
+  int leaf, run, index;
+  if (!find(o, leaf, run, index) ||
+      !store.set(PrimitiveRef{runs[run].type, index}, o))
+    return false;
+  for (int i = leaf; i >= 0; i = parents[i])
+    refitNode(i);
+  return true;
+}
+
+bool PrimitiveBVH::remove(const Hittable *o) {
+  int leaf, run, index;
+  if (!find(o, leaf, run, index))
+    return false;
+  // The last primitive of the run takes its place, and the run's old last
+  // slot is left unused until the next build
+  PrimitiveRun &r = runs[run];
+  if (index != r.start + r.count - 1)
+    store.copy(r.type, r.start + r.count - 1, index);
+  r.count--;
+  for (int i = leaf; i >= 0; i = parents[i])
+    refitNode(i);
+  return true;
+}
+
+double PrimitiveBVH::cost() const {
+  if (nodes.empty())
+    return 0;
+  double total = 0;
+  for (const BVHFlatNode &node : nodes)
+    total += motionArea(node.box, node.endBox);
+  return total / motionArea(nodes[0].box, nodes[0].endBox);
+}
+
+// Splits the widest axis of the centres where the surface area heuristic says
+// is cheapest, or makes a leaf if that is cheaper than splitting
+int PrimitiveBVH::buildNode(std::vector<BuildRef> &refs, size_t start,
+                            size_t end, const PrimitiveStore &unsorted,
+                            int maxLeafSize, int depth) {
+  const int index = nodes.size();
+  nodes.push_back(BVHFlatNode());
+
+  aabb startBox = refs[start].start;
+  aabb endBox = refs[start].end;
+  aabb centres(refs[start].centre, refs[start].centre);
+  bool spheresOnly = refs[start].ref.type == PRIM_SPHERE;
+  for (size_t i = start + 1; i < end; i++) {
+    startBox = surroundingBox(startBox, refs[i].start);
+    endBox = surroundingBox(endBox, refs[i].end);
+    centres = surroundingBox(centres, aabb(refs[i].centre, refs[i].centre));
+    spheresOnly = spheresOnly && refs[i].ref.type == PRIM_SPHERE;
+  }
+  setBounds(nodes[index], startBox, endBox);
+  nodes[index].runCount = 0;
+
+  const Point extent = sub(centres.max, centres.min);
+  int axis = 0;
+  if (extent.y > extent.x)
+    axis = 1;
+  if (extent.z > axisValue(extent, axis))
+    axis = 2;
+
+  // Every centre is in the same place
+  const size_t size = end - start;
+  if (size == 1 || axisValue(extent, axis) <= 0) {
+    makeLeaf(index, refs, start, end, unsorted);
+    return index;
+  }
+
+  if (depth >= SAH_DEPTH) {
+    if (size <= (size_t)maxLeafSize) {
+      makeLeaf(index, refs, start, end, unsorted);
+      return index;
+    }
+    const size_t mid = medianSplit(refs, start, end, axis);
+    nodes[index].axis = axis;
+    buildNode(refs, start, mid, unsorted, maxLeafSize, depth + 1);
+    const int right =
+        buildNode(refs, mid, end, unsorted, maxLeafSize, depth + 1);
+    nodes[index].rightChild = right;
+    return index;
+  }
+
+  // Bucket the centres along the axis
+  const float axisMin = axisValue(centres.min, axis);
+  const float binScale = SAH_BINS / axisValue(extent, axis);
+  auto binOf = [&](const BuildRef &b) {
+    int bin = (int)((axisValue(b.centre, axis) - axisMin) * binScale);
+    return bin < SAH_BINS ? bin : SAH_BINS - 1;
+  };
+  int counts[SAH_BINS] = {0};
+  aabb startBounds[SAH_BINS];
+  aabb endBounds[SAH_BINS];
+  for (size_t i = start; i < end; i++) {
+    const int bin = binOf(refs[i]);
+    if (counts[bin] == 0) {
+      startBounds[bin] = refs[i].start;
+      endBounds[bin] = refs[i].end;
+    } else {
+      startBounds[bin] = surroundingBox(startBounds[bin], refs[i].start);
+      endBounds[bin] = surroundingBox(endBounds[bin], refs[i].end);
+    }
+    counts[bin]++;
+  }
+
+  // Cost of splitting after each bucket, relative to testing one primitive
+  double rightCost[SAH_BINS];
+  int rightCount = 0;
+  aabb rightStart, rightEnd;
+  for (int i = SAH_BINS - 1; i > 0; i--) {
+    if (counts[i] > 0) {
+      rightStart = rightCount == 0 ? startBounds[i]
+                                   : surroundingBox(rightStart, startBounds[i]);
+      rightEnd = rightCount == 0 ? endBounds[i]
+                                 : surroundingBox(rightEnd, endBounds[i]);
+      rightCount += counts[i];
+    }
+    rightCost[i - 1] = rightCount * motionArea(rightStart, rightEnd);
+  }
+  int bestSplit = 0;
+  double bestCost = DBL_INF;
+  int leftCount = 0;
+  aabb leftStart, leftEnd;
+  for (int i = 0; i < SAH_BINS - 1; i++) {
+    if (counts[i] > 0) {
+      leftStart = leftCount == 0 ? startBounds[i]
+                                 : surroundingBox(leftStart, startBounds[i]);
+      leftEnd = leftCount == 0 ? endBounds[i]
+                               : surroundingBox(leftEnd, endBounds[i]);
+      leftCount += counts[i];
+    }
+    if (leftCount == 0 || leftCount == (int)size)
+      continue;
+    const double cost =
+        leftCount * motionArea(leftStart, leftEnd) + rightCost[i];
+    if (cost < bestCost) {
+      bestCost = cost;
+      bestSplit = i;
+    }
+  }
+  bestCost = 1 + bestCost / motionArea(startBox, endBox);
+
+  // A sphere-only leaf is tested a row at a time by the sphere kernel, so it
+  // can hold a full row and costs about SPHERE_ROW_COST per row
+  size_t leafLimit = maxLeafSize;
+  double leafCost = size;
+  if (spheresOnly) {
+    leafLimit = std::max(maxLeafSize, SPHERE_KERNEL_WIDTH);
+    leafCost = SPHERE_ROW_COST *
+               ((size + SPHERE_KERNEL_WIDTH - 1) / SPHERE_KERNEL_WIDTH);
+  }
+
+  if (size <= leafLimit && leafCost <= bestCost) {
+    makeLeaf(index, refs, start, end, unsorted);
+    return index;
+  }
+
+  size_t mid =
+      std::partition(refs.begin() + start, refs.begin() + end,
+                     [&](const BuildRef &b) { return binOf(b) <= bestSplit; }) -
+      refs.begin();
+  // Every centre fell in one bucket, split in the middle instead
+  if (mid == start || mid == end)
+    mid = medianSplit(refs, start, end, axis);
+
+  nodes[index].axis = axis;
+  buildNode(refs, start, mid, unsorted, maxLeafSize, depth + 1);
+  const int right =
+      buildNode(refs, mid, end, unsorted, maxLeafSize, depth + 1);
+  nodes[index].rightChild = right;
+  return index;
+}
+
+void PrimitiveBVH::setBounds(BVHFlatNode &node, const aabb &start,
+                             const aabb &end) {
+  const aabb swept = surroundingBox(start, end);
+  node.interpolate = surfaceArea(swept) > MOTION_GAIN * motionArea(start, end);
+  node.box = node.interpolate ? start : swept;
+  node.endBox = node.interpolate ? end : swept;
+}
+
+// Groups the leaf's primitives by type and copies each group to the end of its
+// array, so each group becomes one run
+void PrimitiveBVH::makeLeaf(int node, std::vector<BuildRef> &refs,
+                            size_t start, size_t end,
+                            const PrimitiveStore &unsorted) {
+  std::stable_sort(refs.begin() + start, refs.begin() + end,
+                   [](const BuildRef &a, const BuildRef &b) {
+                     return a.ref.type < b.ref.type;
+                   });
+
+  nodes[node].firstRun = runs.size();
+  for (size_t i = start; i < end; i++) {
+    const PrimitiveRef placed = store.append(unsorted, refs[i].ref);
+    if (i > start && refs[i].ref.type == refs[i - 1].ref.type)
+      runs.back().count++;
+    else
+      runs.push_back(PrimitiveRun{placed.type, placed.index, 1});
+  }
+  nodes[node].runCount = runs.size() - nodes[node].firstRun;
+}
+
+void PrimitiveBVH::clear() {
+  moving = false;
+  builtCost = 0;
+  refitOrder.clear();
+  parents.clear();
+  nodes.clear();
+  runs.clear();
+  store.clear();
+}
+
+bool PrimitiveBVH::hit(const Ray &r, hitRecord &rec, double tMin,
+                       double tMax) const {
+  if (nodes.empty())
+    return false;
+
+  const bool negative[3] = {r.direction.x < 0, r.direction.y < 0,
+                            r.direction.z < 0};
+  int stack[TRAVERSAL_STACK];
+  int top = 0;
+  int current = 0;
+  bool objHit = false;
+  double closest = tMax;
+  const float f =
+      moving && shutterClose > shutterOpen
+          ? std::min(1.0, std::max(0.0, (r.time - shutterOpen) /
+                                            (shutterClose - shutterOpen)))
+          : 0;
+
+  while (true) {
+    const BVHFlatNode &node = nodes[current];
+    const bool entered = node.interpolate
+                             ? lerp(node.box, node.endBox, f).hit(r, tMin,
+                                                                  closest)
+                             : node.box.hit(r, tMin, closest);
+    if (entered) {
+      if (node.runCount > 0) {
+        for (int i = node.firstRun; i < node.firstRun + node.runCount; i++) {
+          if (store.hit(runs[i], r, rec, tMin, closest)) {
+            objHit = true;
+            closest = rec.t;
+          }
+        }
+      } else {
+        // Visit the child nearer to the ray origin first so closest shrinks
+        // sooner
+        if (negative[node.axis]) {
+          stack[top++] = current + 1;
+          current = node.rightChild;
+        } else {
+          stack[top++] = node.rightChild;
+          current = current + 1;
+        }
+        continue;
+      }
+    }
+    if (top == 0)
+      break;
+    current = stack[--top];
+  }
+  return objHit;
+}
+
+bool PrimitiveBVH::boundingBox(double t0, double t1, aabb &outputBox) const {
+  if (nodes.empty())
+    return false;
+  outputBox = surroundingBox(nodes[0].box, nodes[0].endBox);
+  return true;
+}
@@ -0,0 +1,118 @@
+#ifndef _PRIMITIVE_BVH_H
+#define _PRIMITIVE_BVH_H
+
+#include <vector>
+
+#include "Hittable.h"
+#include "Primitives.h"
+#include "aabb.h"
+
+// A node of the flattened tree. The first child of an interior node is the
+// node right after it, the second child is at rightChild. Leaves point at
+// runCount runs of same-typed primitives.
+struct BVHFlatNode {
+  // Bounds at the start and the end of the shutter. A ray is tested against
+  // the box interpolated to its time; they are the same if nothing below the
+  // node moves.
+  aabb box;
+  aabb endBox;
+  int rightChild;
+  int firstRun;
+  int runCount;
+  // Axis the children were split on, used to visit the nearer child first
+  unsigned char axis;
+  // Whether the boxes differ. Nodes whose contents move apart rather than
+  // together gain little from interpolating, and keep one box for the whole
+  // shutter instead.
+  bool interpolate;
+};
+
+// Bounding volume hierarchy over a PrimitiveStore. The nodes are kept in one
+// array in depth first order, and each leaf's primitives are contiguous in
+// their type's array, so a leaf is tested with one switch per run instead of
+// one virtual call per primitive.
+class PrimitiveBVH : public Hittable {
+public:
+  PrimitiveBVH() {}
+
+  // Sorts the objects into typed arrays and builds the tree over them. Splits
+  // are chosen with the surface area heuristic, and leaves hold at most
+  // maxLeafSize primitives.
+  void build(const std::vector<Hittable *> &objects, double t0, double t1,
+             int maxLeafSize = 4);
+
+  void clear();
+
+  bool empty() const { return nodes.empty(); }
+
+  // Recomputes the boxes bottom up for the shutter t0 to t1, keeping the
+  // tree. Only nodes above objects kept by pointer are visited, since
+  // primitives stored by value can't have changed. The tree stays correct but
+  // gets looser as objects move away from where it was built.
+  void refit(double t0, double t1);
+
+  // Surface area heuristic cost of the nodes relative to the root, to tell
+  // how much refitting has loosened the tree
+  double cost() const;
+
+  // Copies o into the tree again after it was moved or given another
+  // material, and refits the nodes above it. Returns false if o is not in
+  // the tree or changed type, in which case it needs a rebuild.
+  bool update(const Hittable *o);
+
+  // Takes o out of its leaf and refits the nodes above it. Returns false if
+  // o is not in the tree.
+  bool remove(const Hittable *o);
+
+  virtual bool hit(const Ray &r, hitRecord &rec, double tMin,
+                   double tMax) const override;
+
+  virtual bool boundingBox(double t0, double t1,
+                           aabb &outputBox) const override;
+
+  std::vector<BVHFlatNode> nodes;
+  std::vector<PrimitiveRun> runs;
+  PrimitiveStore store;
+
+  // The shutter interval the tree was built for, and whether anything moves
+  // in it
+  double shutterOpen = 0;
+  double shutterClose = 0;
+  bool moving = false;
+
+  // cost() right after the last build
+  double builtCost = 0;
+
+private:
+  struct BuildRef {
+    PrimitiveRef ref;
+    // Bounds at the start and end of the shutter
+    aabb start;
+    aabb end;
+    Point centre;
+  };
+
+  // depth is that of the node built, the root's being 0
+  int buildNode(std::vector<BuildRef> &refs, size_t start, size_t end,
+                const PrimitiveStore &unsorted, int maxLeafSize, int depth);
+
+  void makeLeaf(int node, std::vector<BuildRef> &refs, size_t start,
+                size_t end, const PrimitiveStore &unsorted);
+
+  // Sets a node's boxes and whether to interpolate them
+  static void setBounds(BVHFlatNode &node, const aabb &start, const aabb &end);
+
+  // Recomputes a node's boxes from its primitives or its children. Leaves
+  // left empty by remove() keep their old boxes.
+  void refitNode(int node);
+
+  // Finds the leaf, run and index of the primitive copied from o
+  bool find(const Hittable *o, int &leaf, int &run, int &index) const;
+
+  // Nodes with objects kept by pointer below them, children before parents
+  std::vector<int> refitOrder;
+  // Parent of each node, -1 for the root
+  std::vector<int> parents;
+};
+
+#endif
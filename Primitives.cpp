@@ -0,0 +1,268 @@
+#include "Primitives.h"
+
+#include <typeinfo>
+
+// Tests prims[start, start + count) with non-virtual calls, keeping the
+// closest hit and the object it was copied from
+template <class T>
+static inline bool hitRange(const std::vector<T> &prims,
+                            const std::vector<const Hittable *> &sources,
+                            int start, int count, const Ray &r,
+                            hitRecord &rec, double tMin, double tMax) {
+  bool objHit = false;
+  double closest = tMax;
+  for (int i = start; i < start + count; i++) {
+    if (prims[i].T::hit(r, rec, tMin, closest)) {
+      objHit = true;
+      closest = rec.t;
+      rec.object = sources[i];
+    }
+  }
+  return objHit;
+}
+
+template <class T>
+static inline PrimitiveRef push(std::vector<T> &prims, const T &prim,
+                                PrimitiveType type,
+                                std::vector<const Hittable *> &sources,
+                                const Hittable *source) {
+  prims.push_back(prim);
+  sources.push_back(source);
+  return PrimitiveRef{type, (int)prims.size() - 1};
+}
+
+PrimitiveType primitiveType(const Hittable *o) {
+  // Exact type matches only, a subclass could override hit()
+  const std::type_info &type = typeid(*o);
+  if (type == typeid(Sphere))
+    return PRIM_SPHERE;
+  if (type == typeid(XYRectangle))
+    return PRIM_XY_RECT;
+  if (type == typeid(XZRectangle))
+    return PRIM_XZ_RECT;
+  if (type == typeid(YZRectangle))
+    return PRIM_YZ_RECT;
+  if (type == typeid(Box))
+    return PRIM_BOX;
+  if (type == typeid(Triangle))
+    return PRIM_TRIANGLE;
+  return PRIM_CUSTOM;
+}
+
+PrimitiveRef PrimitiveStore::add(Hittable *o) {
+  const PrimitiveType type = primitiveType(o);
+  std::vector<const Hittable *> &from = sources[type];
+  switch (type) {
+  case PRIM_SPHERE:
+    return push(spheres, *static_cast<Sphere *>(o), type, from, o);
+  case PRIM_XY_RECT:
+    return push(xyRects, *static_cast<XYRectangle *>(o), type, from, o);
+  case PRIM_XZ_RECT:
+    return push(xzRects, *static_cast<XZRectangle *>(o), type, from, o);
+  case PRIM_YZ_RECT:
+    return push(yzRects, *static_cast<YZRectangle *>(o), type, from, o);
+  case PRIM_BOX:
+    return push(boxes, *static_cast<Box *>(o), type, from, o);
+  case PRIM_TRIANGLE:
+    return push(triangles, *static_cast<Triangle *>(o), type, from, o);
+  default:
+    return push(custom, o, PRIM_CUSTOM, from, o);
+  }
+}
+
+PrimitiveRef PrimitiveStore::append(const PrimitiveStore &from,
+                                    PrimitiveRef ref) {
+  const Hittable *source = from.sources[ref.type][ref.index];
+  std::vector<const Hittable *> &to = sources[ref.type];
+  switch (ref.type) {
+  case PRIM_SPHERE:
+    return push(spheres, from.spheres[ref.index], ref.type, to, source);
+  case PRIM_XY_RECT:
+    return push(xyRects, from.xyRects[ref.index], ref.type, to, source);
+  case PRIM_XZ_RECT:
+    return push(xzRects, from.xzRects[ref.index], ref.type, to, source);
+  case PRIM_YZ_RECT:
+    return push(yzRects, from.yzRects[ref.index], ref.type, to, source);
+  case PRIM_BOX:
+    return push(boxes, from.boxes[ref.index], ref.type, to, source);
+  case PRIM_TRIANGLE:
+    return push(triangles, from.triangles[ref.index], ref.type, to, source);
+  default:
+    return push(custom, from.custom[ref.index], PRIM_CUSTOM, to, source);
+  }
+}
+
+bool PrimitiveStore::set(PrimitiveRef ref, const Hittable *o) {
+  if (primitiveType(o) != ref.type)
+    return false;
+  sources[ref.type][ref.index] = o;
+  switch (ref.type) {
+  case PRIM_SPHERE:
+    spheres[ref.index] = *static_cast<const Sphere *>(o);
+    if (sphereData.count == spheres.size())
+      sphereData.set(ref.index, spheres[ref.index]);
+    break;
+  case PRIM_XY_RECT:
+    xyRects[ref.index] = *static_cast<const XYRectangle *>(o);
+    break;
+  case PRIM_XZ_RECT:
+    xzRects[ref.index] = *static_cast<const XZRectangle *>(o);
+    break;
+  case PRIM_YZ_RECT:
+    yzRects[ref.index] = *static_cast<const YZRectangle *>(o);
+    break;
+  case PRIM_BOX:
+    boxes[ref.index] = *static_cast<const Box *>(o);
+    break;
+  case PRIM_TRIANGLE:
+    triangles[ref.index] = *static_cast<const Triangle *>(o);
+    break;
+  default:
+    // Kept by pointer, so it is up to date already
+    break;
+  }
+  return true;
+}
+
+void PrimitiveStore::copy(PrimitiveType type, int from, int to) {
+  sources[type][to] = sources[type][from];
+  switch (type) {
+  case PRIM_SPHERE:
+    spheres[to] = spheres[from];
+    if (sphereData.count == spheres.size())
+      sphereData.set(to, spheres[to]);
+    break;
+  case PRIM_XY_RECT:
+    xyRects[to] = xyRects[from];
+    break;
+  case PRIM_XZ_RECT:
+    xzRects[to] = xzRects[from];
+    break;
+  case PRIM_YZ_RECT:
+    yzRects[to] = yzRects[from];
+    break;
+  case PRIM_BOX:
+    boxes[to] = boxes[from];
+    break;
+  case PRIM_TRIANGLE:
+    triangles[to] = triangles[from];
+    break;
+  default:
+    custom[to] = custom[from];
+    break;
+  }
+}
+
+bool PrimitiveStore::hit(const PrimitiveRun &run, const Ray &r, hitRecord &rec,
+                         double tMin, double tMax) const {
+  switch (run.type) {
+  case PRIM_SPHERE: {
+    if (run.count == 1 || sphereData.count != spheres.size())
+      return hitRange(spheres, sources[PRIM_SPHERE], run.start,
+                      run.count, r, rec, tMin, tMax);
+    float t;
+    const int nearest =
+        hitSpheres(sphereData, run.start, run.count, r, tMax, t);
+    if (nearest < 0)
+      return false;
+    spheres[nearest].fillRecord(r, t, rec);
+    rec.object = sources[PRIM_SPHERE][nearest];
+    return true;
+  }
+  case PRIM_XY_RECT:
+    return hitRange(xyRects, sources[PRIM_XY_RECT], run.start,
+                    run.count, r, rec, tMin, tMax);
+  case PRIM_XZ_RECT:
+    return hitRange(xzRects, sources[PRIM_XZ_RECT], run.start,
+                    run.count, r, rec, tMin, tMax);
+  case PRIM_YZ_RECT:
+    return hitRange(yzRects, sources[PRIM_YZ_RECT], run.start,
+                    run.count, r, rec, tMin, tMax);
+  case PRIM_BOX:
+    return hitRange(boxes, sources[PRIM_BOX], run.start,
+                    run.count, r, rec, tMin, tMax);
+  case PRIM_TRIANGLE:
+    return hitRange(triangles, sources[PRIM_TRIANGLE], run.start,
+                    run.count, r, rec, tMin, tMax);
+  default: {
+    // Custom objects may write to the record on a miss, so use a temporary
+    hitRecord tempRec;
+    bool objHit = false;
+    double closest = tMax;
+    for (int i = run.start; i < run.start + run.count; i++) {
+      if (custom[i]->hit(r, tempRec, tMin, closest)) {
+        objHit = true;
+        closest = tempRec.t;
+        rec = tempRec;
+        rec.object = sources[PRIM_CUSTOM][i];
+      }
+    }
+    return objHit;
+  }
+  }
+}
+
+bool PrimitiveStore::boundingBox(PrimitiveRef ref, double t0, double t1,
+                                 aabb &outputBox) const {
+  switch (ref.type) {
+  case PRIM_SPHERE:
+    return spheres[ref.index].boundingBox(t0, t1, outputBox);
+  case PRIM_XY_RECT:
+    return xyRects[ref.index].boundingBox(t0, t1, outputBox);
+  case PRIM_XZ_RECT:
+    return xzRects[ref.index].boundingBox(t0, t1, outputBox);
+  case PRIM_YZ_RECT:
+    return yzRects[ref.index].boundingBox(t0, t1, outputBox);
+  case PRIM_BOX:
+    return boxes[ref.index].boundingBox(t0, t1, outputBox);
+  case PRIM_TRIANGLE:
+    return triangles[ref.index].boundingBox(t0, t1, outputBox);
+  default:
+    return custom[ref.index]->boundingBox(t0, t1, outputBox);
+  }
+}
+
+bool PrimitiveStore::motionBounds(PrimitiveRef ref, double t0, double t1,
+                                  aabb &start, aabb &end) const {
+  // Primitives stored by value don't move
+  if (ref.type == PRIM_CUSTOM)
+    return custom[ref.index]->motionBounds(t0, t1, start, end);
+  if (!boundingBox(ref, t0, t1, start))
+    return false;
+  end = start;
+  return true;
+}
+
+int PrimitiveStore::size(PrimitiveType type) const {
+  switch (type) {
+  case PRIM_SPHERE:
+    return spheres.size();
+  case PRIM_XY_RECT:
+    return xyRects.size();
+  case PRIM_XZ_RECT:
+    return xzRects.size();
+  case PRIM_YZ_RECT:
+    return yzRects.size();
+  case PRIM_BOX:
+    return boxes.size();
+  case PRIM_TRIANGLE:
+    return triangles.size();
+  default:
+    return custom.size();
+  }
+}
+
+void PrimitiveStore::packSpheres() { sphereData.pack(spheres); }
+
+void PrimitiveStore::clear() {
+  spheres.clear();
+  xyRects.clear();
+  xzRects.clear();
+  yzRects.clear();
+  boxes.clear();
+  triangles.clear();
+  custom.clear();
+  for (int i = 0; i < PRIM_TYPE_COUNT; i++)
+    sources[i].clear();
+  sphereData.clear();
+}
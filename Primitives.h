@@ -0,0 +1,99 @@
+#ifndef _PRIMITIVES_H
+#define _PRIMITIVES_H
+
+#include <vector>
+
+#include "Hittable.h"
+#include "Sphere.h"
+#include "SphereKernel.h"
+#include "Triangle.h"
+#include "aaBox.h"
+#include "aaRect.h"
+
+// The kinds of primitive that are stored by value. Anything else is kept as a
+// Hittable pointer and goes through the virtual interface.
+enum PrimitiveType : unsigned char {
+  PRIM_SPHERE,
+  PRIM_XY_RECT,
+  PRIM_XZ_RECT,
+  PRIM_YZ_RECT,
+  PRIM_BOX,
+  PRIM_TRIANGLE,
+  PRIM_CUSTOM,
+  PRIM_TYPE_COUNT
+};
+
+// A primitive given by its type and its index in that type's array
+struct PrimitiveRef {
+  PrimitiveType type;
+  int index;
+};
+
+// A contiguous range of primitives of one type
+struct PrimitiveRun {
+  PrimitiveType type;
+  int start;
+  int count;
+};
+
+// The type o is stored as
+PrimitiveType primitiveType(const Hittable *o);
+
+// Primitives sorted into one contiguous array per type. Runs of a type are
+// tested with a switch on the type and non-virtual calls, so the compiler can
+// inline the intersection code.
+class PrimitiveStore {
+public:
+  // Copies o into the array of its type, or keeps the pointer if it is not
+  // one of the known primitives. Returns where it was put.
+  PrimitiveRef add(Hittable *o);
+
+  // Copies a primitive from another store to the end of its array here
+  PrimitiveRef append(const PrimitiveStore &from, PrimitiveRef ref);
+
+  // Copies o over the primitive at ref again, after o was edited. Returns
+  // false if o is not of ref's type.
+  bool set(PrimitiveRef ref, const Hittable *o);
+
+  // Copies the primitive at index from of a type over the one at index to
+  void copy(PrimitiveType type, int from, int to);
+
+  // Returns true if the ray hits a primitive of the run, and stores the
+  // closest hit in rec.
+  bool hit(const PrimitiveRun &run, const Ray &r, hitRecord &rec, double tMin,
+           double tMax) const;
+
+  bool boundingBox(PrimitiveRef ref, double t0, double t1,
+                   aabb &outputBox) const;
+
+  // Bounds at t0 and t1, see Hittable::motionBounds()
+  bool motionBounds(PrimitiveRef ref, double t0, double t1, aabb &start,
+                    aabb &end) const;
+
+  // Number of primitives of a type
+  int size(PrimitiveType type) const;
+
+  // Copies the spheres into sphereData. Until this is called again, runs of
+  // spheres are tested one at a time.
+  void packSpheres();
+
+  void clear();
+
+  std::vector<Sphere> spheres;
+  std::vector<XYRectangle> xyRects;
+  std::vector<XZRectangle> xzRects;
+  std::vector<YZRectangle> yzRects;
+  std::vector<Box> boxes;
+  std::vector<Triangle> triangles;
+  // Adapter for everything else (instances, media, lists...)
+  std::vector<Hittable *> custom;
+
+  // The object each primitive was copied from, per type, so an edited object
+  // can be found again
+  std::vector<const Hittable *> sources[PRIM_TYPE_COUNT];
+
+  // The spheres again as a structure of arrays, for the vectorised kernel
+  SphereSoA sphereData;
+};
+
+#endif
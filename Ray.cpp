@@ -24,6 +24,13 @@ Point Ray::pointAtTime(float t) const {
   return add(point(scale(t, direction)), origin);
 }
 
+void Ray::scaleDifferentials(float s) {
+  rxOrigin = add(origin, point(scale(s, sub(rxOrigin, origin).direction())));
+  ryOrigin = add(origin, point(scale(s, sub(ryOrigin, origin).direction())));
+  rxDirection = add(direction, scale(s, sub(rxDirection, direction)));
+  ryDirection = add(direction, scale(s, sub(ryDirection, direction)));
+}
+
 std::ostream &operator<<(std::ostream &out, const Ray &point) {
   std::cout << "Ray("
             << "Point(" << point.origin.x << ", " << point.origin.y << ", "
@@ -2,6 +2,7 @@
 #define _RAY_H
 
 #include "Point.h"
+#include "Sampler.h"
 #include "Vec.h"
 #include <iostream>
 
@@ -11,6 +12,24 @@ public:
 
   Vec direction;
 
+  // The sampler of the path the ray belongs to, for objects that need random
+  // numbers to be hit (media). Instances must copy the ray to keep it.
+  Sampler *sampler = nullptr;
+
+  // The moment during the shutter the ray was sent at. Moving objects are
+  // hit where they were at that time; rays leaving a hit keep it.
+  float time = 0;
+
+  // Only asks whether something blocks the way to a light. Media don't
+  // scatter shadow rays; their transmittance is accounted for separately.
+  bool shadow = false;
+
+  // Optional rays through the neighbouring pixels (one to the right, one
+  // down), to work out how much of a surface a pixel covers
+  bool hasDifferentials = false;
+  Point rxOrigin, ryOrigin;
+  Vec rxDirection, ryDirection;
+
   Ray();
 
   Ray(Point &origin, Vec &direction);
@@ -19,6 +38,10 @@ public:
 
   Point pointAtTime(float t) const;
 
+  // Moves the differential rays towards the main one, to the spacing of s
+  // pixels
+  void scaleDifferentials(float s);
+
   friend std::ostream &operator<<(std::ostream &out, const Vec &point);
 };
 
@@ -0,0 +1,199 @@
+#include "RenderService.h"
+
+#include <algorithm>
+#include <chrono>
+#include <omp.h>
+
+// Preview passes rendered after the camera last moved
+static const int PREVIEW_PASSES = 4;
+
+RenderService::RenderService(Scene &s, int threads)
+    : scene(s),
+      threads(threads > 0 ? threads : std::max(1, omp_get_num_procs() - 1)) {
+  worker = std::thread(&RenderService::run, this);
+}
+
+RenderService::~RenderService() {
+  {
+    std::lock_guard<std::mutex> guard(queueLock);
+    quit = true;
+    interrupt = true;
+  }
+  wake.notify_one();
+  worker.join();
+}
+
+void RenderService::send(const RenderCommand &command) {
+  {
+    std::lock_guard<std::mutex> guard(queueLock);
+    queue.push_back(command);
+    if (command.type != RENDER_MOVE || !previewing)
+      interrupt = true;
+  }
+  wake.notify_one();
+}
+
+void RenderService::start() { send(RenderCommand{RENDER_START}); }
+
+void RenderService::stop() { send(RenderCommand{RENDER_STOP}); }
+
+void RenderService::reset() { send(RenderCommand{RENDER_RESET}); }
+
+void RenderService::setCamera(const PinholeCamera &camera) {
+  RenderCommand command{RENDER_CAMERA};
+  command.camera = camera;
+  send(command);
+}
+
+void RenderService::moveCamera(const PinholeCamera &camera) {
+  RenderCommand command{RENDER_MOVE};
+  command.camera = camera;
+  send(command);
+}
+
+void RenderService::setTone(const ToneSettings &tone) {
+  RenderCommand command{RENDER_TONE};
+  command.tone = tone;
+  send(command);
+}
+
+void RenderService::setDenoise(const DenoiseSettings &denoise) {
+  RenderCommand command{RENDER_DENOISE};
+  command.denoise = denoise;
+  send(command);
+}
+
+void RenderService::edit(std::function<void(Scene &)> edit) {
+  RenderCommand command{RENDER_EDIT};
+  command.edit = edit;
+  send(command);
+}
+
+std::unique_lock<std::mutex> RenderService::lockScene() {
+  return std::unique_lock<std::mutex>(sceneLock);
+}
+
+int RenderService::present(FrameDisplay &display) {
+  std::lock_guard<std::mutex> guard(frontLock);
+  return display.update(buffers[front]);
+}
+
+void RenderService::touchRows() {
+  for (unsigned int &version : scene.rowVersions)
+    version++;
+}
+
+void RenderService::publish() {
+  // Only this thread swaps, so the back buffer can't become the front one
+  // while it is written
+  const int back = 1 - front;
+  if (denoise.enabled) {
+    // A change anywhere spreads as far as the filter reaches, so the whole
+    // image is filtered and converted again
+    if (scene.rowVersions != denoisedVersions) {
+      const auto start = std::chrono::steady_clock::now();
+      denoiser.run(scene, denoise);
+      denoiseMicroseconds =
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - start)
+              .count();
+      touchRows();
+      denoisedVersions = scene.rowVersions;
+    }
+    buffers[back].update(scene, denoiser.sums.data());
+  } else {
+    buffers[back].update(scene);
+  }
+  std::lock_guard<std::mutex> guard(frontLock);
+  front = back;
+}
+
+void RenderService::run() {
+  // The setting is per thread, so it only applies to the passes
+  omp_set_num_threads(threads);
+  bool active = false;
+  while (true) {
+    std::deque<RenderCommand> commands;
+    {
+      std::unique_lock<std::mutex> guard(queueLock);
+      wake.wait(guard, [&] { return quit || active || !queue.empty(); });
+      if (quit)
+        return;
+      commands.swap(queue);
+      interrupt = false;
+    }
+
+    if (!commands.empty()) {
+      std::lock_guard<std::mutex> guard(sceneLock);
+      bool edited = false;
+      // Only the last move of a batch is worth reprojecting to
+      size_t lastMove = commands.size();
+      for (size_t i = 0; i < commands.size(); i++)
+        if (commands[i].type == RENDER_CAMERA || commands[i].type == RENDER_MOVE)
+          lastMove = i;
+      for (size_t i = 0; i < commands.size(); i++) {
+        const RenderCommand &command = commands[i];
+        switch (command.type) {
+        case RENDER_START:
+          active = true;
+          break;
+        case RENDER_STOP:
+          active = false;
+          break;
+        case RENDER_RESET:
+          scene.resetAccumulation();
+          break;
+        case RENDER_CAMERA:
+          scene.camera = command.camera;
+          scene.resetAccumulation();
+          previewPasses = 0;
+          break;
+        case RENDER_MOVE:
+          if (i != lastMove)
+            break;
+          scene.reproject(command.camera);
+          previewPasses = PREVIEW_PASSES;
+          break;
+        case RENDER_TONE:
+          scene.tone = command.tone;
+          // The display only uploads rows that changed
+          touchRows();
+          break;
+        case RENDER_DENOISE:
+          denoise = command.denoise;
+          scene.features = denoise.enabled;
+          denoisedVersions.clear();
+          touchRows();
+          break;
+        case RENDER_EDIT:
+          command.edit(scene);
+          edited = true;
+          break;
+        }
+      }
+      if (edited)
+        scene.updateBVH();
+      rendering = active;
+      // Resets show up even when nothing is rendering
+      publish();
+    }
+    if (!active)
+      continue;
+
+    const auto start = std::chrono::steady_clock::now();
+    rows = 0;
+    scene.preview = previewPasses > 0;
+    previewing = scene.preview;
+    scene.render(&interrupt, &rows);
+    previewing = false;
+    if (!interrupt) {
+      if (previewPasses > 0)
+        previewPasses--;
+      passes++;
+      passMicroseconds = std::chrono::duration_cast<std::chrono::microseconds>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+    }
+    publish();
+  }
+}
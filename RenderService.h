@@ -0,0 +1,144 @@
+#ifndef _RENDER_SERVICE_H
+#define _RENDER_SERVICE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Denoiser.h"
+#include "FrameDisplay.h"
+#include "PinholeCamera.h"
+#include "Scene.h"
+
+enum RenderCommandType {
+  RENDER_START,
+  RENDER_STOP,
+  // Clears what has been accumulated
+  RENDER_RESET,
+  // Moves to another camera and starts accumulating again
+  RENDER_CAMERA,
+  // Moves to another camera, reprojecting what has been accumulated, and
+  // renders preview passes for a while
+  RENDER_MOVE,
+  // Develops the image with other tone settings
+  RENDER_TONE,
+  // Turns the denoiser on or off, or changes its settings
+  RENDER_DENOISE,
+  // Runs a function on the scene
+  RENDER_EDIT
+};
+
+struct RenderCommand {
+  RenderCommandType type;
+  PinholeCamera camera;
+  ToneSettings tone;
+  DenoiseSettings denoise;
+  std::function<void(Scene &)> edit;
+};
+
+// Renders a scene on a thread of its own, one pass after another, so the
+// thread showing it never waits for a pass. Everything that changes the scene
+// goes through the command queue and is applied between passes; a new
+// command cuts the current pass short. Finished passes are converted into one
+// of two frame buffers while the other one is shown.
+class RenderService {
+public:
+  // Renders with threads threads, or every core but one if it is 0
+  RenderService(Scene &s, int threads = 0);
+
+  // Stops the thread, leaving the scene as it was after the last pass
+  ~RenderService();
+
+  RenderService(const RenderService &) = delete;
+
+  RenderService &operator=(const RenderService &) = delete;
+
+  void start();
+
+  void stop();
+
+  void reset();
+
+  void setCamera(const PinholeCamera &camera);
+
+  // For a camera being dragged around: the image follows it at one sample
+  // per pixel, reusing what is still in view, and converges once it stops.
+  // Moves don't interrupt preview passes, so those always finish.
+  void moveCamera(const PinholeCamera &camera);
+
+  // Only changes how the image is developed, so nothing is rendered again
+  void setTone(const ToneSettings &tone);
+
+  // Shows the image denoised, filtering it again after every pass. The scene
+  // gathers the features the filter needs while it is on.
+  void setDenoise(const DenoiseSettings &denoise);
+
+  // Runs edit on the scene between two passes. The BVH is brought up to date
+  // afterwards, and edit decides what to reset.
+  void edit(std::function<void(Scene &)> edit);
+
+  // Keeps commands from running while the caller reads the scene or makes
+  // objects in its arena. The scene can be read while a pass is rendering,
+  // but nothing in it may be changed.
+  std::unique_lock<std::mutex> lockScene();
+
+  // Uploads the rows of the latest frame that changed to display
+  int present(FrameDisplay &display);
+
+  // Progress, readable from any thread without waiting
+  std::atomic<bool> rendering{false};
+  std::atomic<unsigned int> passes{0};
+  // Rows finished in the current pass
+  std::atomic<int> rows{0};
+  // How long the last full pass took
+  std::atomic<uint64_t> passMicroseconds{0};
+  // How long the denoiser took on the last frame
+  std::atomic<uint64_t> denoiseMicroseconds{0};
+
+private:
+  void send(const RenderCommand &command);
+
+  void run();
+
+  // Converts the scene into the back buffer, denoised if it is on, and swaps
+  // it to the front
+  void publish();
+
+  // Marks every row of the scene as changed, so every row is converted again
+  void touchRows();
+
+  Scene &scene;
+  int threads;
+
+  std::mutex queueLock;
+  std::condition_variable wake;
+  std::deque<RenderCommand> queue;
+  bool quit = false;
+  // Set when a command arrives, to cut the pass short
+  std::atomic<bool> interrupt{false};
+  // Whether the pass being rendered is a preview
+  std::atomic<bool> previewing{false};
+  // Preview passes left before full ones, counted by the render thread
+  int previewPasses = 0;
+
+  DenoiseSettings denoise;
+  Denoiser denoiser;
+  // Scene::rowVersions when the denoiser last ran
+  std::vector<unsigned int> denoisedVersions;
+
+  std::mutex sceneLock;
+
+  // buffers[front] is shown, the other one is written
+  std::mutex frontLock;
+  FrameBuffer buffers[2];
+  int front = 0;
+
+  std::thread worker;
+};
+
+#endif
@@ -82,7 +82,9 @@ bool Rotation::hit(const Ray &r, hitRecord &rec, double tMin,
   direction.z = sinXTheta * r.direction.x + cosXTheta * r.direction.z;
 
   // Rotate the ray
-  Ray rotated(origin, direction);
+  Ray rotated = r;
+  rotated.origin = origin;
+  rotated.direction = direction;
   if (!obj->hit(rotated, rec, tMin, tMax))
     return false;
 
@@ -97,6 +99,12 @@ bool Rotation::hit(const Ray &r, hitRecord &rec, double tMin,
   normal.x = cosXTheta * rec.normal.x + sinXTheta * rec.normal.z;
   normal.z = -sinXTheta * rec.normal.x + cosXTheta * rec.normal.z;
 
+  // and the derivatives, which turn the same way
+  rec.dpdu = rotateOut(rec.dpdu);
+  rec.dpdv = rotateOut(rec.dpdv);
+  rec.dndu = rotateOut(rec.dndu);
+  rec.dndv = rotateOut(rec.dndv);
+
   rec.p = p;
   rec.normal =
       // (dotProduct(rec.normal, rotated.direction) > 0.0) ? -normal :
@@ -106,6 +114,11 @@ bool Rotation::hit(const Ray &r, hitRecord &rec, double tMin,
   return true;
 }
 
+Vec Rotation::rotateOut(const Vec &v) const {
+  return Vec(cosXTheta * v.x + sinXTheta * v.z, v.y,
+             -sinXTheta * v.x + cosXTheta * v.z);
+}
+
 bool Rotation::boundingBox(double t0, double t1, aabb &outputBox) const {
   outputBox = rotBox;
   return hasBox;
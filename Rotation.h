@@ -19,10 +19,13 @@ public:
   //   return obj->pdfValue(origin, vec);
   // }
 
-  // virtual Vec random(const Point &origin) const override {
-  //   return obj->random(origin);
+  // virtual Vec random(const Point &origin, Sampler &sampler) const override {
+  //   return obj->random(origin, sampler);
   // }
 
+  // Turns a vector from the object's space back into the scene's
+  Vec rotateOut(const Vec &v) const;
+
   Hittable *obj;
   bool hasBox;
   aabb rotBox;
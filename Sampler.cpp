@@ -0,0 +1,35 @@
+#include "Sampler.h"
+
+// Scrambles the bits of x so that nearby seeds give unrelated sequences
+static uint64_t splitMix(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+Sampler::Sampler(uint64_t seed) : state(splitMix(seed)) {}
+
+Sampler::Sampler(int x, int y, uint64_t sampleIndex, uint64_t seed)
+    : state(splitMix(splitMix(splitMix(seed ^ (uint32_t)x) ^ (uint32_t)y) ^
+                     sampleIndex)) {}
+
+// PCG32 (XSH RR)
+uint32_t Sampler::nextBits() {
+  const uint64_t old = state;
+  state = old * 6364136223846793005ULL + 1442695040888963407ULL;
+  const uint32_t xorShifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+  const uint32_t rot = (uint32_t)(old >> 59u);
+  return (xorShifted >> rot) | (xorShifted << ((-rot) & 31));
+}
+
+// The top 24 bits fill a float's mantissa exactly, so the result is never 1
+float Sampler::next() { return (nextBits() >> 8) * (1.0f / 16777216.0f); }
+
+float Sampler::next(float min, float max) {
+  return min + (max - min) * next();
+}
+
+int Sampler::nextInt(int min, int max) {
+  return min + (int)(nextBits() % (uint32_t)(max - min + 1));
+}
@@ -0,0 +1,33 @@
+#ifndef _SAMPLER_H
+#define _SAMPLER_H
+
+#include <cstdint>
+
+// Random numbers for one path. Every path gets its own sampler seeded from
+// its pixel and sample index, so threads never share generator state and a
+// render comes out the same whatever the thread count.
+class Sampler {
+public:
+  Sampler(uint64_t seed = 0);
+
+  // Seeds from a pixel, the index of the sample in that pixel and a scene
+  // wide seed
+  Sampler(int x, int y, uint64_t sampleIndex, uint64_t seed = 0);
+
+  // Uniform number in [0, 1)
+  float next();
+
+  // Uniform number in [min, max)
+  float next(float min, float max);
+
+  // Uniform integer in [min, max]
+  int nextInt(int min, int max);
+
+  // PCG32 state, can be saved and restored to repeat a sequence
+  uint64_t state;
+
+private:
+  uint32_t nextBits();
+};
+
+#endif
@@ -1,5 +1,4 @@
 #include "Scene.h"
-#include "./BVHNode.h"
 #include "./Functions.h"
 #include "./Hittable.h"
 #include "./Light.h"
@@ -9,17 +8,22 @@
 #include "./Vec.h"
 #include "PinholeCamera.h"
 #include "RandomGenerator.h"
+#include "Textures/BakedTexture.h"
 #include "pdf/HittablePDF.h"
 
 #include "Compute.h"
-#include "pdf/CosineONB_PDF.h"
-#include "pdf/CosinePDF.h"
-#include "pdf/MixturePDF.h"
+#include <algorithm>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <iterator>
+#include <omp.h>
 #include <random>
+#include <string>
 #include <thread>
+#include <unistd.h>
+#include <unordered_map>
 #include <vector>
 
 #include <SDL2/SDL.h>
@@ -46,39 +50,611 @@ Scene::Scene(int w, int h, PinholeCamera cam, Point bg, double *rawPixelPtr) {
   raw = rawPixelPtr;
 }
 
-void Scene::createBVHBox() { box = new BVHNode(hittables, 0, FLT_INF); }
+void Scene::createBVHBox() {
+  bvh.build(hittables.objects, shutterOpen, shutterClose);
+  media.clear();
+  for (Hittable *o : hittables.objects)
+    if (o->participating())
+      media.push_back(o);
+  added.clear();
+  addedBVH.clear();
+  addedChanged = false;
+  bvhDirty = false;
+}
+
+// Rebuild once the refit tree costs this much more to traverse than it did
+// when it was built
+static const double REFIT_LIMIT = 1.5;
+
+// Objects that can be added before the tree is rebuilt, at least this many
+// or an eighth of the scene
+static const size_t ADDED_LIMIT = 64;
+
+bool Scene::updateBVH() {
+  if (bvhDirty || bvh.empty() ||
+      added.size() > std::max(ADDED_LIMIT, hittables.objects.size() / 8)) {
+    createBVHBox();
+    return false;
+  }
+  if (bvh.shutterOpen != shutterOpen || bvh.shutterClose != shutterClose) {
+    bvh.refit(shutterOpen, shutterClose);
+    addedChanged = addedChanged || !added.empty();
+  }
+  if (bvh.cost() > REFIT_LIMIT * bvh.builtCost) {
+    createBVHBox();
+    return false;
+  }
+  if (addedChanged) {
+    addedBVH.build(added, shutterOpen, shutterClose);
+    addedChanged = false;
+  }
+  return true;
+}
+
+bool Scene::hitObjects(const Ray &r, hitRecord &rec, double tMin,
+                       double tMax) const {
+  bool objHit = bvh.hit(r, rec, tMin, tMax);
+  if (!addedBVH.empty() &&
+      addedBVH.hit(r, rec, tMin, objHit ? rec.t : tMax))
+    objHit = true;
+  return objHit;
+}
+
+// How far along a camera ray something is taken to be when the ray hits
+// nothing
+static const float MISS_DISTANCE = 1e6f;
+
+// A reprojected pixel keeps its samples if the pass sees a surface this close
+// to the old one, relative to its distance from the camera
+static const float REPROJECT_TOLERANCE = 0.05f;
+
+// What reproject() keeps of a pixel weighs at most this many passes
+static const unsigned int HISTORY_PASSES = 4;
 
-void Scene::render() const {
+static float distanceBetween(const Point &a, const Point &b) {
+  const float dx = a.x - b.x, dy = a.y - b.y, dz = a.z - b.z;
+  return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+// Adds a sample's AOVs to the passes that are on, those with room in rows,
+// at pixel x. Object IDs are only taken from the first sample of a pass.
+static void addAovs(std::vector<float> *rows, int x, const FirstHit &first,
+                    const Point *lighting, bool firstSample,
+                    const std::unordered_map<const Hittable *, float> &ids) {
+  const Point colours[AOV_DEPTH] = {
+      lighting[AOV_DIRECT], lighting[AOV_INDIRECT], lighting[AOV_EMISSION],
+      first.albedo, point(first.normal)};
+  for (int pass = 0; pass < AOV_DEPTH; pass++) {
+    if (rows[pass].empty())
+      continue;
+    float *to = &rows[pass][x * 3];
+    to[0] += colours[pass].x;
+    to[1] += colours[pass].y;
+    to[2] += colours[pass].z;
+  }
+  if (!rows[AOV_DEPTH].empty())
+    rows[AOV_DEPTH][x] += first.depth;
+  if (!rows[AOV_OBJECT_ID].empty() && firstSample) {
+    const auto id = ids.find(first.object);
+    rows[AOV_OBJECT_ID][x] = id != ids.end() ? id->second : -1.0f;
+  }
+}
+
+void Scene::allocateAovs() {
+  if (aovs == aovsAllocated &&
+      (aovs == 0 || aovSamples.size() == (size_t)width * height))
+    return;
+  for (int pass = 0; pass < AOV_COUNT; pass++)
+    aovSums[pass].assign(aovs & aovBit((AovPass)pass)
+                             ? (size_t)width * height *
+                                   aovChannels((AovPass)pass)
+                             : 0,
+                         pass == AOV_OBJECT_ID ? -1.0f : 0.0f);
+  aovSamples.assign(aovs != 0 ? (size_t)width * height : 0, 0);
+  aovsAllocated = aovs;
+}
+
+void Scene::render(const std::atomic<bool> *interrupt,
+                   std::atomic<int> *rowsDone) {
+  const int n = preview ? 1 : samples;
+  const uint64_t firstSample = (uint64_t)passIndex * n;
+  const unsigned int passSeed = preview ? ~seed : seed;
+  // The samples of a pass cover the pixel between them, so each one only
+  // needs a share of its footprint
+  const float footprint = std::fmax(0.125f, 1.0f / std::sqrt((float)n));
+  const bool lens = camera.hasLens();
+  const bool motion = shutterClose > shutterOpen;
+  const Point eye = camera.getLocation();
+  if (pixelSamples.size() != (size_t)width * height)
+    pixelSamples.assign((size_t)width * height, 0);
+  if (firstHits.size() != (size_t)width * height) {
+    firstHits.assign((size_t)width * height, Point(0, 0, 0));
+    reprojected.assign((size_t)width * height, 0);
+  }
+  if (features && featureSamples.size() != (size_t)width * height) {
+    featureSums.assign((size_t)width * height * FEATURE_CHANNELS, 0.0f);
+    featureSamples.assign((size_t)width * height, 0);
+  }
+  allocateAovs();
+  // Only the passes that split the radiance change how paths are traced
+  const bool split = (aovs & AOV_LIGHTING) != 0;
+  const bool gather = features || aovs != 0;
+  std::unordered_map<const Hittable *, float> objectIds;
+  if (aovs & aovBit(AOV_OBJECT_ID))
+    for (size_t i = 0; i < hittables.objects.size(); i++)
+      objectIds[hittables.objects[i]] = i;
+  rowVersions.resize(height);
+
+  if (filterTable.type() != film.filter ||
+      filterTable.radius() != film.radius)
+    filterTable = FilterTable(film.filter, film.radius);
+  // Samples in a box over the pixel keep their plain jitter, and so the same
+  // images
+  const bool importance =
+      !film.splat &&
+      (film.filter != FILTER_BOX || filterTable.radius() != 0.5f);
+  const bool splat = film.splat;
+  if (splat && (int)filmTiles.size() < omp_get_max_threads())
+    filmTiles.resize(omp_get_max_threads());
+  std::vector<float> coverageX, coverageY;
+  std::vector<unsigned char> rendered(splat ? height : 0);
+  // The threads, and so the tiles, the pass ran on
+  int tilesUsed = 0;
+  if (splat) {
+    filterCoverage(filterTable, width, coverageX);
+    filterCoverage(filterTable, height, coverageY);
+  }
 #pragma omp parallel
   {
-#pragma omp for nowait
-    for (int y = 0; y < height; y++) {
-      for (int x = 0; x < width * 3; x += 3) {
-        Ray r;
-        Point col;
-
-        for (int i = 0; i < samples; i++) {
-          camera.getPrimaryRay(float(x) / 3 + joetracer::randomOne(),
-                               float(y) + joetracer::randomOne(), r);
-          col = add(col, Colour(r, bounces));
+    // Per thread: one row of samplers and camera samples, and the row's rays
+    std::vector<Sampler> samplers(width);
+    std::vector<float> jitterX(width), jitterY(width);
+    std::vector<float> weights(importance ? width : 0);
+    // Rows are shared out in even runs, one a thread, so a thread's splats
+    // stay within its run and the rows the filter reaches either side
+    const int threads = omp_get_num_threads();
+    const int thread = omp_get_thread_num();
+    const int yStart = (int)((int64_t)height * thread / threads);
+    const int yEnd = (int)((int64_t)height * (thread + 1) / threads);
+    if (thread == 0)
+      tilesUsed = threads;
+    FilmTile *tile = splat ? &filmTiles[thread] : nullptr;
+    if (splat)
+      tile->reset(width, height, yStart, yEnd, filterTable);
+    // Where a sample goes: splatted, weighted by the filter it was picked
+    // from, or as it is
+    const auto addSample = [&](int x, int y, const Point &c,
+                               std::vector<Point> &row) {
+      if (splat)
+        tile->splat(x + jitterX[x], y + jitterY[x], c, filterTable);
+      else
+        row[x] = add(row[x], importance ? scale(weights[x], c) : c);
+    };
+    std::vector<float> lensU(lens ? width : 0), lensV(lens ? width : 0);
+    std::vector<float> times(motion ? width : 0);
+    std::vector<Point> row(width);
+    std::vector<Point> hits(width);
+    std::vector<float> rowFeatures(features ? width * FEATURE_CHANNELS : 0);
+    std::vector<float> rowAovs[AOV_COUNT];
+    for (int pass = 0; pass < AOV_COUNT; pass++)
+      if (aovs & aovBit((AovPass)pass))
+        rowAovs[pass].resize(width * aovChannels((AovPass)pass));
+    RayBatch rays;
+
+    for (int y = yStart; y < yEnd; y++) {
+      if (interrupt != nullptr && interrupt->load(std::memory_order_relaxed))
+        continue;
+      if (splat)
+        rendered[y] = 1;
+      std::fill(row.begin(), row.end(), Point(0, 0, 0));
+      std::fill(rowFeatures.begin(), rowFeatures.end(), 0.0f);
+      for (std::vector<float> &pass : rowAovs)
+        std::fill(pass.begin(), pass.end(), 0.0f);
+
+      for (int i = 0; i < n; i++) {
+        for (int x = 0; x < width; x++) {
+          samplers[x] = Sampler(x, y, firstSample + i, passSeed);
+          jitterX[x] = samplers[x].next();
+          jitterY[x] = samplers[x].next();
+          if (importance) {
+            // Offsets from the pixel's centre picked by the filter
+            float wx, wy;
+            jitterX[x] = 0.5f + filterTable.sample(jitterX[x], wx);
+            jitterY[x] = 0.5f + filterTable.sample(jitterY[x], wy);
+            weights[x] = wx * wy;
+          }
+          if (lens) {
+            lensU[x] = samplers[x].next();
+            lensV[x] = samplers[x].next();
+          }
+          if (motion)
+            times[x] = shutterOpen +
+                       samplers[x].next() * (shutterClose - shutterOpen);
         }
+        camera.getPrimaryRays(0, y, width, 1, jitterX.data(), jitterY.data(),
+                              lens ? lensU.data() : nullptr,
+                              lens ? lensV.data() : nullptr, rayDifferentials,
+                              rays);
 
-        raw[y * (width * 3) + x] += col.x;
-        raw[y * (width * 3) + x + 1] += col.y;
-        raw[y * (width * 3) + x + 2] += col.z;
-
-        // // R channel
-        // pixels[y * (width * 3) + x] =
-        //     (col.x / samples >= 255) ? 255 : col.x / samples;
-        // // G channel
-        // pixels[y * (width * 3) + x + 1] =
-        //     (col.y / samples >= 255) ? 255 : col.y / samples;
-        // // B channel
-        // pixels[y * (width * 3) + x + 2] =
-        //     (col.z / samples >= 255) ? 255 : col.z / samples;
+        for (int x = 0; x < width; x++) {
+          Ray r;
+          rays.get(x, r);
+          r.time = motion ? times[x] : shutterOpen;
+          if (rayDifferentials)
+            r.scaleDifferentials(footprint);
+          if (i > 0 && !gather) {
+            addSample(x, y, Colour(r, bounces, samplers[x]), row);
+            continue;
+          }
+          FirstHit first;
+          Point lighting[3];
+          const Point c =
+              split ? trace<true>(r, bounces, samplers[x], &first, lighting)
+                    : Colour(r, bounces, samplers[x], &first);
+          addSample(x, y, c, row);
+          if (i == 0)
+            hits[x] = first.p;
+          if (aovs != 0)
+            addAovs(rowAovs, x, first, lighting, i == 0, objectIds);
+          if (features) {
+            float *f = &rowFeatures[x * FEATURE_CHANNELS];
+            const float luminance =
+                0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+            f[FEATURE_ALBEDO] += first.albedo.x;
+            f[FEATURE_ALBEDO + 1] += first.albedo.y;
+            f[FEATURE_ALBEDO + 2] += first.albedo.z;
+            f[FEATURE_NORMAL] += first.normal.x;
+            f[FEATURE_NORMAL + 1] += first.normal.y;
+            f[FEATURE_NORMAL + 2] += first.normal.z;
+            f[FEATURE_DEPTH] += first.depth;
+            f[FEATURE_LUMINANCE] += luminance;
+            f[FEATURE_LUMINANCE_SQUARED] += luminance * luminance;
+          }
+        }
+      }
+
+      for (int x = 0; x < width; x++) {
+        const int p = y * width + x;
+        // Samples reprojected from another view only count if this pass sees
+        // the same surface there
+        if (reprojected[p]) {
+          reprojected[p] = 0;
+          if (distanceBetween(firstHits[p], hits[x]) >
+              REPROJECT_TOLERANCE * distanceBetween(eye, hits[x])) {
+            raw[p * 3] = raw[p * 3 + 1] = raw[p * 3 + 2] = 0;
+            pixelSamples[p] = 0;
+          }
+        }
+        firstHits[p] = hits[x];
+        raw[p * 3] += row[x].x;
+        raw[p * 3 + 1] += row[x].y;
+        raw[p * 3 + 2] += row[x].z;
+        // Splatted samples are counted once they are all in. Features and
+        // AOVs aren't splatted, so the rows done count for them either way.
+        if (!splat)
+          pixelSamples[p] += n;
+        if (features) {
+          for (int c = 0; c < FEATURE_CHANNELS; c++)
+            featureSums[(size_t)p * FEATURE_CHANNELS + c] +=
+                rowFeatures[x * FEATURE_CHANNELS + c];
+          featureSamples[p] += n;
+        }
+        if (aovs != 0) {
+          for (int pass = 0; pass < AOV_COUNT; pass++) {
+            const int channels = aovChannels((AovPass)pass);
+            float *sums = aovSums[pass].data() + (size_t)p * channels;
+            const float *add = rowAovs[pass].data() + x * channels;
+            if (rowAovs[pass].empty())
+              continue;
+            if (pass == AOV_OBJECT_ID)
+              sums[0] = add[0];
+            else
+              for (int c = 0; c < channels; c++)
+                sums[c] += add[c];
+          }
+          aovSamples[p] += n;
+        }
+      }
+      if (!splat)
+        rowVersions[y]++;
+      if (rowsDone != nullptr)
+        rowsDone->fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  // Each row takes what every thread splatted into it, in the same order
+  // whichever thread gets it. A pass that was interrupted is thrown away:
+  // the rows next to the ones skipped would miss their splats.
+  if (splat) {
+    const bool complete =
+        std::find(rendered.begin(), rendered.end(), 0) == rendered.end();
+#pragma omp parallel for schedule(static)
+    for (int y = 0; y < height; y++) {
+      if (complete) {
+        for (int t = 0; t < tilesUsed; t++)
+          filmTiles[t].addRow(y, raw + (size_t)y * width * 3,
+                              coverageX.data(), 1.0 / coverageY[y]);
+        for (int x = 0; x < width; x++)
+          pixelSamples[(size_t)y * width + x] += n;
       }
+      if (rendered[y])
+        rowVersions[y]++;
     }
   }
+  passIndex++;
+}
+
+void Scene::resetAccumulation() {
+  std::fill(raw, raw + width * height * 3, 0.0);
+  pixelSamples.assign((size_t)width * height, 0);
+  clearAuxiliary();
+  rowVersions.resize(height);
+  for (unsigned int &version : rowVersions)
+    version++;
+}
+
+void Scene::clearAuxiliary() {
+  std::fill(featureSums.begin(), featureSums.end(), 0.0f);
+  std::fill(featureSamples.begin(), featureSamples.end(), 0);
+  for (int pass = 0; pass < AOV_COUNT; pass++)
+    std::fill(aovSums[pass].begin(), aovSums[pass].end(),
+              pass == AOV_OBJECT_ID ? -1.0f : 0.0f);
+  std::fill(aovSamples.begin(), aovSamples.end(), 0);
+}
+
+bool Scene::reproject(const PinholeCamera &next) {
+  const size_t count = (size_t)width * height;
+  camera = next;
+  const Point eye = camera.getLocation();
+  if (pixelSamples.size() != count || firstHits.size() != count ||
+      !camera.canProject()) {
+    resetAccumulation();
+    return false;
+  }
+
+  const unsigned int limit = HISTORY_PASSES * std::max(samples, 1);
+  std::vector<double> history(count * 3, 0.0);
+  std::vector<unsigned int> historySamples(count, 0);
+  std::vector<Point> historyHits(count);
+  std::vector<float> depth(count, DBL_INF);
+  float px, py;
+  // Every pixel moves to where its hit is seen from now, so several can land
+  // on the same one; the nearest to the camera is kept
+  for (size_t i = 0; i < count; i++) {
+    if (pixelSamples[i] == 0 || !camera.project(firstHits[i], px, py) ||
+        !(px >= 0 && px < width && py >= 0 && py < height))
+      continue;
+    const size_t to = (size_t)py * width + (size_t)px;
+    const float d = distanceBetween(eye, firstHits[i]);
+    if (d >= depth[to])
+      continue;
+    depth[to] = d;
+    const double keep =
+        pixelSamples[i] > limit ? (double)limit / pixelSamples[i] : 1.0;
+    history[to * 3] = raw[i * 3] * keep;
+    history[to * 3 + 1] = raw[i * 3 + 1] * keep;
+    history[to * 3 + 2] = raw[i * 3 + 2] * keep;
+    historySamples[to] = std::min(pixelSamples[i], limit);
+    historyHits[to] = firstHits[i];
+  }
+
+  // Moving closer spreads the pixels apart, leaving gaps between them. A gap
+  // takes the nearest of the pixels beside it, which the next pass checks like
+  // any other.
+  std::copy(history.begin(), history.end(), raw);
+  pixelSamples = historySamples;
+  firstHits = historyHits;
+  reprojected.assign(count, 0);
+  // Cheap to gather again, unlike the radiance
+  clearAuxiliary();
+#pragma omp parallel for schedule(static)
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      const size_t i = (size_t)y * width + x;
+      if (historySamples[i] > 0) {
+        reprojected[i] = 1;
+        continue;
+      }
+      const int nx[4] = {x - 1, x + 1, x, x};
+      const int ny[4] = {y, y, y - 1, y + 1};
+      size_t from = count;
+      for (int k = 0; k < 4; k++) {
+        if (nx[k] < 0 || nx[k] >= width || ny[k] < 0 || ny[k] >= height)
+          continue;
+        const size_t j = (size_t)ny[k] * width + nx[k];
+        if (historySamples[j] > 0 && (from == count || depth[j] < depth[from]))
+          from = j;
+      }
+      if (from == count)
+        continue;
+      raw[i * 3] = history[from * 3];
+      raw[i * 3 + 1] = history[from * 3 + 1];
+      raw[i * 3 + 2] = history[from * 3 + 2];
+      pixelSamples[i] = historySamples[from];
+      firstHits[i] = historyHits[from];
+      reprojected[i] = 1;
+    }
+  }
+  for (unsigned int &version : rowVersions)
+    version++;
+  return true;
+}
+
+void Scene::resetRegion(int x0, int y0, int x1, int y1) {
+  if (pixelSamples.size() != (size_t)width * height) {
+    resetAccumulation();
+    return;
+  }
+  for (int y = 0; y < height; y++) {
+    rowVersions[y]++;
+    for (int x = 0; x < width; x++) {
+      const int i = y * width + x;
+      double keep = 0;
+      if (x < x0 || x >= x1 || y < y0 || y >= y1) {
+        if (pixelSamples[i] <= (unsigned int)samples)
+          continue;
+        keep = (double)samples / pixelSamples[i];
+      }
+      raw[i * 3] *= keep;
+      raw[i * 3 + 1] *= keep;
+      raw[i * 3 + 2] *= keep;
+      pixelSamples[i] = keep > 0 ? samples : 0;
+      // The features outside are still right, whatever their weight
+      if (keep == 0 && (size_t)i < featureSamples.size()) {
+        std::fill_n(&featureSums[(size_t)i * FEATURE_CHANNELS],
+                    FEATURE_CHANNELS, 0.0f);
+        featureSamples[i] = 0;
+      }
+      if (keep == 0 && (size_t)i < aovSamples.size()) {
+        for (int pass = 0; pass < AOV_COUNT; pass++) {
+          const int channels = aovChannels((AovPass)pass);
+          if (!aovSums[pass].empty())
+            std::fill_n(&aovSums[pass][(size_t)i * channels], channels,
+                        pass == AOV_OBJECT_ID ? -1.0f : 0.0f);
+        }
+        aovSamples[i] = 0;
+      }
+    }
+  }
+}
+
+static const char CHECKPOINT_MAGIC[8] = {'J', 'T', 'C', 'K', 'P', 'T', '0',
+                                         '2'};
+
+// What has to match for a checkpoint to carry on a render: the image size,
+// the settings the samples depend on, and the number of objects as a check
+// that it is the same scene
+struct CheckpointHeader {
+  int32_t width, height;
+  int32_t samples, bounces;
+  uint32_t seed, passIndex;
+  uint64_t objects;
+  double shutterOpen, shutterClose;
+  int32_t filter, splat;
+  float filterRadius;
+  // Always 0, so no padding of the struct is left undefined in the file
+  int32_t reserved;
+};
+
+// The file is the magic and the header, then raw and the sample counts
+bool Scene::saveCheckpoint(const char *path) const {
+  const size_t count = (size_t)width * height;
+  if (pixelSamples.size() != count)
+    return false;
+  const std::string temporary = std::string(path) + ".tmp";
+  FILE *f = fopen(temporary.c_str(), "wb");
+  if (f == nullptr) {
+    printf("Unable to write checkpoint %s\n", temporary.c_str());
+    return false;
+  }
+
+  CheckpointHeader header{};
+  header.width = width;
+  header.height = height;
+  header.samples = samples;
+  header.bounces = bounces;
+  header.seed = seed;
+  header.passIndex = passIndex;
+  header.objects = hittables.objects.size();
+  header.shutterOpen = shutterOpen;
+  header.shutterClose = shutterClose;
+  header.filter = film.filter;
+  header.splat = film.splat;
+  header.filterRadius = film.radius;
+  bool ok = fwrite(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC), 1, f) == 1 &&
+            fwrite(&header, sizeof(header), 1, f) == 1 &&
+            fwrite(raw, sizeof(double), count * 3, f) == count * 3 &&
+            fwrite(pixelSamples.data(), sizeof(unsigned int), count, f) ==
+                count;
+  // On disk before it replaces the last one
+  ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+  ok = fclose(f) == 0 && ok;
+  ok = ok && rename(temporary.c_str(), path) == 0;
+  if (!ok) {
+    printf("Unable to write checkpoint %s\n", path);
+    remove(temporary.c_str());
+  }
+  return ok;
+}
+
+bool Scene::loadCheckpoint(const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (f == nullptr) {
+    printf("Unable to open checkpoint %s\n", path);
+    return false;
+  }
+
+  char magic[sizeof(CHECKPOINT_MAGIC)];
+  CheckpointHeader header;
+  bool ok = fread(magic, sizeof(magic), 1, f) == 1 &&
+            memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) == 0 &&
+            fread(&header, sizeof(header), 1, f) == 1;
+  const bool matches =
+      ok && header.width == width && header.height == height &&
+      header.samples == samples && header.bounces == bounces &&
+      header.seed == seed && header.objects == hittables.objects.size() &&
+      header.shutterOpen == shutterOpen &&
+      header.shutterClose == shutterClose && header.filter == film.filter &&
+      header.splat == film.splat && header.filterRadius == film.radius;
+  if (ok && !matches) {
+    printf("Checkpoint %s is of another render\n", path);
+    fclose(f);
+    return false;
+  }
+
+  // Read aside, so a truncated file changes nothing
+  const size_t count = (size_t)width * height;
+  std::vector<double> accumulated(ok ? count * 3 : 0);
+  std::vector<unsigned int> counts(ok ? count : 0);
+  ok = ok &&
+       fread(accumulated.data(), sizeof(double), count * 3, f) == count * 3 &&
+       fread(counts.data(), sizeof(unsigned int), count, f) == count;
+  fclose(f);
+  if (!ok) {
+    printf("%s is not a valid checkpoint\n", path);
+    return false;
+  }
+
+  std::copy(accumulated.begin(), accumulated.end(), raw);
+  pixelSamples.swap(counts);
+  passIndex = header.passIndex;
+  reprojected.assign(reprojected.size(), 0);
+  clearAuxiliary();
+  rowVersions.resize(height);
+  for (unsigned int &version : rowVersions)
+    version++;
+  return true;
+}
+
+bool Scene::screenBounds(const aabb &box, int &x0, int &y0, int &x1,
+                         int &y1) const {
+  // Out of focus objects spread further than their projection
+  if (camera.hasLens())
+    return false;
+  float minX = DBL_INF, minY = DBL_INF, maxX = -DBL_INF, maxY = -DBL_INF;
+  for (int corner = 0; corner < 8; corner++) {
+    const Point p(corner & 1 ? box.max.x : box.min.x,
+                  corner & 2 ? box.max.y : box.min.y,
+                  corner & 4 ? box.max.z : box.min.z);
+    float px, py;
+    if (!camera.project(p, px, py))
+      return false;
+    minX = std::fmin(minX, px);
+    minY = std::fmin(minY, py);
+    maxX = std::fmax(maxX, px);
+    maxY = std::fmax(maxY, py);
+  }
+  // A pixel of margin for the jitter and the pixels the edges cross, and as
+  // many more as the filter reaches past the pixel, which takes samples from
+  // up to its radius from the centre. Splats are given one more.
+  const int margin = 1 +
+                     (int)std::ceil(std::max(0.0f, film.radius - 0.5f)) +
+                     (film.splat ? 1 : 0);
+  x0 = std::max(0, (int)std::floor(minX) - margin);
+  y0 = std::max(0, (int)std::floor(minY) - margin);
+  x1 = std::min(width, (int)std::ceil(maxX) + margin);
+  y1 = std::min(height, (int)std::ceil(maxY) + margin);
+  return true;
 }
 
 void Scene::newCamera(PinholeCamera p) { camera = p; }
@@ -86,77 +662,209 @@ void Scene::newCamera(PinholeCamera p) { camera = p; }
 std::vector<Hittable *> Scene::getObjects() const { return hittables.objects; }
 
 void Scene::removeObject(unsigned int i) {
-  if (i < hittables.objects.size())
-    hittables.objects.erase(hittables.objects.begin() + i);
+  if (i >= hittables.objects.size())
+    return;
+  Hittable *o = hittables.objects[i];
+  hittables.objects.erase(hittables.objects.begin() + i);
+  media.erase(std::remove(media.begin(), media.end(), o), media.end());
+  if (bvhDirty)
+    return;
+
+  auto a = std::find(added.begin(), added.end(), o);
+  if (a != added.end()) {
+    added.erase(a);
+    addedChanged = true;
+  } else if (!bvh.remove(o)) {
+    bvhDirty = true;
+  }
 }
 
-Point Scene::Colour(Ray r, int limit) const {
-  hitRecord rec;
+void Scene::updateObject(Hittable *o) {
+  if (bvhDirty)
+    return;
+  if (std::find(added.begin(), added.end(), o) != added.end())
+    addedChanged = true;
+  else if (!bvh.update(o))
+    bvhDirty = true;
+}
 
-  // Checks all objects
-  if (limit > 0 && box->hit(r, rec, 0, DBL_INF)) {
-    Ray scattered;
-    Point attenuation; // colour value of the ray
-    Point emitted = rec.matPtr->emitted(
-        rec.u, rec.v, rec.p, rec, r); // emitted value of the rendering equation
-    double pdfValue;
-    Point albedo; // fractional reflectance value
-    if (!rec.matPtr->scatter(r, rec, albedo, scattered, pdfValue)) {
-      return emitted; // returns the emitted value if the object doesn't scatter
-    }
+void Scene::deleteScene() {
+  hittables.clear();
+  bvh.clear();
+  added.clear();
+  addedBVH.clear();
+  addedChanged = false;
+  bvhDirty = true;
+  media.clear();
+  lights = nullptr;
+  arena.release();
+  textureCache.clear();
+}
+
+void Scene::memoryReport() const {
+  arena.report("Scene arena");
+  textureCache.report("Texture cache");
+}
 
-    HittablePDF lightPDF(lights, rec.p);
-    CosineONB_PDF cosinePDF(rec.normal);
-    MixturePDF mixPDF(&cosinePDF, &lightPDF);
-    scattered = Ray(rec.p, mixPDF.generate());
-    pdfValue = mixPDF.value(scattered.direction);
+Point Scene::Colour(Ray r, int limit, Sampler &sampler,
+                    FirstHit *first) const {
+  return trace<false>(r, limit, sampler, first, nullptr);
+}
 
-    // scattered = Ray(rec.p, lightPDF.generate());
-    // pdfValue = lightPDF.value(scattered.direction);
+// Adds c, which reached the camera after bounces bounces, to its lighting AOV
+static inline void addLighting(Point *lighting, int bounces, const Point &c) {
+  Point &pass = lighting[bounces == 0   ? AOV_EMISSION
+                         : bounces == 1 ? AOV_DIRECT
+                                        : AOV_INDIRECT];
+  pass = pass + c;
+}
 
-    // scattered = Ray(rec.p, cosinePDF.generate());
-    // pdfValue = cosinePDF.value(scattered.direction);
+// Traces a path of up to limit bounces. Every bounce off a surface that is
+// not specular also samples the light directly; that sample and the emission
+// found by following the BSDF are combined with the power heuristic, so both
+// strategies can be used without counting the light twice. With Split,
+// every contribution is also added to the lighting AOV of its bounce in
+// lighting, indexed by AovPass; without it that bookkeeping is compiled out.
+template <bool Split>
+Point Scene::trace(Ray r, int limit, Sampler &sampler, FirstHit *first,
+                   Point *lighting) const {
+  if (Split)
+    for (int pass = AOV_DIRECT; pass <= AOV_EMISSION; pass++)
+      lighting[pass] = Point(0, 0, 0);
+  Point radiance(0, 0, 0);
+  Point throughput(1, 1, 1); // product of f / pdf along the path
 
-    // emission + fractional reflectance value * scattering PDF * colour of next
-    // rays / pdf
+  // The previous bounce, to weight emission found by BSDF sampling
+  bool lastSpecular = true;
+  double lastPdf = 0;
+  Point lastP;
 
-    // For matte objects the scattering pdf is cosine (things are most likely to
-    // scatter around the middle) the other pdf is the probability that we
-    // sample that direction (acts as scaling) In this case sampling pdf is the
-    // same as scattering pdf
+  r.sampler = &sampler;
+  for (int depth = 0;; depth++) {
+    hitRecord rec;
+    if (depth >= limit || !hitObjects(r, rec, 0, DBL_INF)) {
+      if (depth == 0 && first != nullptr) {
+        const Vec direction = unitVec(r.direction);
+        first->p = add(r.origin, point(scale(MISS_DISTANCE, direction)));
+        first->albedo = Point(std::fmin(background.x, 1.0),
+                              std::fmin(background.y, 1.0),
+                              std::fmin(background.z, 1.0));
+        first->normal = -direction;
+        first->depth = MISS_DISTANCE;
+        first->object = nullptr;
+      }
+      // the ray hit nothing
+      if (Split)
+        addLighting(lighting, depth, throughput * background);
+      return radiance + throughput * background;
+    }
+    if (depth == 0 && first != nullptr) {
+      first->p = rec.p;
+      first->albedo = Point(0, 0, 0);
+      first->normal = rec.normal;
+      first->depth = rec.t * length(r.direction);
+      first->object = rec.object;
+    }
 
-    // Point onLight =
-    // Point(randomNum(213.0, 343.0), 554, randomNum(-332.0, -227.0));
-    // Vec toLight = sub(onLight, rec.p).direction();
-    // float distanceSquared = length(toLight) * length(toLight);
-    // toLight = unitVec(toLight);
+    computeDifferentials(r, rec);
+    const Vec wo = -unitVec(r.direction);
+    Point emitted = rec.matPtr->emitted(
+        rec.u, rec.v, rec.p, rec, r); // emitted value of the rendering equation
+    if (!(emitted == Point(0, 0, 0))) {
+      double weight = 1;
+      // The light could also have been reached by sampling it directly
+      if (!lastSpecular && lights != nullptr) {
+        double lightPdf = lights->pdfValue(lastP, r.direction);
+        weight = powerHeuristic(lastPdf, lightPdf);
+      }
+      radiance = radiance + scale(weight, throughput * emitted);
+      if (Split)
+        addLighting(lighting, depth, scale(weight, throughput * emitted));
+    }
 
-    // // if the ray is going up, we can hit either the light or the top black
-    // box if (dotProduct(toLight, rec.normal) < 0)
-    //   return emitted;
+    BSDFSample bs;
+    const bool scattered = rec.matPtr->sample(rec, wo, sampler, bs) &&
+                           bs.pdf > 0;
+    if (depth == 0 && first != nullptr)
+      first->albedo =
+          scattered ? scale(1 / bs.pdf, bs.f)
+                    : Point(std::fmin(emitted.x, 1.0),
+                            std::fmin(emitted.y, 1.0),
+                            std::fmin(emitted.z, 1.0));
+    if (!scattered) {
+      return radiance; // absorbed, or the object doesn't scatter
+    }
+    const bool specular = (bs.flags & BSDF_SPECULAR) != 0;
 
-    // double lightArea = (343 - 213) * (332 - 227);
-    // float lightCosine = fabs(toLight.y);
-    // grazing edge
-    // if (lightCosine < 0.000001)
-    // return emitted;
+    // Sample the light directly. Specular lobes can't be evaluated for an
+    // arbitrary direction, so they only get the BSDF sample. On the last
+    // bounce the BSDF sample can't reach the light any more, so the light
+    // isn't sampled either (the MIS weights would not add up to one).
+    if (!specular && lights != nullptr && depth + 1 < limit) {
+      HittablePDF lightPDF(lights, rec.p);
+      const Vec toLight = lightPDF.generate(sampler);
+      const double lightPdf = lightPDF.value(toLight);
+      const Vec wi = unitVec(toLight);
+      const Point f = rec.matPtr->eval(rec, wo, wi);
+      hitRecord lightRec;
+      Ray shadow(rec.p, toLight);
+      shadow.sampler = &sampler;
+      shadow.time = r.time;
+      shadow.shadow = true;
+      // toLight ends on the light, so anything hit before t = 1 blocks it
+      if (lightPdf > 0 && !(f == Point(0, 0, 0)) &&
+          hitObjects(shadow, lightRec, 0, DBL_INF) &&
+          lightRec.t > 0.999) {
+        double transmitted = 1;
+        for (size_t i = 0; i < media.size() && transmitted > 0; i++)
+          transmitted *= media[i]->transmittance(shadow, 0.001, lightRec.t,
+                                                 sampler);
+        const Point le = lightRec.matPtr->emitted(lightRec.u, lightRec.v,
+                                                  lightRec.p, lightRec,
+                                                  shadow);
+        const double weight =
+            powerHeuristic(lightPdf, rec.matPtr->pdf(rec, wo, wi));
+        const Point direct =
+            scale(transmitted * weight / lightPdf, throughput * f * le);
+        radiance = radiance + direct;
+        // One bounce further than the surface it was gathered at
+        if (Split)
+          addLighting(lighting, depth + 1, direct);
+      }
+    }
 
-    // pdfValue = distanceSquared / (lightCosine * lightArea);
-    // scattered = Ray(rec.p, toLight);
+    throughput = throughput * scale(1 / bs.pdf, bs.f);
+    lastSpecular = specular;
+    lastPdf = bs.pdf;
+    lastP = rec.p;
+    Ray next(rec.p, bs.wi);
+    rec.matPtr->differentials(rec, wo, bs, r, next);
+    next.sampler = &sampler;
+    next.time = r.time;
+    r = next;
+  }
+}
 
-    return emitted +
-           scale(1 / pdfValue,
-                 scale(rec.matPtr->scatteringPDF(r, rec, scattered), albedo) *
-                     Colour(scattered, limit - 1));
-  } else // the ray hit nothing
-    return background;
+const Texture *Scene::bake(const Texture *texture, const aabb &region) {
+  Point c;
+  if (bakeResolution < 2 || texture->constant(c))
+    return texture;
+  return make<BakedTexture>(texture, region, bakeResolution);
 }
 
-void Scene::addObject(Hittable *o) { hittables.objects.push_back(o); }
+void Scene::addObject(Hittable *o) {
+  hittables.objects.push_back(o);
+  if (bvhDirty)
+    return;
+  added.push_back(o);
+  addedChanged = true;
+  if (o->participating())
+    media.push_back(o);
+}
 
-int Scene::getWidth() { return width; }
+int Scene::getWidth() const { return width; }
 
-int Scene::getHeight() { return height; }
+int Scene::getHeight() const { return height; }
 
 HittableList *Scene::getHittables() { return &hittables; }
 
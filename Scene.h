@@ -1,21 +1,55 @@
 #ifndef _SCENE_H
 #define _SCENE_H
 
-#include "./BVHNode.h"
+#include "./Arena.h"
+#include "./Aov.h"
+#include "./Film.h"
 #include "./Functions.h"
 #include "./Hittable.h"
 #include "./Light.h"
 #include "./Point.h"
+#include "./PrimitiveBVH.h"
 #include "./Ray.h"
 #include "./Sphere.h"
+#include "./TextureCache.h"
+#include "./Textures/Texture.h"
 #include "./Vec.h"
 #include "PinholeCamera.h"
+#include "Tonemap.h"
 
+#include <atomic>
 #include <math.h>
 #include <memory>
 #include <utility>
 #include <vector>
 
+// What a camera ray hit first, for reprojecting and denoising. Rays that hit
+// nothing get a point far along them and its distance as their depth, the
+// background as their albedo and a normal facing back along them.
+struct FirstHit {
+  Point p;
+  // How much of the light arriving there is sent on: the BSDF over its pdf
+  // for surfaces that scatter, the emission up to white for ones that don't
+  Point albedo;
+  Vec normal;
+  // Distance from the ray's origin
+  float depth;
+  // The object hit, null for none
+  const Hittable *object;
+};
+
+// The features summed per pixel in Scene::featureSums
+enum FeatureChannel {
+  FEATURE_ALBEDO = 0, // 3 channels
+  FEATURE_NORMAL = 3, // 3 channels
+  FEATURE_DEPTH = 6,
+  // The luminance of the radiance and its square, for the variance of the
+  // pixel's samples
+  FEATURE_LUMINANCE = 7,
+  FEATURE_LUMINANCE_SQUARED = 8,
+  FEATURE_CHANNELS = 9
+};
+
 class Scene {
 
 private:
@@ -26,18 +60,125 @@ private:
 
   unsigned char *pixels;
 
-  Hittable *lights;
-  
+  Hittable *lights = nullptr;
+
+  // The participating media among the objects, found by createBVHBox().
+  // Light sampled through them is scaled by their transmittance.
+  std::vector<Hittable *> media;
+
+  // Whether the BVH has to be built from scratch
+  bool bvhDirty = true;
+
+  // Objects added since the BVH was built. They get a small tree of their
+  // own until there are enough of them to be worth a rebuild.
+  std::vector<Hittable *> added;
+  PrimitiveBVH addedBVH;
+  bool addedChanged = false;
+
+  // The closest hit among the objects of both trees
+  bool hitObjects(const Ray &r, hitRecord &rec, double tMin,
+                  double tMax) const;
+
+  // The passes aovSums was last allocated for
+  unsigned int aovsAllocated = 0;
+
+  // film's filter, tabulated when render() first needs it
+  FilterTable filterTable;
+
+  // Where each thread splats with film.splat, kept between passes
+  std::vector<FilmTile> filmTiles;
+
+  // Colour(), also splitting the radiance into lighting[AOV_EMISSION],
+  // lighting[AOV_DIRECT] and lighting[AOV_INDIRECT] if Split is set. Without
+  // it the path carries none of that bookkeeping.
+  template <bool Split>
+  Point trace(Ray r, int limit, Sampler &sampler, FirstHit *first,
+              Point *lighting) const;
+
 public:
   PinholeCamera camera;
 
   double *raw;
 
+  // Samples accumulated in raw by each pixel, counted by render(). They can
+  // differ between pixels after resetRegion().
+  std::vector<unsigned int> pixelSamples;
+  // Bumped whenever a row of raw changes, so a display can tell which rows
+  // to show again
+  std::vector<unsigned int> rowVersions;
+  // Where each pixel's first camera ray of the last pass hit the scene, or a
+  // point far along it if it hit nothing. reproject() moves the accumulated
+  // samples with them.
+  std::vector<Point> firstHits;
+  // Set for pixels whose samples were reprojected from another view, until
+  // a pass checks that they still see the same surface
+  std::vector<unsigned char> reprojected;
+
+  // Sums over every sample of the first hit features, FEATURE_CHANNELS floats
+  // a pixel, while features is set. featureSamples counts them; it falls
+  // behind pixelSamples when features are turned on late, and drops to zero
+  // where the image is reprojected or cleared.
+  bool features = false;
+  std::vector<float> featureSums;
+  std::vector<unsigned int> featureSamples;
+
+  // The AOV passes rendered along with the image, an aovBit() each. Passes
+  // that are off cost nothing.
+  unsigned int aovs = 0;
+  // Sums over every sample of each pass that is on, aovChannels() floats a
+  // pixel, counted by aovSamples; object IDs are stored as they are. Like the
+  // features they start again where the image is reprojected or cleared,
+  // and all of them when the passes are changed.
+  std::vector<float> aovSums[AOV_COUNT];
+  std::vector<unsigned int> aovSamples;
+
   int samples = 12;
   int bounces = 4;
+
+  // How samples are filtered into pixels. The accumulated image has to be
+  // reset when it changes.
+  FilmSettings film;
+
+  // Render a single sample per pixel each pass, for quick passes while the
+  // view is moving. Its samples come from sequences of their own.
+  bool preview = false;
+
+  // Number of render() calls accumulated in raw. Together with the pixel it
+  // seeds each path's sampler, so a pass renders the same on any number of
+  // threads.
+  unsigned int passIndex = 0;
+  // Changes every sequence of random numbers used by the renderer
+  unsigned int seed = 0;
+
+  // Camera rays are sent at times spread over this interval, and the BVH is
+  // built for it. Nothing is blurred if it is empty.
+  double shutterOpen = 0;
+  double shutterClose = 0;
+
+  // Trace camera rays with differentials so textures are filtered over the
+  // pixel's footprint
+  bool rayDifferentials = true;
+  // Linear radiance of rays that hit nothing
   Point background;
 
-  BVHNode *box;
+  // How raw is developed into pixels for display and 8 bit images. Only
+  // read when a frame is developed, so changing it doesn't touch raw.
+  ToneSettings tone;
+
+  // Built from the objects by createBVHBox()
+  PrimitiveBVH bvh;
+
+  // Tiled mip chains of the scene's image textures. Declared before the arena
+  // so it outlives the textures that point to it.
+  TextureCache textureCache;
+
+  // Grid points along each side of the grids bake() samples procedural
+  // textures into, or 0 to shade them procedurally. Scenes read it while they
+  // are built, so it only changes objects added later.
+  int bakeResolution = 0;
+
+  // Owns every object, material, texture and BVH node of the scene
+  Arena arena;
 
   Scene();
 
@@ -47,7 +188,75 @@ public:
 
   void createBVHBox();
 
-  void render() const;
+  // Brings the BVH up to date with the objects, the edits made since it was
+  // built and the shutter. Objects that moved are refit into the tree,
+  // removed ones are taken out of their leaves and added ones go into a
+  // small second tree. The whole tree is rebuilt if that has made it much
+  // worse than a fresh build, or too many objects were added. Returns true if
+  // it was kept.
+  bool updateBVH();
+
+  // Adds one pass of samples per pixel to raw. Once interrupt is set, the
+  // rows not started yet are skipped; the rows finished are counted in
+  // rowsDone. Either can be null. With film.splat the rows only change in
+  // raw once every row of the pass is done, and an interrupted pass adds
+  // nothing to raw; the features and AOVs of the rows it did are kept, as
+  // they are per pixel and counted apart.
+  void render(const std::atomic<bool> *interrupt = nullptr,
+              std::atomic<int> *rowsDone = nullptr);
+
+  // Sizes aovSums and aovSamples for the passes in aovs, clearing them if
+  // the passes changed. render() does this itself.
+  void allocateAovs();
+
+  // Clears raw and every pixel's sample count
+  void resetAccumulation();
+
+  // Clears the features and AOV passes of every pixel, leaving raw as it is
+  void clearAuxiliary();
+
+  // Moves to the camera next, keeping what has been accumulated where it is
+  // still in view: every pixel's samples move to where its first hit is seen
+  // from next, the nearest one winning, and gaps of a pixel are filled from a
+  // neighbour. They are weighted as a few passes at most, so the new view
+  // soon outweighs them, and dropped by the next pass if it sees another
+  // surface there. Starts again from nothing if the camera can't project
+  // points. Returns false if it did.
+  bool reproject(const PinholeCamera &next);
+
+  // Clears the pixels in [x0, x1) x [y0, y1). What the rest of the image has
+  // accumulated is kept but weighted as a single pass, so anything an edit
+  // changed there fades out as new passes come in.
+  void resetRegion(int x0, int y0, int x1, int y1);
+
+  // Writes raw, the sample counts and everything the samples of later passes
+  // depend on to path. The file is written under another name and renamed
+  // over path once it is on disk, so a crash leaves the last checkpoint
+  // whole.
+  bool saveCheckpoint(const char *path) const;
+
+  // Continues from a checkpoint of the same scene and settings. Passes
+  // rendered from there give exactly the image the render would have given
+  // had it never stopped. Returns false, leaving the scene as it was, if the
+  // file can't be read or belongs to another render.
+  bool loadCheckpoint(const char *path);
+
+  // The pixels box covers, with the pixels whose filter reaches it, as
+  // [x0, x1) x [y0, y1). Returns false if that can't be told, e.g. if the
+  // box is behind the camera.
+  bool screenBounds(const aabb &box, int &x0, int &y0, int &x1,
+                    int &y1) const;
+
+  // Constructs an object, material or texture owned by the scene. It stays
+  // valid until deleteScene() is called.
+  template <class T, class... Args> T *make(Args &&...args) {
+    return arena.make<T>(std::forward<Args>(args)...);
+  }
+
+  // texture, or with bakeResolution set a BakedTexture of it over region,
+  // owned by the scene like make()'s. Textures that are constant are never
+  // baked.
+  const Texture *bake(const Texture *texture, const aabb &region);
 
   // Inserts a pointer to a hittable object into the list
   void addObject(Hittable *o);
@@ -60,17 +269,27 @@ public:
   // True if success
   void removeObject(unsigned int i);
 
+  // Tells the scene an object was moved, resized or given another material
+  // in place
+  void updateObject(Hittable *o);
+
+  // Removes every object and frees everything created with make()
   void deleteScene();
 
+  // Prints how much the scene has allocated
+  void memoryReport() const;
+
   // Sphere stuff
 
-  Point Colour(Ray r, int limit) const;
+  // The radiance along r. first, if not null, is set to what r hits first.
+  Point Colour(Ray r, int limit, Sampler &sampler,
+               FirstHit *first = nullptr) const;
 
   std::vector<Hittable *> getObjects() const;
 
-  int getWidth();
+  int getWidth() const;
 
-  int getHeight();
+  int getHeight() const;
 
   HittableList *getHittables();
 
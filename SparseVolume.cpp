@@ -0,0 +1,361 @@
+#include "SparseVolume.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+// Written at the start of every .jtvol file
+static const char VOLUME_MAGIC[8] = {'J', 'T', 'V', 'O', 'L', '0', '1', '\n'};
+
+SparseVolume::SparseVolume(const Point &origin, float voxelSize)
+    : origin(origin), voxelSize(voxelSize) {}
+
+static int localIndex(int x, int y, int z) {
+  const int m = VOXEL_LEAF_SIZE - 1;
+  return (((z & m) << VOXEL_LEAF_LOG2) + (y & m)) << VOXEL_LEAF_LOG2 | (x & m);
+}
+
+uint64_t SparseVolume::nodeKey(int x, int y, int z) {
+  const int shift = VOXEL_LEAF_LOG2 + VOXEL_NODE_LOG2;
+  const uint64_t m = (1 << 21) - 1;
+  return ((uint64_t)(x >> shift) & m) | (((uint64_t)(y >> shift) & m) << 21) |
+         (((uint64_t)(z >> shift) & m) << 42);
+}
+
+static int childIndex(int x, int y, int z) {
+  const int m = VOXEL_NODE_SIZE - 1;
+  return ((((z >> VOXEL_LEAF_LOG2) & m) << VOXEL_NODE_LOG2) +
+          ((y >> VOXEL_LEAF_LOG2) & m))
+             << VOXEL_NODE_LOG2 |
+         ((x >> VOXEL_LEAF_LOG2) & m);
+}
+
+// Whether voxel index i can be given to nodeKey()
+static bool inIndexRange(int64_t i) {
+  return i >= -(int64_t)VOXEL_INDEX_LIMIT && i < VOXEL_INDEX_LIMIT;
+}
+
+const VoxelLeaf *SparseVolume::findLeaf(int x, int y, int z) const {
+  // Anything further out would alias a node in range
+  if (!inIndexRange(x) || !inIndexRange(y) || !inIndexRange(z))
+    return nullptr;
+  const auto node = root.find(nodeKey(x, y, z));
+  if (node == root.end())
+    return nullptr;
+  const int32_t leaf = nodes[node->second].children[childIndex(x, y, z)];
+  return leaf < 0 ? nullptr : &leaves[leaf];
+}
+
+VoxelLeaf &SparseVolume::touchLeaf(int x, int y, int z) {
+  auto node = root.find(nodeKey(x, y, z));
+  if (node == root.end()) {
+    node = root.insert(std::make_pair(nodeKey(x, y, z), (int32_t)nodes.size()))
+               .first;
+    nodes.push_back(Node());
+    std::fill(nodes.back().children,
+              nodes.back().children + VOXEL_NODE_SIZE * VOXEL_NODE_SIZE *
+                                          VOXEL_NODE_SIZE,
+              -1);
+  }
+
+  int32_t &child = nodes[node->second].children[childIndex(x, y, z)];
+  if (child < 0) {
+    child = leaves.size();
+    leaves.push_back(VoxelLeaf());
+    VoxelLeaf &leaf = leaves.back();
+    leaf.origin[0] = x & ~(VOXEL_LEAF_SIZE - 1);
+    leaf.origin[1] = y & ~(VOXEL_LEAF_SIZE - 1);
+    leaf.origin[2] = z & ~(VOXEL_LEAF_SIZE - 1);
+    std::fill(leaf.mask, leaf.mask + VOXEL_LEAF_VOXELS / 64, 0);
+    std::fill(leaf.values, leaf.values + VOXEL_LEAF_VOXELS, 0.0f);
+    leaf.maximum = 0;
+  }
+  return leaves[child];
+}
+
+void SparseVolume::clear() {
+  root.clear();
+  nodes.clear();
+  leaves.clear();
+  box = aabb();
+}
+
+bool SparseVolume::fromDense(const float *values, int nx, int ny, int nz,
+                             float threshold) {
+  clear();
+  if (nx > VOXEL_INDEX_LIMIT || ny > VOXEL_INDEX_LIMIT ||
+      nz > VOXEL_INDEX_LIMIT) {
+    printf("Grid of %dx%dx%d is too large for a volume\n", nx, ny, nz);
+    finish();
+    return false;
+  }
+  for (int z = 0; z < nz; z++) {
+    for (int y = 0; y < ny; y++) {
+      for (int x = 0; x < nx; x++) {
+        const float v = values[((size_t)z * ny + y) * nx + x];
+        if (!(v > threshold))
+          continue;
+        VoxelLeaf &leaf = touchLeaf(x, y, z);
+        const int i = localIndex(x, y, z);
+        leaf.values[i] = v;
+        leaf.mask[i / 64] |= (uint64_t)1 << (i % 64);
+      }
+    }
+  }
+  finish();
+  return true;
+}
+
+void SparseVolume::finish() {
+  if (leaves.empty()) {
+    box = aabb(origin, origin);
+    return;
+  }
+
+  int32_t low[3] = {INT32_MAX, INT32_MAX, INT32_MAX};
+  int32_t high[3] = {INT32_MIN, INT32_MIN, INT32_MIN};
+  for (VoxelLeaf &leaf : leaves) {
+    leaf.maximum = *std::max_element(leaf.values,
+                                     leaf.values + VOXEL_LEAF_VOXELS);
+    for (int axis = 0; axis < 3; axis++) {
+      low[axis] = std::min(low[axis], leaf.origin[axis]);
+      high[axis] = std::max(high[axis], leaf.origin[axis]);
+    }
+  }
+
+  // The last voxel of a leaf still blends with the next one (zero) up to a
+  // voxel further on
+  box = aabb(Point(origin.x + low[0] * voxelSize,
+                   origin.y + low[1] * voxelSize,
+                   origin.z + low[2] * voxelSize),
+             Point(origin.x + (high[0] + VOXEL_LEAF_SIZE) * voxelSize,
+                   origin.y + (high[1] + VOXEL_LEAF_SIZE) * voxelSize,
+                   origin.z + (high[2] + VOXEL_LEAF_SIZE) * voxelSize));
+}
+
+float SparseVolume::value(int x, int y, int z) const {
+  const VoxelLeaf *leaf = findLeaf(x, y, z);
+  return leaf == nullptr ? 0 : leaf->values[localIndex(x, y, z)];
+}
+
+float SparseVolume::Accessor::value(int x, int y, int z) {
+  const int32_t k[3] = {x >> VOXEL_LEAF_LOG2, y >> VOXEL_LEAF_LOG2,
+                        z >> VOXEL_LEAF_LOG2};
+  if (k[0] != key[0] || k[1] != key[1] || k[2] != key[2]) {
+    key[0] = k[0];
+    key[1] = k[1];
+    key[2] = k[2];
+    leaf = volume.findLeaf(x, y, z);
+  }
+  return leaf == nullptr ? 0 : leaf->values[localIndex(x, y, z)];
+}
+
+float SparseVolume::density(const Point &p) const {
+  if (!(p.x >= box.min.x && p.y >= box.min.y && p.z >= box.min.z &&
+        p.x < box.max.x && p.y < box.max.y && p.z < box.max.z))
+    return 0;
+
+  const float gx = (p.x - origin.x) / voxelSize;
+  const float gy = (p.y - origin.y) / voxelSize;
+  const float gz = (p.z - origin.z) / voxelSize;
+  const int x = (int)std::floor(gx);
+  const int y = (int)std::floor(gy);
+  const int z = (int)std::floor(gz);
+  const float fx = gx - x;
+  const float fy = gy - y;
+  const float fz = gz - z;
+
+  float v000, v100, v010, v110, v001, v101, v011, v111;
+  const int m = VOXEL_LEAF_SIZE - 1;
+  if ((x & m) != m && (y & m) != m && (z & m) != m) {
+    // All eight corners are in one leaf
+    const VoxelLeaf *leaf = findLeaf(x, y, z);
+    if (leaf == nullptr)
+      return 0;
+    const float *v = leaf->values + localIndex(x, y, z);
+    const int dy = VOXEL_LEAF_SIZE;
+    const int dz = VOXEL_LEAF_SIZE * VOXEL_LEAF_SIZE;
+    v000 = v[0];
+    v100 = v[1];
+    v010 = v[dy];
+    v110 = v[dy + 1];
+    v001 = v[dz];
+    v101 = v[dz + 1];
+    v011 = v[dz + dy];
+    v111 = v[dz + dy + 1];
+  } else {
+    Accessor acc(*this);
+    v000 = acc.value(x, y, z);
+    v100 = acc.value(x + 1, y, z);
+    v010 = acc.value(x, y + 1, z);
+    v110 = acc.value(x + 1, y + 1, z);
+    v001 = acc.value(x, y, z + 1);
+    v101 = acc.value(x + 1, y, z + 1);
+    v011 = acc.value(x, y + 1, z + 1);
+    v111 = acc.value(x + 1, y + 1, z + 1);
+  }
+
+  const float x00 = v000 + fx * (v100 - v000);
+  const float x10 = v010 + fx * (v110 - v010);
+  const float x01 = v001 + fx * (v101 - v001);
+  const float x11 = v011 + fx * (v111 - v011);
+  const float y0 = x00 + fy * (x10 - x00);
+  const float y1 = x01 + fy * (x11 - x01);
+  return y0 + fz * (y1 - y0);
+}
+
+float SparseVolume::maxDensity(const aabb &region) const {
+  // Voxels that can blend into a point of the region, as a range of leaves
+  int32_t low[3], high[3];
+  const float regionLow[3] = {region.min.x, region.min.y, region.min.z};
+  const float regionHigh[3] = {region.max.x, region.max.y, region.max.z};
+  const float start[3] = {origin.x, origin.y, origin.z};
+  // Held to the voxels there can be, so huge regions don't overflow
+  const auto index = [](float g) {
+    return (int32_t)std::min(std::max(std::floor(g), -(float)VOXEL_INDEX_LIMIT),
+                             (float)VOXEL_INDEX_LIMIT);
+  };
+  for (int axis = 0; axis < 3; axis++) {
+    low[axis] =
+        index((regionLow[axis] - start[axis]) / voxelSize) >> VOXEL_LEAF_LOG2;
+    high[axis] = (index((regionHigh[axis] - start[axis]) / voxelSize) + 1) >>
+                 VOXEL_LEAF_LOG2;
+  }
+
+  float highest = 0;
+  const size_t slots = (size_t)(high[0] - low[0] + 1) *
+                       (high[1] - low[1] + 1) * (high[2] - low[2] + 1);
+  if (slots > leaves.size()) {
+    // Fewer leaves than places to look for them
+    for (const VoxelLeaf &leaf : leaves) {
+      bool inside = true;
+      for (int axis = 0; axis < 3; axis++) {
+        const int32_t k = leaf.origin[axis] >> VOXEL_LEAF_LOG2;
+        inside = inside && k >= low[axis] && k <= high[axis];
+      }
+      if (inside)
+        highest = std::max(highest, leaf.maximum);
+    }
+    return highest;
+  }
+
+  for (int32_t z = low[2]; z <= high[2]; z++)
+    for (int32_t y = low[1]; y <= high[1]; y++)
+      for (int32_t x = low[0]; x <= high[0]; x++) {
+        const VoxelLeaf *leaf =
+            findLeaf(x << VOXEL_LEAF_LOG2, y << VOXEL_LEAF_LOG2,
+                     z << VOXEL_LEAF_LOG2);
+        if (leaf != nullptr)
+          highest = std::max(highest, leaf->maximum);
+      }
+  return highest;
+}
+
+static int popcount(uint64_t bits) { return __builtin_popcountll(bits); }
+
+size_t SparseVolume::activeVoxels() const {
+  size_t count = 0;
+  for (const VoxelLeaf &leaf : leaves)
+    for (int i = 0; i < VOXEL_LEAF_VOXELS / 64; i++)
+      count += popcount(leaf.mask[i]);
+  return count;
+}
+
+size_t SparseVolume::bytes() const {
+  return leaves.capacity() * sizeof(VoxelLeaf) +
+         nodes.capacity() * sizeof(Node) +
+         root.size() * (sizeof(uint64_t) + sizeof(int32_t) + sizeof(void *));
+}
+
+// The file is the magic, the origin and voxel size as floats and the number
+// of leaves, then for each leaf its origin, its mask and only the values of
+// its active voxels
+bool SparseVolume::save(const char *path) const {
+  FILE *f = fopen(path, "wb");
+  if (f == nullptr) {
+    printf("Unable to write volume %s\n", path);
+    return false;
+  }
+
+  const float header[4] = {origin.x, origin.y, origin.z, voxelSize};
+  const uint64_t count = leaves.size();
+  bool ok = fwrite(VOLUME_MAGIC, sizeof(VOLUME_MAGIC), 1, f) == 1 &&
+            fwrite(header, sizeof(header), 1, f) == 1 &&
+            fwrite(&count, sizeof(count), 1, f) == 1;
+
+  float active[VOXEL_LEAF_VOXELS];
+  for (size_t l = 0; ok && l < leaves.size(); l++) {
+    const VoxelLeaf &leaf = leaves[l];
+    int n = 0;
+    for (int i = 0; i < VOXEL_LEAF_VOXELS; i++)
+      if (leaf.mask[i / 64] >> (i % 64) & 1)
+        active[n++] = leaf.values[i];
+    ok = fwrite(leaf.origin, sizeof(leaf.origin), 1, f) == 1 &&
+         fwrite(leaf.mask, sizeof(leaf.mask), 1, f) == 1 &&
+         (n == 0 || fwrite(active, sizeof(float), n, f) == (size_t)n);
+  }
+
+  if (fclose(f) != 0 || !ok) {
+    printf("Unable to write volume %s\n", path);
+    return false;
+  }
+  return true;
+}
+
+bool SparseVolume::load(const char *path) {
+  clear();
+  FILE *f = fopen(path, "rb");
+  if (f == nullptr) {
+    printf("Unable to open volume %s\n", path);
+    return false;
+  }
+
+  char magic[sizeof(VOLUME_MAGIC)];
+  float header[4];
+  uint64_t count = 0;
+  bool ok = fread(magic, sizeof(magic), 1, f) == 1 &&
+            memcmp(magic, VOLUME_MAGIC, sizeof(magic)) == 0 &&
+            fread(header, sizeof(header), 1, f) == 1 &&
+            fread(&count, sizeof(count), 1, f) == 1 && header[3] > 0;
+  if (ok) {
+    origin = Point(header[0], header[1], header[2]);
+    voxelSize = header[3];
+  }
+
+  float active[VOXEL_LEAF_VOXELS];
+  for (uint64_t l = 0; ok && l < count; l++) {
+    int32_t leafOrigin[3];
+    uint64_t mask[VOXEL_LEAF_VOXELS / 64];
+    ok = fread(leafOrigin, sizeof(leafOrigin), 1, f) == 1 &&
+         fread(mask, sizeof(mask), 1, f) == 1;
+    for (int axis = 0; ok && axis < 3; axis++)
+      ok = leafOrigin[axis] % VOXEL_LEAF_SIZE == 0 &&
+           inIndexRange(leafOrigin[axis]);
+    if (!ok)
+      break;
+
+    int n = 0;
+    for (int i = 0; i < VOXEL_LEAF_VOXELS / 64; i++)
+      n += popcount(mask[i]);
+    ok = n == 0 || fread(active, sizeof(float), n, f) == (size_t)n;
+    if (!ok)
+      break;
+
+    VoxelLeaf &leaf = touchLeaf(leafOrigin[0], leafOrigin[1], leafOrigin[2]);
+    std::copy(mask, mask + VOXEL_LEAF_VOXELS / 64, leaf.mask);
+    n = 0;
+    for (int i = 0; i < VOXEL_LEAF_VOXELS; i++)
+      if (mask[i / 64] >> (i % 64) & 1)
+        leaf.values[i] = active[n++];
+  }
+  fclose(f);
+
+  if (!ok) {
+    printf("%s is not a valid volume\n", path);
+    clear();
+    return false;
+  }
+  finish();
+  return true;
+}
@@ -0,0 +1,119 @@
+#ifndef _SPARSE_VOLUME_H
+#define _SPARSE_VOLUME_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "DensityField.h"
+#include "Point.h"
+#include "aabb.h"
+
+// Voxels along each side of a leaf, and leaves along each side of a node
+static const int VOXEL_LEAF_LOG2 = 3;
+static const int VOXEL_NODE_LOG2 = 4;
+static const int VOXEL_LEAF_SIZE = 1 << VOXEL_LEAF_LOG2;
+static const int VOXEL_NODE_SIZE = 1 << VOXEL_NODE_LOG2;
+static const int VOXEL_LEAF_VOXELS =
+    VOXEL_LEAF_SIZE * VOXEL_LEAF_SIZE * VOXEL_LEAF_SIZE;
+
+// Voxel indices have to be in [-VOXEL_INDEX_LIMIT, VOXEL_INDEX_LIMIT), so
+// that a node's index along each axis fits the 21 bits it has in its key
+static const int32_t VOXEL_INDEX_LIMIT =
+    1 << (20 + VOXEL_LEAF_LOG2 + VOXEL_NODE_LOG2);
+
+// An 8x8x8 block of voxels, x varying fastest. Inactive voxels hold 0.
+struct VoxelLeaf {
+  // Index of the first voxel
+  int32_t origin[3];
+  // Which voxels are active, one bit each
+  uint64_t mask[VOXEL_LEAF_VOXELS / 64];
+  // The largest value in the leaf
+  float maximum;
+  float values[VOXEL_LEAF_VOXELS];
+};
+
+// A read-only sparse grid of densities, in the spirit of NanoVDB. Voxels are
+// grouped into 8^3 leaves, leaves into 16^3 nodes, and nodes are found through
+// a hash table, so memory grows with the number of active voxels rather than
+// with the extent of the grid. Voxel (i, j, k) sits at origin + voxelSize *
+// (i, j, k) and densities in between are trilinear.
+class SparseVolume : public DensityField {
+public:
+  SparseVolume(const Point &origin = Point(0, 0, 0), float voxelSize = 1);
+
+  // Converts a dense grid of nx * ny * nz values (x varying fastest). Only
+  // the values above threshold are kept. Returns false, leaving the volume
+  // empty, if the grid is more than VOXEL_INDEX_LIMIT along a side.
+  bool fromDense(const float *values, int nx, int ny, int nz,
+                 float threshold = 0);
+
+  // Reads or writes the volume as a .jtvol file. They print a message and
+  // return false if it fails. Leaves that aren't aligned to the leaf size or
+  // are outside VOXEL_INDEX_LIMIT make a file invalid.
+  bool load(const char *path);
+
+  bool save(const char *path) const;
+
+  // The value of a voxel, 0 if it is not active
+  float value(int x, int y, int z) const;
+
+  float density(const Point &p) const override;
+
+  // Uses each leaf's maximum, so it is quick but may be above the true value
+  float maxDensity(const aabb &region) const override;
+
+  aabb bounds() const override { return box; }
+
+  size_t leafCount() const { return leaves.size(); }
+
+  size_t activeVoxels() const;
+
+  // Bytes held by the tree
+  size_t bytes() const;
+
+private:
+  struct Node {
+    // Index of each leaf in leaves, or -1
+    int32_t children[VOXEL_NODE_SIZE * VOXEL_NODE_SIZE * VOXEL_NODE_SIZE];
+  };
+
+  // Remembers the last leaf it looked at. Neighbouring lookups (the eight
+  // corners of a trilinear lookup) usually fall in the same leaf and skip the
+  // walk down the tree.
+  class Accessor {
+  public:
+    Accessor(const SparseVolume &volume) : volume(volume) {}
+
+    float value(int x, int y, int z);
+
+  private:
+    const SparseVolume &volume;
+    int32_t key[3] = {INT32_MIN, INT32_MIN, INT32_MIN};
+    const VoxelLeaf *leaf = nullptr;
+  };
+
+  static uint64_t nodeKey(int x, int y, int z);
+
+  const VoxelLeaf *findLeaf(int x, int y, int z) const;
+
+  // The leaf holding voxel (x, y, z), added if there isn't one
+  VoxelLeaf &touchLeaf(int x, int y, int z);
+
+  // Recomputes each leaf's maximum and the bounds
+  void finish();
+
+  void clear();
+
+  Point origin;
+  float voxelSize;
+  aabb box;
+  // Nodes by position. Kept sparse, as nodes far apart would make a dense
+  // table over their bounds as big as the space between them.
+  std::unordered_map<uint64_t, int32_t> root;
+  std::vector<Node> nodes;
+  std::vector<VoxelLeaf> leaves;
+};
+
+#endif
@@ -36,31 +36,42 @@ bool Sphere::hit(const Ray &r, hitRecord &rec, double tMin, double tMax) const {
     time = ((-sqrt(discriminant)) - b) / a;
     if (tMax > time && time > 0.001) {
       intercept = true;
-      rec.t = time;
+      fillRecord(r, time, rec);
       tMax = rec.t;
-      rec.normal =
-          unitVec(sub(add(r.origin.direction(), scale(rec.t, r.direction)),
-                      location.direction()));
-      rec.p = add(r.origin, point(scale(rec.t, r.direction)));
-      getUV(rec.normal, rec.u, rec.v);
-      rec.matPtr = material;
     }
     time = (sqrt(discriminant) - b) / a;
     if (tMax > time && time > 0.001) {
       intercept = true;
-      rec.t = time;
+      fillRecord(r, time, rec);
       tMax = rec.t;
-      rec.normal =
-          unitVec(sub(add(r.origin.direction(), scale(rec.t, r.direction)),
-                      location.direction()));
-      rec.p = add(r.origin, point(scale(rec.t, r.direction)));
-      getUV(rec.normal, rec.u, rec.v);
-      rec.matPtr = material;
     }
   }
   return intercept;
 }
 
+void Sphere::fillRecord(const Ray &r, float t, hitRecord &rec) const {
+  rec.t = t;
+  rec.normal = unitVec(sub(add(r.origin.direction(), scale(rec.t, r.direction)),
+                           location.direction()));
+  rec.p = add(r.origin, point(scale(rec.t, r.direction)));
+  getUV(rec.normal, rec.u, rec.v);
+  rec.matPtr = material;
+
+  // Derivatives of the getUV() mapping, in terms of the hit point relative to
+  // the centre. u goes once around the y axis, v from the bottom to the top.
+  const Vec local = scale(rad, rec.normal);
+  const float ring = std::sqrt(local.x * local.x + local.z * local.z);
+  rec.dpdu = Vec(2 * PI * local.z, 0, -2 * PI * local.x);
+  if (ring > 0)
+    rec.dpdv = Vec(-PI * local.y * local.x / ring, PI * ring,
+                   -PI * local.y * local.z / ring);
+  else
+    rec.dpdv = Vec(PI * rad, 0, 0);
+  // The normal is the point over the radius
+  rec.dndu = scale(1.0 / rad, rec.dpdu);
+  rec.dndv = scale(1.0 / rad, rec.dpdv);
+}
+
 void Sphere::getUV(const Vec &p, double &u, double &v) {
 
   // taken from raytracing book
@@ -22,6 +22,9 @@ public:
   bool hit(const Ray &r, hitRecord &rec, double tMin,
            double tMax) const override;
 
+  // Fills in rec for a hit at time t along r
+  void fillRecord(const Ray &r, float t, hitRecord &rec) const;
+
 private:
   // gets the uv coordinates on a sphere given normal vector p on the unit
   // sphere. u and v are normalized to [0,1]. Given x and z = 0, u will be 0.5.
@@ -0,0 +1,226 @@
+#include "SphereKernel.h"
+
+#include <cmath>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+void SphereSoA::pack(const std::vector<Sphere> &spheres) {
+  count = spheres.size();
+  const size_t padded = count + SPHERE_KERNEL_WIDTH;
+  cx.assign(padded, 0);
+  cy.assign(padded, 0);
+  cz.assign(padded, 0);
+  radius2.assign(padded, 0);
+  for (size_t i = 0; i < count; i++)
+    set(i, spheres[i]);
+}
+
+void SphereSoA::set(size_t i, const Sphere &sphere) {
+  cx[i] = sphere.location.x;
+  cy[i] = sphere.location.y;
+  cz[i] = sphere.location.z;
+  radius2[i] = (float)sphere.rad * sphere.rad;
+}
+
+void SphereSoA::clear() {
+  cx.clear();
+  cy.clear();
+  cz.clear();
+  radius2.clear();
+  count = 0;
+}
+
+#if defined(__AVX512F__)
+
+int hitSpheres(const SphereSoA &soa, int start, int count, const Ray &r,
+               double tMax, float &tHit) {
+  const __m512 ox = _mm512_set1_ps(r.origin.x);
+  const __m512 oy = _mm512_set1_ps(r.origin.y);
+  const __m512 oz = _mm512_set1_ps(r.origin.z);
+  const __m512 dx = _mm512_set1_ps(r.direction.x);
+  const __m512 dy = _mm512_set1_ps(r.direction.y);
+  const __m512 dz = _mm512_set1_ps(r.direction.z);
+  // Same for every sphere, so only computed once
+  const __m512 a = _mm512_set1_ps(r.direction.x * r.direction.x +
+                                  r.direction.y * r.direction.y +
+                                  r.direction.z * r.direction.z);
+  const __m512 minTime = _mm512_set1_ps(0.001f);
+  const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+                                          11, 12, 13, 14, 15);
+
+  __m512 best = _mm512_set1_ps((float)tMax);
+  __m512i bestIdx = _mm512_set1_epi32(-1);
+
+  for (int i = 0; i < count; i += 16) {
+    const int idx = start + i;
+    const __mmask16 active =
+        count - i >= 16 ? 0xFFFF : (__mmask16)((1u << (count - i)) - 1);
+
+    // v = origin - centre
+    const __m512 vx = _mm512_sub_ps(ox, _mm512_loadu_ps(&soa.cx[idx]));
+    const __m512 vy = _mm512_sub_ps(oy, _mm512_loadu_ps(&soa.cy[idx]));
+    const __m512 vz = _mm512_sub_ps(oz, _mm512_loadu_ps(&soa.cz[idx]));
+    const __m512 b = _mm512_fmadd_ps(
+        dx, vx, _mm512_fmadd_ps(dy, vy, _mm512_mul_ps(dz, vz)));
+    const __m512 c = _mm512_sub_ps(
+        _mm512_fmadd_ps(vx, vx, _mm512_fmadd_ps(vy, vy, _mm512_mul_ps(vz, vz))),
+        _mm512_loadu_ps(&soa.radius2[idx]));
+    const __m512 disc = _mm512_fmsub_ps(b, b, _mm512_mul_ps(a, c));
+    const __mmask16 hit = _mm512_mask_cmp_ps_mask(active, disc,
+                                                  _mm512_setzero_ps(), _CMP_GT_OQ);
+    if (!hit)
+      continue;
+
+    const __m512 root = _mm512_sqrt_ps(disc);
+    const __m512 negB = _mm512_sub_ps(_mm512_setzero_ps(), b);
+    const __m512 t0 = _mm512_div_ps(_mm512_sub_ps(negB, root), a);
+    const __m512 t1 = _mm512_div_ps(_mm512_add_ps(negB, root), a);
+
+    // Nearer root first, the far one if the near one is behind the ray
+    const __mmask16 ok0 =
+        _mm512_mask_cmp_ps_mask(hit, t0, minTime, _CMP_GT_OQ) &
+        _mm512_cmp_ps_mask(t0, best, _CMP_LT_OQ);
+    const __mmask16 ok1 =
+        _mm512_mask_cmp_ps_mask(hit, t1, minTime, _CMP_GT_OQ) &
+        _mm512_cmp_ps_mask(t1, best, _CMP_LT_OQ);
+    const __m512 t = _mm512_mask_blend_ps(ok0, t1, t0);
+    const __mmask16 ok = ok0 | ok1;
+
+    best = _mm512_mask_blend_ps(ok, best, t);
+    bestIdx = _mm512_mask_blend_epi32(
+        ok, bestIdx, _mm512_add_epi32(lanes, _mm512_set1_epi32(idx)));
+  }
+
+  alignas(64) float times[16];
+  alignas(64) int indices[16];
+  _mm512_store_ps(times, best);
+  _mm512_store_si512((__m512i *)indices, bestIdx);
+
+  int nearest = -1;
+  for (int lane = 0; lane < 16; lane++) {
+    if (indices[lane] >= 0 && (nearest < 0 || times[lane] < tHit)) {
+      nearest = indices[lane];
+      tHit = times[lane];
+    }
+  }
+  return nearest;
+}
+
+#elif defined(__AVX2__)
+
+int hitSpheres(const SphereSoA &soa, int start, int count, const Ray &r,
+               double tMax, float &tHit) {
+  const __m256 ox = _mm256_set1_ps(r.origin.x);
+  const __m256 oy = _mm256_set1_ps(r.origin.y);
+  const __m256 oz = _mm256_set1_ps(r.origin.z);
+  const __m256 dx = _mm256_set1_ps(r.direction.x);
+  const __m256 dy = _mm256_set1_ps(r.direction.y);
+  const __m256 dz = _mm256_set1_ps(r.direction.z);
+  // Same for every sphere, so only computed once
+  const __m256 a = _mm256_set1_ps(r.direction.x * r.direction.x +
+                                  r.direction.y * r.direction.y +
+                                  r.direction.z * r.direction.z);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 minTime = _mm256_set1_ps(0.001f);
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+  __m256 best = _mm256_set1_ps((float)tMax);
+  __m256i bestIdx = _mm256_set1_epi32(-1);
+
+  for (int i = 0; i < count; i += 8) {
+    const int idx = start + i;
+    // Lanes past the end of the range belong to other leaves
+    const __m256 active = _mm256_castsi256_ps(
+        _mm256_cmpgt_epi32(_mm256_set1_epi32(count - i), lanes));
+
+    // v = origin - centre
+    const __m256 vx = _mm256_sub_ps(ox, _mm256_loadu_ps(&soa.cx[idx]));
+    const __m256 vy = _mm256_sub_ps(oy, _mm256_loadu_ps(&soa.cy[idx]));
+    const __m256 vz = _mm256_sub_ps(oz, _mm256_loadu_ps(&soa.cz[idx]));
+    const __m256 b = _mm256_add_ps(
+        _mm256_mul_ps(dx, vx),
+        _mm256_add_ps(_mm256_mul_ps(dy, vy), _mm256_mul_ps(dz, vz)));
+    const __m256 c = _mm256_sub_ps(
+        _mm256_add_ps(_mm256_mul_ps(vx, vx),
+                      _mm256_add_ps(_mm256_mul_ps(vy, vy),
+                                    _mm256_mul_ps(vz, vz))),
+        _mm256_loadu_ps(&soa.radius2[idx]));
+    const __m256 disc = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(a, c));
+    const __m256 hit =
+        _mm256_and_ps(active, _mm256_cmp_ps(disc, zero, _CMP_GT_OQ));
+    if (_mm256_movemask_ps(hit) == 0)
+      continue;
+
+    const __m256 root = _mm256_sqrt_ps(_mm256_max_ps(disc, zero));
+    const __m256 negB = _mm256_sub_ps(zero, b);
+    const __m256 t0 = _mm256_div_ps(_mm256_sub_ps(negB, root), a);
+    const __m256 t1 = _mm256_div_ps(_mm256_add_ps(negB, root), a);
+
+    // Nearer root first, the far one if the near one is behind the ray
+    const __m256 ok0 = _mm256_and_ps(
+        hit, _mm256_and_ps(_mm256_cmp_ps(t0, minTime, _CMP_GT_OQ),
+                           _mm256_cmp_ps(t0, best, _CMP_LT_OQ)));
+    const __m256 ok1 = _mm256_and_ps(
+        hit, _mm256_and_ps(_mm256_cmp_ps(t1, minTime, _CMP_GT_OQ),
+                           _mm256_cmp_ps(t1, best, _CMP_LT_OQ)));
+    const __m256 t = _mm256_blendv_ps(t1, t0, ok0);
+    const __m256 ok = _mm256_or_ps(ok0, ok1);
+
+    best = _mm256_blendv_ps(best, t, ok);
+    bestIdx = _mm256_castps_si256(_mm256_blendv_ps(
+        _mm256_castsi256_ps(bestIdx),
+        _mm256_castsi256_ps(_mm256_add_epi32(lanes, _mm256_set1_epi32(idx))),
+        ok));
+  }
+
+  alignas(32) float times[8];
+  alignas(32) int indices[8];
+  _mm256_store_ps(times, best);
+  _mm256_store_si256((__m256i *)indices, bestIdx);
+
+  int nearest = -1;
+  for (int lane = 0; lane < 8; lane++) {
+    if (indices[lane] >= 0 && (nearest < 0 || times[lane] < tHit)) {
+      nearest = indices[lane];
+      tHit = times[lane];
+    }
+  }
+  return nearest;
+}
+
+#else
+
+// Plain version of the same test for machines without AVX2
+int hitSpheres(const SphereSoA &soa, int start, int count, const Ray &r,
+               double tMax, float &tHit) {
+  const float a = r.direction.x * r.direction.x +
+                  r.direction.y * r.direction.y +
+                  r.direction.z * r.direction.z;
+  float best = tMax;
+  int nearest = -1;
+  for (int i = start; i < start + count; i++) {
+    const float vx = r.origin.x - soa.cx[i];
+    const float vy = r.origin.y - soa.cy[i];
+    const float vz = r.origin.z - soa.cz[i];
+    const float b = r.direction.x * vx + r.direction.y * vy +
+                    r.direction.z * vz;
+    const float c = vx * vx + vy * vy + vz * vz - soa.radius2[i];
+    const float disc = b * b - a * c;
+    if (disc <= 0)
+      continue;
+    const float root = std::sqrt(disc);
+    float t = (-root - b) / a;
+    if (!(t > 0.001f && t < best))
+      t = (root - b) / a;
+    if (t > 0.001f && t < best) {
+      best = t;
+      nearest = i;
+    }
+  }
+  tHit = best;
+  return nearest;
+}
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef _SPHERE_KERNEL_H
+#define _SPHERE_KERNEL_H
+
+#include <vector>
+
+#include "Ray.h"
+#include "Sphere.h"
+
+// Number of spheres tested per iteration of hitSpheres()
+#if defined(__AVX512F__)
+static const int SPHERE_KERNEL_WIDTH = 16;
+#else
+static const int SPHERE_KERNEL_WIDTH = 8;
+#endif
+
+// Sphere centres and squared radii as a structure of arrays, so one ray can
+// be tested against a row of spheres with vector instructions
+struct SphereSoA {
+  std::vector<float> cx, cy, cz, radius2;
+  // Number of spheres packed, not counting the padding
+  size_t count = 0;
+
+  // Copies the centres and radii of spheres. The arrays are padded so the
+  // kernel can always load a full vector.
+  void pack(const std::vector<Sphere> &spheres);
+
+  // Copies one sphere into slot i, which must already be packed
+  void set(size_t i, const Sphere &sphere);
+
+  void clear();
+};
+
+// Tests r against spheres [start, start + count) of soa and returns the index
+// of the nearest one hit between 0.001 and tMax (the same window as
+// Sphere::hit), or -1 if none are. The time of the hit is stored in tHit.
+int hitSpheres(const SphereSoA &soa, int start, int count, const Ray &r,
+               double tMax, float &tHit);
+
+#endif
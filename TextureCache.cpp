@@ -0,0 +1,216 @@
+#include "TextureCache.h"
+#include "Tonemap.h"
+
+#include <algorithm>
+#include <unistd.h>
+
+TextureCache::TextureCache(size_t maxBytes)
+    : maxTilesPerShard(std::max<size_t>(1, maxBytes / sizeof(TextureTile) /
+                                               SHARDS)),
+      scratch(tmpfile()), shards(new Shard[SHARDS]) {}
+
+TextureCache::~TextureCache() {
+  if (scratch != nullptr)
+    fclose(scratch);
+}
+
+TextureCache::TextureCache(TextureCache &&other)
+    : images(std::move(other.images)),
+      maxTilesPerShard(other.maxTilesPerShard), tileCount(other.tileCount),
+      scratch(other.scratch), pinned(std::move(other.pinned)),
+      shards(std::move(other.shards)) {
+  other.scratch = nullptr;
+  other.tileCount = 0;
+}
+
+int TextureCache::addImage(const unsigned char *rgb, int width, int height,
+                           int pitch) {
+  // Images are sRGB encoded; they are filtered and shaded with linear values
+  float decoded[256];
+  for (int i = 0; i < 256; i++)
+    decoded[i] = srgbToLinear(i / 255.0f);
+  Image image;
+  std::vector<float> texels(width * height * 3);
+  for (int y = 0; y < height; y++)
+    for (int x = 0; x < width * 3; x++)
+      texels[y * width * 3 + x] = decoded[rgb[y * pitch + x]];
+
+  // Each level is the previous one shrunk by two with a box filter, down to
+  // a single texel
+  while (true) {
+    Level level;
+    level.width = width;
+    level.height = height;
+    storeLevel(texels, level);
+    image.levels.push_back(level);
+    if (width == 1 && height == 1)
+      break;
+
+    const int w = std::max(1, width / 2);
+    const int h = std::max(1, height / 2);
+    std::vector<float> smaller(w * h * 3);
+    for (int y = 0; y < h; y++) {
+      const int y0 = std::min(2 * y, height - 1);
+      const int y1 = std::min(2 * y + 1, height - 1);
+      for (int x = 0; x < w; x++) {
+        const int x0 = std::min(2 * x, width - 1);
+        const int x1 = std::min(2 * x + 1, width - 1);
+        for (int c = 0; c < 3; c++) {
+          smaller[(y * w + x) * 3 + c] =
+              0.25f * (texels[(y0 * width + x0) * 3 + c] +
+                       texels[(y0 * width + x1) * 3 + c] +
+                       texels[(y1 * width + x0) * 3 + c] +
+                       texels[(y1 * width + x1) * 3 + c]);
+        }
+      }
+    }
+    texels.swap(smaller);
+    width = w;
+    height = h;
+  }
+
+  if (scratch != nullptr)
+    fflush(scratch);
+  images.push_back(image);
+  return images.size() - 1;
+}
+
+void TextureCache::storeLevel(const std::vector<float> &texels, Level &level) {
+  level.tilesX = (level.width + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+  level.tilesY = (level.height + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+  level.firstTile = tileCount;
+
+  for (int ty = 0; ty < level.tilesY; ty++) {
+    for (int tx = 0; tx < level.tilesX; tx++) {
+      std::shared_ptr<TextureTile> tile(new TextureTile());
+      // Texels past the edge of the image repeat the last row and column
+      for (int y = 0; y < TEXTURE_TILE_SIZE; y++) {
+        const int sy = std::min(ty * TEXTURE_TILE_SIZE + y, level.height - 1);
+        for (int x = 0; x < TEXTURE_TILE_SIZE; x++) {
+          const int sx =
+              std::min(tx * TEXTURE_TILE_SIZE + x, level.width - 1);
+          for (int c = 0; c < 3; c++)
+            tile->texels[(y * TEXTURE_TILE_SIZE + x) * 3 + c] =
+                texels[(sy * level.width + sx) * 3 + c];
+        }
+      }
+
+      if (scratch == nullptr ||
+          fseek(scratch, tileCount * sizeof(TextureTile), SEEK_SET) != 0 ||
+          fwrite(tile.get(), sizeof(TextureTile), 1, scratch) != 1)
+        pinned[tileCount] = tile;
+      tileCount++;
+    }
+  }
+}
+
+std::shared_ptr<const TextureTile> TextureCache::readTile(size_t index) const {
+  std::shared_ptr<TextureTile> tile(new TextureTile());
+  // pread doesn't move the file position, so threads can read at once
+  const ssize_t bytes = pread(fileno(scratch), tile->texels,
+                              sizeof(TextureTile), index * sizeof(TextureTile));
+  if (bytes != (ssize_t)sizeof(TextureTile))
+    std::fill(tile->texels, tile->texels + TEXTURE_TILE_SIZE *
+                                              TEXTURE_TILE_SIZE * 3,
+              0.0f);
+  return tile;
+}
+
+int TextureCache::levels(int image) const {
+  return images[image].levels.size();
+}
+
+int TextureCache::width(int image, int level) const {
+  return images[image].levels[level].width;
+}
+
+int TextureCache::height(int image, int level) const {
+  return images[image].levels[level].height;
+}
+
+std::shared_ptr<const TextureTile> TextureCache::tile(int image, int level,
+                                                      int tx, int ty) const {
+  const Level &l = images[image].levels[level];
+  const size_t index = l.firstTile + ty * l.tilesX + tx;
+
+  if (!pinned.empty()) {
+    auto p = pinned.find(index);
+    if (p != pinned.end())
+      return p->second;
+  }
+
+  Shard &shard = shards[index % SHARDS];
+  {
+    std::lock_guard<std::mutex> guard(shard.lock);
+    auto found = shard.entries.find(index);
+    if (found != shard.entries.end()) {
+      shard.hits++;
+      shard.order.splice(shard.order.begin(), shard.order,
+                         found->second.position);
+      return found->second.tile;
+    }
+    shard.misses++;
+  }
+
+  // Read without holding the lock. If another thread loads the same tile in
+  // the meantime, the first copy inserted wins.
+  std::shared_ptr<const TextureTile> loaded = readTile(index);
+
+  std::lock_guard<std::mutex> guard(shard.lock);
+  auto found = shard.entries.find(index);
+  if (found != shard.entries.end())
+    return found->second.tile;
+
+  shard.order.push_front(index);
+  Shard::Entry entry;
+  entry.tile = loaded;
+  entry.position = shard.order.begin();
+  shard.entries[index] = entry;
+
+  // Drop the least recently used tiles. Anyone still holding one keeps it
+  // alive until they let go.
+  while (shard.entries.size() > maxTilesPerShard) {
+    shard.entries.erase(shard.order.back());
+    shard.order.pop_back();
+  }
+  return loaded;
+}
+
+void TextureCache::clear() {
+  images.clear();
+  pinned.clear();
+  tileCount = 0;
+  for (int i = 0; i < SHARDS; i++) {
+    shards[i].order.clear();
+    shards[i].entries.clear();
+    shards[i].hits = 0;
+    shards[i].misses = 0;
+  }
+  if (scratch != nullptr && ftruncate(fileno(scratch), 0) != 0)
+    printf("Unable to truncate the texture scratch file\n");
+}
+
+size_t TextureCache::residentTiles() const {
+  size_t count = pinned.size();
+  for (int i = 0; i < SHARDS; i++) {
+    std::lock_guard<std::mutex> guard(shards[i].lock);
+    count += shards[i].entries.size();
+  }
+  return count;
+}
+
+void TextureCache::report(const char *name) const {
+  size_t hits = 0;
+  size_t misses = 0;
+  for (int i = 0; i < SHARDS; i++) {
+    std::lock_guard<std::mutex> guard(shards[i].lock);
+    hits += shards[i].hits;
+    misses += shards[i].misses;
+  }
+  const size_t resident = residentTiles();
+  printf("%s: %zu images, %zu tiles (%zu in memory, %zu bytes), %.1f%% hit "
+         "rate\n",
+         name, images.size(), tileCount, resident,
+         resident * sizeof(TextureTile),
+         hits + misses == 0 ? 100.0 : 100.0 * hits / (hits + misses));
+}
@@ -0,0 +1,110 @@
+#ifndef _TEXTURE_CACHE_H
+#define _TEXTURE_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Width and height of a tile in texels
+static const int TEXTURE_TILE_SIZE = 32;
+
+// A square block of one mip level, as linear float RGB, row by row
+struct TextureTile {
+  float texels[TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE * 3];
+};
+
+// Stores images as mip chains cut into tiles. Images are converted once when
+// they are added and written to a scratch file; only the most recently used
+// tiles are kept in memory, up to a fixed budget, so a scene can reference
+// more texture data than fits in RAM. Lookups can come from any thread.
+class TextureCache {
+public:
+  // maxBytes is the memory budget for tiles held in memory
+  TextureCache(size_t maxBytes = 64 * 1024 * 1024);
+
+  ~TextureCache();
+
+  TextureCache(TextureCache &&other);
+
+  TextureCache(const TextureCache &) = delete;
+
+  TextureCache &operator=(const TextureCache &) = delete;
+
+  // Decodes 8 bit sRGB pixels (3 bytes each, rows pitch bytes apart) to
+  // linear values, builds a mip chain of them and returns the id of the image
+  int addImage(const unsigned char *rgb, int width, int height, int pitch);
+
+  // Number of mip levels of an image, level 0 being the full size
+  int levels(int image) const;
+
+  int width(int image, int level) const;
+
+  int height(int image, int level) const;
+
+  // The tile at (tx, ty) of a level, read back from the scratch file if it is
+  // not in memory. The tile stays valid while the pointer is held, even if
+  // the cache drops it.
+  std::shared_ptr<const TextureTile> tile(int image, int level, int tx,
+                                          int ty) const;
+
+  // Drops every image and tile
+  void clear();
+
+  // Tiles currently held in memory
+  size_t residentTiles() const;
+
+  // Prints the images, tiles in memory and the hit rate
+  void report(const char *name) const;
+
+private:
+  struct Level {
+    int width;
+    int height;
+    int tilesX;
+    int tilesY;
+    // Index of the level's first tile in the scratch file
+    size_t firstTile;
+  };
+
+  struct Image {
+    std::vector<Level> levels;
+  };
+
+  // The cache is split into shards with a lock each, so threads looking up
+  // different tiles rarely wait for each other
+  struct Shard {
+    std::mutex lock;
+    // Most recently used first
+    std::list<uint64_t> order;
+    struct Entry {
+      std::shared_ptr<const TextureTile> tile;
+      std::list<uint64_t>::iterator position;
+    };
+    std::unordered_map<uint64_t, Entry> entries;
+    size_t hits = 0;
+    size_t misses = 0;
+  };
+
+  static const int SHARDS = 16;
+
+  // Writes a level out as tiles. Tiles that can't be written to the scratch
+  // file are kept in memory for good.
+  void storeLevel(const std::vector<float> &texels, Level &level);
+
+  std::shared_ptr<const TextureTile> readTile(size_t index) const;
+
+  std::vector<Image> images;
+  size_t maxTilesPerShard;
+  size_t tileCount = 0;
+  FILE *scratch;
+  // Tiles that have no copy in the scratch file
+  std::unordered_map<size_t, std::shared_ptr<const TextureTile>> pinned;
+  std::unique_ptr<Shard[]> shards;
+};
+
+#endif
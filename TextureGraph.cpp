@@ -0,0 +1,390 @@
+#include "TextureGraph.h"
+#include "Functions.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+int TextureGraph::addNode(const Node &node) {
+  nodes.push_back(node);
+  return nodes.size() - 1;
+}
+
+int TextureGraph::constant(const Point &c) {
+  Node n = Node();
+  n.op = TEX_CONSTANT;
+  n.colour = c;
+  return addNode(n);
+}
+
+int TextureGraph::scale(int a, float s) {
+  Node n = Node();
+  n.op = TEX_SCALE;
+  n.a = a;
+  n.param = s;
+  return addNode(n);
+}
+
+int TextureGraph::multiply(int a, int b) {
+  Node n = Node();
+  n.op = TEX_MULTIPLY;
+  n.a = a;
+  n.b = b;
+  return addNode(n);
+}
+
+int TextureGraph::add(int a, int b) {
+  Node n = Node();
+  n.op = TEX_ADD;
+  n.a = a;
+  n.b = b;
+  return addNode(n);
+}
+
+int TextureGraph::mix(int a, int b, int t) {
+  Node n = Node();
+  n.op = TEX_MIX;
+  n.a = a;
+  n.b = b;
+  n.c = t;
+  return addNode(n);
+}
+
+int TextureGraph::checker(int even, int odd, float frequency) {
+  Node n = Node();
+  n.op = TEX_CHECKER;
+  n.a = even;
+  n.b = odd;
+  n.param = frequency;
+  return addNode(n);
+}
+
+int TextureGraph::noise(float frequency, uint64_t seed) {
+  Node n = Node();
+  n.op = TEX_NOISE;
+  n.param = frequency;
+  n.seed = seed;
+  return addNode(n);
+}
+
+int TextureGraph::image(const TextureCache *cache, int image) {
+  Node n = Node();
+  n.op = TEX_IMAGE;
+  n.cache = cache;
+  n.image = image;
+  return addNode(n);
+}
+
+int TextureGraph::texture(const Texture *t) {
+  Node n = Node();
+  n.op = TEX_TEXTURE;
+  n.texture = t;
+  return addNode(n);
+}
+
+int TextureGraph::push(TextureProgram &program, TextureOp op, int a, int b,
+                       int c, float param, int index) {
+  TextureInstruction in;
+  in.op = op;
+  in.a = a;
+  in.b = b;
+  in.c = c;
+  in.param = param;
+  in.index = index;
+  program.code.push_back(in);
+  return program.code.size() - 1;
+}
+
+int TextureGraph::pushConstant(TextureProgram &program, const Point &c) {
+  program.constants.push_back(c);
+  return push(program, TEX_CONSTANT, 0, 0, 0, 0, program.constants.size() - 1);
+}
+
+bool TextureGraph::isConstant(const TextureProgram &program, int reg,
+                              Point &c) {
+  if (program.code[reg].op != TEX_CONSTANT)
+    return false;
+  c = program.constants[program.code[reg].index];
+  return true;
+}
+
+int TextureGraph::emit(int id, TextureProgram &program,
+                       std::vector<int> &registers) const {
+  if (registers[id] >= 0)
+    return registers[id];
+
+  const Node &n = nodes[id];
+  Point ca, cb, ct;
+  int reg = -1;
+  switch (n.op) {
+  case TEX_CONSTANT:
+    reg = pushConstant(program, n.colour);
+    break;
+
+  case TEX_SCALE: {
+    const int a = emit(n.a, program, registers);
+    if (isConstant(program, a, ca))
+      reg = pushConstant(program, ::scale(n.param, ca));
+    else if (n.param == 1)
+      reg = a;
+    else if (n.param == 0)
+      reg = pushConstant(program, Point(0, 0, 0));
+    else
+      reg = push(program, TEX_SCALE, a, 0, 0, n.param, 0);
+    break;
+  }
+
+  case TEX_MULTIPLY:
+  case TEX_ADD: {
+    const int a = emit(n.a, program, registers);
+    const int b = emit(n.b, program, registers);
+    const bool constA = isConstant(program, a, ca);
+    const bool constB = isConstant(program, b, cb);
+    // The value that leaves the other side unchanged
+    const Point identity = n.op == TEX_MULTIPLY ? Point(1, 1, 1) : Point(0, 0, 0);
+    if (constA && constB)
+      reg = pushConstant(program, n.op == TEX_MULTIPLY ? ca * cb : ca + cb);
+    else if (constA && ca == identity)
+      reg = b;
+    else if (constB && cb == identity)
+      reg = a;
+    else if (n.op == TEX_MULTIPLY && ((constA && ca == Point(0, 0, 0)) ||
+                                      (constB && cb == Point(0, 0, 0))))
+      reg = pushConstant(program, Point(0, 0, 0));
+    else
+      reg = push(program, n.op, a, b, 0, 0, 0);
+    break;
+  }
+
+  case TEX_MIX: {
+    const int t = emit(n.c, program, registers);
+    // A constant blend only needs the side it picks
+    if (isConstant(program, t, ct) && ct.x == 0) {
+      reg = emit(n.a, program, registers);
+      break;
+    }
+    if (isConstant(program, t, ct) && ct.x == 1) {
+      reg = emit(n.b, program, registers);
+      break;
+    }
+    const int a = emit(n.a, program, registers);
+    const int b = emit(n.b, program, registers);
+    const bool constT = isConstant(program, t, ct);
+    if (a == b)
+      reg = a;
+    else if (constT && isConstant(program, a, ca) &&
+             isConstant(program, b, cb))
+      reg = pushConstant(program, ca + ::scale(ct.x, cb - ca));
+    else
+      reg = push(program, TEX_MIX, a, b, t, 0, 0);
+    break;
+  }
+
+  case TEX_CHECKER: {
+    const int a = emit(n.a, program, registers);
+    const int b = emit(n.b, program, registers);
+    if (a == b || (isConstant(program, a, ca) && isConstant(program, b, cb) &&
+                   ca == cb))
+      reg = a;
+    else
+      reg = push(program, TEX_CHECKER, a, b, 0, n.param, 0);
+    break;
+  }
+
+  case TEX_NOISE:
+    program.noises.push_back(PerlinNoise(n.seed));
+    reg = push(program, TEX_NOISE, 0, 0, 0, n.param,
+               program.noises.size() - 1);
+    break;
+
+  case TEX_IMAGE:
+    program.images.push_back(ImageTexture(n.cache, n.image));
+    reg = push(program, TEX_IMAGE, 0, 0, 0, 0, program.images.size() - 1);
+    break;
+
+  case TEX_TEXTURE:
+    if (n.texture->constant(ca)) {
+      reg = pushConstant(program, ca);
+    } else {
+      program.textures.push_back(n.texture);
+      reg = push(program, TEX_TEXTURE, 0, 0, 0, 0,
+                 program.textures.size() - 1);
+    }
+    break;
+  }
+
+  registers[id] = reg;
+  return reg;
+}
+
+TextureProgram TextureGraph::compile(int output) const {
+  TextureProgram program;
+  std::vector<int> registers(nodes.size(), -1);
+  program.output = emit(output, program, registers);
+
+  // Folding leaves behind instructions nothing reads any more (the inputs of
+  // folded nodes). Walk back from the output to find the ones still used.
+  const int count = program.code.size();
+  std::vector<bool> live(count, false);
+  live[program.output] = true;
+  for (int i = count - 1; i >= 0; i--) {
+    if (!live[i])
+      continue;
+    const TextureInstruction &in = program.code[i];
+    switch (in.op) {
+    case TEX_MIX:
+      live[in.c] = true;
+      // fall through
+    case TEX_MULTIPLY:
+    case TEX_ADD:
+    case TEX_CHECKER:
+      live[in.b] = true;
+      // fall through
+    case TEX_SCALE:
+      live[in.a] = true;
+      break;
+    default:
+      break;
+    }
+  }
+  std::vector<int> renamed(count, -1);
+  std::vector<TextureInstruction> code;
+  for (int i = 0; i < count; i++) {
+    if (!live[i])
+      continue;
+    // Operands the op doesn't read are left at register 0
+    TextureInstruction in = program.code[i];
+    in.a = std::max(renamed[in.a], 0);
+    in.b = std::max(renamed[in.b], 0);
+    in.c = std::max(renamed[in.c], 0);
+    renamed[i] = code.size();
+    code.push_back(in);
+  }
+  program.code.swap(code);
+  program.output = renamed[program.output];
+
+  if (program.code.size() > (size_t)TEXTURE_PROGRAM_SIZE) {
+    printf("Texture graph needs %zu instructions, more than %d\n",
+           program.code.size(), TEXTURE_PROGRAM_SIZE);
+    TextureProgram missing;
+    missing.output = pushConstant(missing, Point(0, 1, 1));
+    return missing;
+  }
+  return program;
+}
+
+bool TextureProgram::constant(Point &c) const {
+  if (code[output].op != TEX_CONSTANT)
+    return false;
+  c = constants[code[output].index];
+  return true;
+}
+
+void TextureProgram::values(const Point *p, int count, Point *out) const {
+  // Register i of point j is r[i * count + j]
+  std::vector<Point> r(code.size() * count);
+  std::vector<float> x, y, z, n;
+  for (size_t i = 0; i < code.size(); i++) {
+    const TextureInstruction &in = code[i];
+    Point *to = &r[i * count];
+    Point *a = &r[in.a * count];
+    Point *b = &r[in.b * count];
+    Point *c = &r[in.c * count];
+    switch (in.op) {
+    case TEX_CONSTANT:
+      std::fill(to, to + count, constants[in.index]);
+      break;
+    case TEX_SCALE:
+      for (int j = 0; j < count; j++)
+        to[j] = scale(in.param, a[j]);
+      break;
+    case TEX_MULTIPLY:
+      for (int j = 0; j < count; j++)
+        to[j] = a[j] * b[j];
+      break;
+    case TEX_ADD:
+      for (int j = 0; j < count; j++)
+        to[j] = a[j] + b[j];
+      break;
+    case TEX_MIX:
+      for (int j = 0; j < count; j++)
+        to[j] = a[j] + scale(c[j].x, b[j] - a[j]);
+      break;
+    case TEX_CHECKER:
+      for (int j = 0; j < count; j++) {
+        const double val = sin(in.param * p[j].x) * sin(in.param * p[j].y) *
+                           sin(in.param * p[j].z);
+        to[j] = val < 0 ? a[j] : b[j];
+      }
+      break;
+    case TEX_NOISE:
+      x.resize(count);
+      y.resize(count);
+      z.resize(count);
+      n.resize(count);
+      for (int j = 0; j < count; j++) {
+        x[j] = in.param * p[j].x;
+        y[j] = in.param * p[j].y;
+        z[j] = in.param * p[j].z;
+      }
+      noises[in.index].noise(x.data(), y.data(), z.data(), n.data(), count);
+      for (int j = 0; j < count; j++)
+        to[j] = Point((1 + n[j]) / 2, (1 + n[j]) / 2, (1 + n[j]) / 2);
+      break;
+    case TEX_IMAGE:
+      for (int j = 0; j < count; j++)
+        to[j] = images[in.index].filtered(0, 0, p[j], 0);
+      break;
+    case TEX_TEXTURE:
+      for (int j = 0; j < count; j++)
+        to[j] = textures[in.index]->filtered(0, 0, p[j], 0);
+      break;
+    }
+  }
+  std::copy(r.begin() + output * count, r.begin() + (output + 1) * count,
+            out);
+}
+
+Point TextureProgram::run(double u, double v, const Point &p,
+                          double width) const {
+  Point r[TEXTURE_PROGRAM_SIZE];
+  for (size_t i = 0; i < code.size(); i++) {
+    const TextureInstruction &in = code[i];
+    switch (in.op) {
+    case TEX_CONSTANT:
+      r[i] = constants[in.index];
+      break;
+    case TEX_SCALE:
+      r[i] = scale(in.param, r[in.a]);
+      break;
+    case TEX_MULTIPLY:
+      r[i] = r[in.a] * r[in.b];
+      break;
+    case TEX_ADD:
+      r[i] = r[in.a] + r[in.b];
+      break;
+    case TEX_MIX:
+      r[i] = r[in.a] + scale(r[in.c].x, r[in.b] - r[in.a]);
+      break;
+    case TEX_CHECKER: {
+      const double val = sin(in.param * p.x) * sin(in.param * p.y) *
+                         sin(in.param * p.z);
+      r[i] = val < 0 ? r[in.a] : r[in.b];
+      break;
+    }
+    case TEX_NOISE: {
+      const float n = noises[in.index].noise(in.param * p.x, in.param * p.y,
+                                             in.param * p.z);
+      r[i] = Point((1 + n) / 2, (1 + n) / 2, (1 + n) / 2);
+      break;
+    }
+    case TEX_IMAGE:
+      r[i] = images[in.index].filtered(u, v, p, width);
+      break;
+    case TEX_TEXTURE:
+      r[i] = textures[in.index]->filtered(u, v, p, width);
+      break;
+    }
+  }
+  return r[output];
+}
@@ -0,0 +1,139 @@
+#ifndef _TEXTURE_GRAPH_H
+#define _TEXTURE_GRAPH_H
+
+#include <cstdint>
+#include <vector>
+
+#include "Noise.h"
+#include "Point.h"
+#include "TextureCache.h"
+#include "Textures/ImageTexture.h"
+#include "Textures/Texture.h"
+
+enum TextureOp : unsigned char {
+  TEX_CONSTANT,
+  TEX_SCALE,
+  TEX_MULTIPLY,
+  TEX_ADD,
+  TEX_MIX,
+  TEX_CHECKER,
+  TEX_NOISE,
+  TEX_IMAGE,
+  TEX_TEXTURE
+};
+
+// Most instructions a TextureProgram can hold
+static const int TEXTURE_PROGRAM_SIZE = 64;
+
+// One step of a TextureProgram. Instruction i writes register i from the
+// registers a, b and c.
+struct TextureInstruction {
+  TextureOp op;
+  unsigned short a, b, c;
+  // Scale factor or checker/noise frequency
+  float param;
+  // Slot in the program's table of constants, noises, images or textures
+  int index;
+};
+
+// A texture graph compiled down to a straight list of instructions, run once
+// per lookup with no virtual calls except for wrapped textures
+class TextureProgram : public Texture {
+public:
+  Point value(double u, double v, const Point p) const override {
+    return run(u, v, p, 0);
+  }
+
+  Point filtered(double u, double v, const Point p,
+                 double width) const override {
+    return run(u, v, p, width);
+  }
+
+  bool constant(Point &c) const override;
+
+  // Runs each instruction over all the points before the next, so noise is
+  // looked up with PerlinNoise's batch kernel
+  void values(const Point *p, int count, Point *out) const override;
+
+  // Number of instructions left after folding
+  int size() const { return code.size(); }
+
+private:
+  friend class TextureGraph;
+
+  Point run(double u, double v, const Point &p, double width) const;
+
+  std::vector<TextureInstruction> code;
+  // Register that holds the result
+  int output = 0;
+
+  std::vector<Point> constants;
+  std::vector<PerlinNoise> noises;
+  std::vector<ImageTexture> images;
+  std::vector<const Texture *> textures;
+};
+
+// Textures built out of nodes. Every method adds a node and returns its id,
+// to be used as the input of later nodes. compile() turns the nodes that
+// lead to an output into a TextureProgram, working out every node whose
+// inputs are all constant while it goes.
+class TextureGraph {
+public:
+  int constant(const Point &c);
+
+  // a times s
+  int scale(int a, float s);
+
+  // a times b, channel by channel
+  int multiply(int a, int b);
+
+  int add(int a, int b);
+
+  // a where the first channel of t is 0, b where it is 1
+  int mix(int a, int b, int t);
+
+  // The same 3D pattern as CheckerTexture
+  int checker(int even, int odd, float frequency = 10);
+
+  // Grey Perlin noise, the same as PerlinTexture
+  int noise(float frequency, uint64_t seed = 0);
+
+  // An image from a texture cache, filtered over the lookup's footprint
+  int image(const TextureCache *cache, int image);
+
+  // Any other texture. Not owned, it has to outlive the program.
+  int texture(const Texture *t);
+
+  TextureProgram compile(int output) const;
+
+private:
+  struct Node {
+    TextureOp op;
+    int a, b, c;
+    float param;
+    Point colour;
+    uint64_t seed;
+    const TextureCache *cache;
+    int image;
+    const Texture *texture;
+  };
+
+  int addNode(const Node &node);
+
+  // Appends an instruction and returns its register
+  static int push(TextureProgram &program, TextureOp op, int a, int b, int c,
+                  float param, int index);
+
+  static int pushConstant(TextureProgram &program, const Point &c);
+
+  // True if the register is a constant, which is stored in c
+  static bool isConstant(const TextureProgram &program, int reg, Point &c);
+
+  // Emits the instructions for a node once its inputs are done, and returns
+  // the register that holds it
+  int emit(int id, TextureProgram &program, std::vector<int> &registers) const;
+
+  std::vector<Node> nodes;
+};
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef _BAKED_TEXTURE_H
+#define _BAKED_TEXTURE_H
+
+#include "../Point.h"
+#include "../aabb.h"
+#include "Texture.h"
+#include <cmath>
+#include <vector>
+
+// A texture of position sampled once on a 3D grid over a region, when the
+// scene is built. Lookups inside the region are a trilinear fetch from the
+// grid; anything outside goes to the source texture.
+class BakedTexture : public Texture {
+public:
+  // res is the number of grid points along each side (at least 2). Colours are kept as
+  // 8 bits per channel, the same precision as an image texture.
+  BakedTexture(const Texture *source, const aabb &region, int res)
+      : source(source), region(region), res(res), grid(res * res * res * 3) {
+    step = Point((region.max.x - region.min.x) / (res - 1),
+                 (region.max.y - region.min.y) / (res - 1),
+                 (region.max.z - region.min.z) / (res - 1));
+
+    // A row at a time, so the source can evaluate it as a batch
+    std::vector<Point> points(res);
+    std::vector<Point> colours(res);
+    for (int k = 0; k < res; k++) {
+      for (int j = 0; j < res; j++) {
+        for (int i = 0; i < res; i++)
+          points[i] = Point(region.min.x + i * step.x,
+                            region.min.y + j * step.y,
+                            region.min.z + k * step.z);
+        source->values(points.data(), res, colours.data());
+        unsigned char *row = &grid[((k * res + j) * res) * 3];
+        for (int i = 0; i < res; i++) {
+          row[i * 3] = quantize(colours[i].x);
+          row[i * 3 + 1] = quantize(colours[i].y);
+          row[i * 3 + 2] = quantize(colours[i].z);
+        }
+      }
+    }
+  }
+
+  Point value(double u, double v, const Point p) const override {
+    const float gx = (p.x - region.min.x) / step.x;
+    const float gy = (p.y - region.min.y) / step.y;
+    const float gz = (p.z - region.min.z) / step.z;
+    if (!(gx >= 0 && gy >= 0 && gz >= 0 && gx <= res - 1 && gy <= res - 1 &&
+          gz <= res - 1))
+      return source->value(u, v, p);
+
+    // The far faces belong to the last cell
+    const int i = gx >= res - 1 ? res - 2 : (int)gx;
+    const int j = gy >= res - 1 ? res - 2 : (int)gy;
+    const int k = gz >= res - 1 ? res - 2 : (int)gz;
+    const float fx = gx - i;
+    const float fy = gy - j;
+    const float fz = gz - k;
+
+    // Blend along x on the four edges of the cell, then along y and z
+    const int dy = res * 3;
+    const int dz = res * res * 3;
+    const unsigned char *base = &grid[((k * res + j) * res + i) * 3];
+    float colour[3];
+    for (int c = 0; c < 3; c++) {
+      const unsigned char *t = base + c;
+      const float x00 = t[0] + fx * (t[3] - t[0]);
+      const float x10 = t[dy] + fx * (t[dy + 3] - t[dy]);
+      const float x01 = t[dz] + fx * (t[dz + 3] - t[dz]);
+      const float x11 = t[dz + dy] + fx * (t[dz + dy + 3] - t[dz + dy]);
+      const float y0 = x00 + fy * (x10 - x00);
+      const float y1 = x01 + fy * (x11 - x01);
+      colour[c] = (y0 + fz * (y1 - y0)) * (1.0f / 255);
+    }
+    return Point(colour[0], colour[1], colour[2]);
+  }
+
+  // Bytes held by the grid
+  size_t bytes() const { return grid.size(); }
+
+private:
+  static unsigned char quantize(float c) {
+    const float scaled = c * 255 + 0.5f;
+    return scaled <= 0 ? 0 : (scaled >= 255 ? 255 : (unsigned char)scaled);
+  }
+
+  // Not owned, the source has to outlive the baked copy
+  const Texture *source;
+  aabb region;
+  int res;
+  Point step;
+  std::vector<unsigned char> grid;
+};
+
+#endif
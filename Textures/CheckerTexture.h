@@ -14,8 +14,10 @@
 		CheckerTexture(Texture* tex1, Texture* tex2) : even(tex1), odd(tex2){}
 
 		CheckerTexture(Point col1, Point col2) :
-			even(new SolidColour(col1)),
-			odd(new SolidColour(col2)) {}
+			evenColour(col1),
+			oddColour(col2),
+			even(&evenColour),
+			odd(&oddColour) {}
 
 		Point value(double u, double v, const Point p) const override {
 			double val = sin(10*p.x) * sin(10*p.y) * sin(10*p.z);
@@ -25,6 +27,9 @@
 		}
 
 	private:
+		// Storage for the two colours when built from constants
+		SolidColour evenColour;
+		SolidColour oddColour;
 		Texture* even;
 		Texture* odd;
 	};
@@ -3,44 +3,101 @@
 
 #include "../Functions.h"
 #include "../Point.h"
+#include "../TextureCache.h"
 #include "SolidColour.h"
 #include "Texture.h"
 #include <cmath>
 #include <iostream>
+#include <memory>
 
+// An image stored in a TextureCache. Lookups are bilinear on the full size
+// image, or trilinear between the two mip levels closest to the footprint.
 class ImageTexture : public Texture {
 public:
   ImageTexture() {}
 
-  ImageTexture(unsigned char *p, int _width, int _height)
-      : pixels(p), width(_width), height(_height), pitch(3 * _width) {}
+  // image is an id returned by cache->addImage(), or -1 if the image could
+  // not be loaded
+  ImageTexture(const TextureCache *cache, int image)
+      : cache(cache), image(image) {}
 
   Point value(double u, double v, const Point p) const override {
-    if (pixels == nullptr)
+    return filtered(u, v, p, 0);
+  }
+
+  Point filtered(double u, double v, const Point p,
+                 double width) const override {
+    if (cache == nullptr || image < 0)
       return Point(0, 1, 1);
     u = clamp(u, 0.0, 1.0);
     v = 1.0 - clamp(v, 0.0, 1.0);
 
-    int i = (int)(u * width);
-    int j = (int)(v * height);
+    // The level where one texel is about as wide as the footprint
+    const int levels = cache->levels(image);
+    const double size = std::fmax(cache->width(image, 0),
+                                  cache->height(image, 0));
+    const double level = width > 0 ? std::log2(width * size) : 0;
+    if (level <= 0)
+      return bilinear(0, u, v);
+    if (level >= levels - 1)
+      return bilinear(levels - 1, u, v);
+
+    const int fine = (int)level;
+    const float t = level - fine;
+    const Point a = bilinear(fine, u, v);
+    const Point b = bilinear(fine + 1, u, v);
+    return Point(a.x + t * (b.x - a.x), a.y + t * (b.y - a.y),
+                 a.z + t * (b.z - a.z));
+  }
+
+private:
+  // Blends the four texels around (u, v) of one level. Usually all four are
+  // in the same tile, so it is only fetched once.
+  Point bilinear(int level, double u, double v) const {
+    const int w = cache->width(image, level);
+    const int h = cache->height(image, level);
+    const double x = u * w - 0.5;
+    const double y = v * h - 0.5;
+    const int x0 = (int)std::floor(x);
+    const int y0 = (int)std::floor(y);
+    const float fx = x - x0;
+    const float fy = y - y0;
 
-    if (i >= width)
-      i = width - 1;
-    if (j >= height)
-      j = height - 1;
+    const int xs[2] = {clampIndex(x0, w), clampIndex(x0 + 1, w)};
+    const int ys[2] = {clampIndex(y0, h), clampIndex(y0 + 1, h)};
+    const float weights[4] = {(1 - fx) * (1 - fy), fx * (1 - fy),
+                              (1 - fx) * fy, fx * fy};
 
-    unsigned char *pixel = pixels + (j * pitch) + (i * 3);
-    return Point((float)pixel[0] / 255, (float)pixel[1] / 255,
-                 (float)pixel[2] / 255);
+    std::shared_ptr<const TextureTile> tile;
+    int tileX = -1;
+    int tileY = -1;
+    float colour[3] = {0, 0, 0};
+    for (int i = 0; i < 4; i++) {
+      const int tx = xs[i & 1] / TEXTURE_TILE_SIZE;
+      const int ty = ys[i >> 1] / TEXTURE_TILE_SIZE;
+      if (tx != tileX || ty != tileY) {
+        tile = cache->tile(image, level, tx, ty);
+        tileX = tx;
+        tileY = ty;
+      }
+      const float *texel =
+          tile->texels + ((ys[i >> 1] % TEXTURE_TILE_SIZE) * TEXTURE_TILE_SIZE +
+                          xs[i & 1] % TEXTURE_TILE_SIZE) *
+                             3;
+      colour[0] += weights[i] * texel[0];
+      colour[1] += weights[i] * texel[1];
+      colour[2] += weights[i] * texel[2];
+    }
+    return Point(colour[0], colour[1], colour[2]);
   }
 
-  ~ImageTexture() { delete pixels; }
+  static int clampIndex(int i, int size) {
+    return i < 0 ? 0 : (i >= size ? size - 1 : i);
+  }
 
-private:
-  unsigned char *pixels;
-  int width;
-  int height;
-  int pitch;
+  // Not owned, the cache has to outlive the texture
+  const TextureCache *cache = nullptr;
+  int image = -1;
 };
 
 #endif
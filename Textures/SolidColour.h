@@ -20,6 +20,11 @@
 			return Colour;
 		}
 
+		bool constant(Point &c) const override {
+			c = Colour;
+			return true;
+		}
+
 	private:
 		Point Colour;
 	};
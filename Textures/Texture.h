@@ -6,6 +6,25 @@
 class Texture {
 public:
   virtual Point value(double u, double v, const Point p) const = 0;
+
+  // The texture averaged over a footprint about width wide in uv space, for
+  // lookups that know how much of the texture a pixel covers. Textures that
+  // can't filter return the point value.
+  virtual Point filtered(double u, double v, const Point p,
+                         double width) const {
+    return value(u, v, p);
+  }
+
+  // Returns true, and stores the colour in c, if the texture is the same
+  // everywhere
+  virtual bool constant(Point &c) const { return false; }
+
+  // value() at count points at once, with u and v of zero. Used to bake
+  // textures of position alone; procedural ones can do a batch faster.
+  virtual void values(const Point *p, int count, Point *out) const {
+    for (int i = 0; i < count; i++)
+      out[i] = value(0, 0, p[i]);
+  }
 };
 
 #endif
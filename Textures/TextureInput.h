@@ -0,0 +1,31 @@
+#ifndef _TEXTURE_INPUT_H
+#define _TEXTURE_INPUT_H
+
+#include "../Point.h"
+#include "Texture.h"
+
+// A colour input of a material. Constants (and textures that fold down to
+// one) are kept inline, so reading them costs no virtual call.
+class TextureInput {
+public:
+  TextureInput(const Point &c) : constant(c), texture(nullptr) {}
+
+  TextureInput(const Texture *t) : constant(0, 0, 0), texture(t) {
+    if (t == nullptr || t->constant(constant))
+      texture = nullptr;
+  }
+
+  Point at(double u, double v, const Point &p, double width = 0) const {
+    if (texture == nullptr)
+      return constant;
+    return texture->filtered(u, v, p, width);
+  }
+
+  bool isConstant() const { return texture == nullptr; }
+
+  Point constant;
+  // Not owned. Null when the input is constant.
+  const Texture *texture;
+};
+
+#endif
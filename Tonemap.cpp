@@ -0,0 +1,107 @@
+#include "Tonemap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Both branches are computed and one is picked, so loops calling it stay
+// vectorised
+static inline float encode(float x) {
+  const float curve = 1.055f * std::pow(x, 1 / 2.4f) - 0.055f;
+  return x <= 0.0031308f ? 12.92f * x : curve;
+}
+
+float linearToSrgb(float linear) { return encode(linear); }
+
+float srgbToLinear(float encoded) {
+  return encoded <= 0.04045f ? encoded / 12.92f
+                             : std::pow((encoded + 0.055f) / 1.055f, 2.4f);
+}
+
+template <TonemapOperator Op> static inline float tonemap(float x) {
+  switch (Op) {
+  case TONEMAP_REINHARD:
+    return x / (1 + x);
+  case TONEMAP_ACES:
+    return (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f);
+  case TONEMAP_CLAMP:
+  default:
+    return x;
+  }
+}
+
+// Interleaved gradient noise in [0, 1): cheap, without a pattern the eye
+// picks out, and the same for a pixel every time it is developed
+static inline float ditherNoise(int x, int y) {
+  const float f = 0.06711056f * x + 0.00583715f * y;
+  const float g = 52.9829189f * (f - std::floor(f));
+  return g - std::floor(g);
+}
+
+// One channel of a row, exposed and divided by each pixel's sample count,
+// developed into 8 bit values
+template <TonemapOperator Op>
+static void developChannel(const double *in, const unsigned int *counts,
+                           int width, int y, float exposure, float srgb,
+                           float dither, float *scratch, uint32_t *out) {
+  for (int x = 0; x < width; x++)
+    scratch[x] = (float)in[x * 3] * exposure / (counts[x] > 0 ? counts[x] : 1);
+  for (int x = 0; x < width; x++) {
+    const float v = std::min(1.0f, tonemap<Op>(std::max(0.0f, scratch[x])));
+    const float encoded = encode(v);
+    // Half a step either way, around the rounding offset of a half
+    const float offset = 0.5f + dither * (ditherNoise(x, y) - 0.5f);
+    // Blended rather than picked, which vectorises where the pick doesn't
+    const float value = v + srgb * (encoded - v);
+    out[x] = (uint32_t)std::min(255.0f, std::max(0.0f, value * 255 + offset));
+  }
+}
+
+template <TonemapOperator Op>
+static void developRow(const double *in, const unsigned int *counts,
+                       int width, int y, const ToneSettings &tone,
+                       float *scratch, uint32_t *channels, uint32_t *row) {
+  const float exposure = std::exp2(tone.exposure);
+  const float srgb = tone.srgb ? 1.0f : 0.0f;
+  const float dither = tone.dither ? 1.0f : 0.0f;
+  // A channel at a time, so every loop is a plain one over floats
+  for (int c = 0; c < 3; c++)
+    developChannel<Op>(in + c, counts, width, y, exposure, srgb, dither,
+                       scratch, channels + c * width);
+  for (int x = 0; x < width; x++)
+    row[x] = 0xff000000u | (channels[x] << 16) |
+             (channels[width + x] << 8) | channels[2 * width + x];
+}
+
+void developRows(const double *raw, const unsigned int *pixelSamples,
+                 int width, int y0, int y1, const ToneSettings &tone,
+                 unsigned char *out, int pitch) {
+#pragma omp parallel
+  {
+    std::vector<float> scratch(width);
+    std::vector<uint32_t> channels(width * 3);
+#pragma omp for schedule(static)
+    for (int y = y0; y < y1; y++) {
+      const double *in = raw + (size_t)y * width * 3;
+      const unsigned int *counts = pixelSamples + (size_t)y * width;
+      uint32_t *row = (uint32_t *)(out + (size_t)(y - y0) * pitch);
+      switch (tone.op) {
+      case TONEMAP_REINHARD:
+        developRow<TONEMAP_REINHARD>(in, counts, width, y, tone,
+                                     scratch.data(), channels.data(), row);
+        break;
+      case TONEMAP_ACES:
+        developRow<TONEMAP_ACES>(in, counts, width, y, tone, scratch.data(),
+                                 channels.data(), row);
+        break;
+      case TONEMAP_CLAMP:
+      default:
+        developRow<TONEMAP_CLAMP>(in, counts, width, y, tone, scratch.data(),
+                                  channels.data(), row);
+        break;
+      }
+    }
+  }
+}
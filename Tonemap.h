@@ -0,0 +1,50 @@
+#ifndef _TONEMAP_H
+#define _TONEMAP_H
+
+// Scenes are rendered in linear radiance, where 1 is the brightest white a
+// display shows before tonemapping. Everything here turns that into 8 bit
+// pixels.
+
+// How radiance above 1 is brought into the displayable range
+enum TonemapOperator {
+  // Cut off at 1
+  TONEMAP_CLAMP,
+  // x / (1 + x): keeps every highlight, but greys out bright colours
+  TONEMAP_REINHARD,
+  // A fit of the ACES filmic curve: a toe in the shadows and a soft shoulder
+  TONEMAP_ACES
+};
+
+struct ToneSettings {
+  // Stops the radiance is scaled by before tonemapping
+  float exposure = 0;
+  TonemapOperator op = TONEMAP_ACES;
+  // Encode with the sRGB transfer function. Without it the pixels hold the
+  // tonemapped values as they are.
+  bool srgb = true;
+  // Add noise of up to half a step before rounding to 8 bits, which breaks up
+  // the banding of smooth gradients
+  bool dither = true;
+
+  bool operator==(const ToneSettings &o) const {
+    return exposure == o.exposure && op == o.op && srgb == o.srgb &&
+           dither == o.dither;
+  }
+
+  bool operator!=(const ToneSettings &o) const { return !(*this == o); }
+};
+
+// The sRGB encoding of a linear value in [0, 1], and its inverse
+float linearToSrgb(float linear);
+
+float srgbToLinear(float encoded);
+
+// Develops accumulated samples into pixels: rows y0 to y1 of raw, each pixel
+// divided by its sample count, exposed, tonemapped, encoded and rounded, are
+// written as ARGB8888 to out with rows pitch bytes apart. Rows are developed
+// in parallel and the loop over a row has no branches, so it vectorises.
+void developRows(const double *raw, const unsigned int *pixelSamples,
+                 int width, int y0, int y1, const ToneSettings &tone,
+                 unsigned char *out, int pitch);
+
+#endif
@@ -19,8 +19,8 @@ public:
   //   return hittablePtr->pdfValue(origin, vec);
   // }
 
-  // virtual Vec random(const Point &origin) const override {
-  //   return hittablePtr->random(origin);
+  // virtual Vec random(const Point &origin, Sampler &sampler) const override {
+  //   return hittablePtr->random(origin, sampler);
   // }
 
   Hittable *hittablePtr;
@@ -0,0 +1,61 @@
+#include "Triangle.h"
+#include "Functions.h"
+
+#include <cmath>
+
+Triangle::Triangle(const Point &v0, const Point &v1, const Point &v2,
+                   Materials *mat)
+    : v0(v0), v1(v1), v2(v2), mat(mat) {
+  edge1 = sub(v1, v0).direction();
+  edge2 = sub(v2, v0).direction();
+  normal = unitVec(crossProduct(edge1, edge2));
+}
+
+bool Triangle::hit(const Ray &r, hitRecord &rec, double tMin,
+                   double tMax) const {
+  const Vec pvec = crossProduct(r.direction, edge2);
+  const double det = dotProduct(edge1, pvec);
+  // The ray is parallel to the triangle
+  if (std::fabs(det) < 1e-12)
+    return false;
+  const double invDet = 1.0 / det;
+
+  const Vec tvec = sub(r.origin, v0).direction();
+  const double u = dotProduct(tvec, pvec) * invDet;
+  if (u < 0.0 || u > 1.0)
+    return false;
+
+  const Vec qvec = crossProduct(tvec, edge1);
+  const double v = dotProduct(r.direction, qvec) * invDet;
+  if (v < 0.0 || u + v > 1.0)
+    return false;
+
+  const double t = dotProduct(edge2, qvec) * invDet;
+  // No hit
+  if (t < tMin || t > tMax || t < 0.001)
+    return false;
+
+  rec.t = t;
+  rec.p = r.pointAtTime(t);
+  rec.u = u;
+  rec.v = v;
+  rec.dpdu = edge1;
+  rec.dpdv = edge2;
+  rec.dndu = rec.dndv = Vec(0, 0, 0);
+  rec.matPtr = mat;
+  // Faces the incoming ray, the same as the axis aligned rectangles
+  rec.normal = (dotProduct(r.direction, normal) > 0.0) ? -normal : normal;
+  return true;
+}
+
+bool Triangle::boundingBox(double t0, double t1, aabb &outputBox) const {
+  // Padded so that axis aligned triangles are not infinitely thin
+  const float pad = 0.0001;
+  outputBox = aabb(Point(std::fmin(v0.x, std::fmin(v1.x, v2.x)) - pad,
+                         std::fmin(v0.y, std::fmin(v1.y, v2.y)) - pad,
+                         std::fmin(v0.z, std::fmin(v1.z, v2.z)) - pad),
+                   Point(std::fmax(v0.x, std::fmax(v1.x, v2.x)) + pad,
+                         std::fmax(v0.y, std::fmax(v1.y, v2.y)) + pad,
+                         std::fmax(v0.z, std::fmax(v1.z, v2.z)) + pad));
+  return true;
+}
@@ -0,0 +1,28 @@
+#ifndef _TRIANGLE_H
+#define _TRIANGLE_H
+
+#include "Hittable.h"
+#include "Point.h"
+#include "aabb.h"
+
+// A single triangle given by its three corners
+class Triangle : public Hittable {
+public:
+  Triangle(const Point &v0, const Point &v1, const Point &v2, Materials *mat);
+
+  // Moller-Trumbore intersection. u and v are the barycentric coordinates of
+  // the hit point.
+  bool hit(const Ray &r, hitRecord &rec, double tMin,
+           double tMax) const override;
+
+  bool boundingBox(double t0, double t1, aabb &outputBox) const override;
+
+private:
+  Point v0, v1, v2;
+  Vec edge1, edge2;
+  // Unit normal, following the winding v0 -> v1 -> v2
+  Vec normal;
+  Materials *mat;
+};
+
+#endif
@@ -24,7 +24,10 @@ public:
 private:
 	Materials *mat;
 	Point p0, p1;
-	HittableList sides;
+	// The six sides are stored inline so the box is a single allocation
+	XYRectangle front, back;
+	XZRectangle up, down;
+	YZRectangle right, left;
 };
 
 #endif 
@@ -27,6 +27,9 @@ bool XYRectangle::hit(const Ray &r, hitRecord &rec, double tMin,
     return false;
   rec.u = (hit.x - x0) / (x1 - x0);
   rec.v = (hit.y - y0) / (y1 - y0);
+  rec.dpdu = Vec(x1 - x0, 0, 0);
+  rec.dpdv = Vec(0, y1 - y0, 0);
+  rec.dndu = rec.dndv = Vec(0, 0, 0);
   rec.matPtr = mat;
   rec.p = hit;
   rec.t = t;
@@ -67,6 +70,9 @@ bool XZRectangle::hit(const Ray &r, hitRecord &rec, double tMin,
     return false;
   rec.u = (hit.x - x0) / (x1 - x0);
   rec.v = (hit.z - z0) / (z1 - z0);
+  rec.dpdu = Vec(x1 - x0, 0, 0);
+  rec.dpdv = Vec(0, 0, z1 - z0);
+  rec.dndu = rec.dndv = Vec(0, 0, 0);
   rec.matPtr = mat;
   rec.p = r.pointAtTime(t);
   rec.t = t;
@@ -106,6 +112,9 @@ bool YZRectangle::hit(const Ray &r, hitRecord &rec, double tMin,
     return false;
   rec.u = (hit.y - y0) / (y1 - y0);
   rec.v = (hit.z - z0) / (z1 - z0);
+  rec.dpdu = Vec(0, y1 - y0, 0);
+  rec.dpdv = Vec(0, 0, z1 - z0);
+  rec.dndu = rec.dndv = Vec(0, 0, 0);
   rec.matPtr = mat;
   rec.p = hit;
   rec.t = t;
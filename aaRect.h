@@ -75,8 +75,9 @@ public:
     return distanceSquared / (cosine * area);
   }
 
-  virtual Vec random(const Point& origin) const override {
-    Point randomPoint = Point(joetracer::randomNum(x0, x1), k, joetracer::randomNum(z0, z1));
+  virtual Vec random(const Point &origin, Sampler &sampler) const override {
+    const float x = sampler.next(x0, x1);
+    Point randomPoint = Point(x, k, sampler.next(z0, z1));
     return sub(randomPoint, origin).direction();
   }
 
@@ -72,6 +72,25 @@
             return true;
     }
 
+    bool aabb::clip(const Ray &r, double &tMin, double &tMax) const
+    {
+        const float origin[3] = {r.origin.x, r.origin.y, r.origin.z};
+        const float direction[3] = {r.direction.x, r.direction.y, r.direction.z};
+        const float low[3] = {min.x, min.y, min.z};
+        const float high[3] = {max.x, max.y, max.z};
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const double inv = 1.0 / direction[axis];
+            const double t0 = (low[axis] - origin[axis]) * inv;
+            const double t1 = (high[axis] - origin[axis]) * inv;
+            tMin = fmax(fmin(t0, t1), tMin);
+            tMax = fmin(fmax(t0, t1), tMax);
+            if (tMax <= tMin)
+                return false;
+        }
+        return true;
+    }
+
     aabb surroundingBox(aabb box0, aabb box1)
     {
         return aabb(Point(fmin(box0.min.x, box1.min.x),
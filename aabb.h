@@ -17,6 +17,9 @@
         // Takes ray to be examined, the interval tmin and tmax and returns if the ray has intersected the bounding box or not
         bool hit(const Ray &r, double tMin, double tMax) const;
 
+        // Like hit(), but narrows tMin and tMax down to the part of the ray inside the box
+        bool clip(const Ray &r, double &tMin, double &tMax) const;
+
         Point min;
         Point max;
     };
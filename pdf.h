@@ -1,12 +1,13 @@
 #ifndef _PDF_H
 #define _PDF_H
 
+#include "Sampler.h"
 #include "Vec.h"
 class pdf {
  public:
   virtual ~pdf() {}
   virtual double value(const Vec& direction) const = 0;
-  virtual Vec generate() const = 0;
+  virtual Vec generate(Sampler &sampler) const = 0;
 };
 
 #endif
@@ -15,8 +15,9 @@ class CosineONB_PDF : public pdf {
   }
 
   // Generates a random cosine ray based on the normal angle.
-  virtual Vec generate() const override {
-    return uvw.local(randomCosinePDFRay());
+  virtual Vec generate(Sampler &sampler) const override {
+    const float u1 = sampler.next();
+    return uvw.local(cosineDirection(u1, sampler.next()));
   }
   
   onb uvw;
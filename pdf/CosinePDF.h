@@ -18,8 +18,9 @@ class CosinePDF : public pdf {
   }
 
   // Generates a random cosine ray based on the normal angle.
-  virtual Vec generate() const override {
-    Vec scatterDirection = add(normal, randomRayInSphere(normal));
+  virtual Vec generate(Sampler &sampler) const override {
+    const float u1 = sampler.next();
+    Vec scatterDirection = add(normal, sphereDirection(u1, sampler.next()));
     if (isDegenerate(scatterDirection))
       scatterDirection = normal;
     return unitVec(scatterDirection);
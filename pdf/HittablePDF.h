@@ -12,7 +12,9 @@ public:
     return ptr->pdfValue(o, direction);
   }
 
-  virtual Vec generate() const override { return ptr->random(o); }
+  virtual Vec generate(Sampler &sampler) const override {
+    return ptr->random(o, sampler);
+  }
 
   Point o;
   Hittable *ptr;
@@ -2,7 +2,6 @@
 #define _MIXTURE_PDF_H
 
 #include "../pdf.h"
-#include "../RandomGenerator.h"
 
 class MixturePDF : public pdf {
  public:
@@ -16,11 +15,11 @@ class MixturePDF : public pdf {
     return (mixNum * pdf0->value(direction)) + ((1 - mixNum) * pdf1->value(direction));
   }
 
-  virtual Vec generate() const override {
-    if(joetracer::randomOne() < mixNum)
-      return pdf1->generate();
+  virtual Vec generate(Sampler &sampler) const override {
+    if(sampler.next() < mixNum)
+      return pdf1->generate(sampler);
     else
-      return pdf0->generate();
+      return pdf0->generate(sampler);
   }
   
   pdf* pdf0;
@@ -1,11 +1,22 @@
 // Scene Functions and Primitives
+#include "Animation.h"
 #include "ConstantMedium.h"
+#include "DensityField.h"
+#include "Denoiser.h"
+#include "Distributed.h"
+#include "FrameDisplay.h"
+#include "HdrImage.h"
 #include "Hittable.h"
+#include "KeyframedTransform.h"
 #include "Light.h"
+#include "Medium.h"
 #include "Move.h"
+#include "MovingSphere.h"
 #include "Point.h"
+#include "RenderService.h"
 #include "Rotation.h"
 #include "Scene.h"
+#include "SparseVolume.h"
 #include "Sphere.h"
 #include "Translate.h"
 #include "Vec.h"
@@ -25,6 +36,7 @@
 #include "Textures/ImageTexture.h"
 #include "Textures/PerlinTexture.h"
 #include "Textures/SolidColour.h"
+#include "TextureGraph.h"
 
 // GUI
 #include "gui/imgui/backends/imgui_impl_sdl.h"
@@ -35,9 +47,16 @@
 
 // System libraries
 #include <SDL2/SDL_render.h>
+#include <chrono>
 #include <cmath>
+#include <csignal>
+#include <cstring>
 #include <iostream>
 #include <limits>
+#include <memory>
+#include <omp.h>
+#include <string>
+#include <unistd.h>
 
 #if !SDL_VERSION_ATLEAST(2, 0, 17)
 #error This backend requires SDL 2.0.17+ because of SDL_RenderGeometry() function
@@ -46,44 +65,71 @@
 static int screenWidth = 200;
 static int screenHeight = 200;
 
+// Grid points along each side when procedural textures are baked, about
+// 6 MB a texture
+static const int BAKE_RESOLUTION = 128;
+
 void addSampleScene(Scene &s) {
-  Metal *mwhite = new Metal(Point(0.9, 0.9, 0.9), 0.5);
-  Metal *mirror = new Metal(Point(0.9, 0.9, 0.9), 0.0);
-  // Lambertian *lwhite = new Lambertian(Point(0.9, 0.9, 0.9));
-  Lambertian *lchecker = new Lambertian(
-      new CheckerTexture(Point(0.9, 0.9, 0.9), Point(0.7, 0, 0.7)));
-  Metal *mgold = new Metal(Point(0.9, 0.9, 0.6), 0.2);
-  Lambertian *lred = new Lambertian(Point(0.9, 0.0, 0.0));
-  Lambertian *lblue = new Lambertian(Point(0.0, 0.0, 0.9));
-  Dielectrics *glass = new Dielectrics(1.3);
-  Lambertian *perlin = new Lambertian(new PerlinTexture(5));
-
-  // Load image at specified path
+  Metal *mwhite = s.make<Metal>(Point(0.9, 0.9, 0.9), 0.5);
+  Metal *mirror = s.make<Metal>(Point(0.9, 0.9, 0.9), 0.0);
+  // Lambertian *lwhite = s.make<Lambertian>(Point(0.9, 0.9, 0.9));
+  // Procedural textures are built as graphs and compiled into programs
+  TextureGraph graph;
+  const int checker = graph.checker(graph.constant(Point(0.9, 0.9, 0.9)),
+                                    graph.constant(Point(0.7, 0, 0.7)));
+  Lambertian *lchecker =
+      s.make<Lambertian>(s.make<TextureProgram>(graph.compile(checker)));
+  Metal *mgold = s.make<Metal>(Point(0.9, 0.9, 0.6), 0.2);
+  Lambertian *lred = s.make<Lambertian>(Point(0.9, 0.0, 0.0));
+  Lambertian *lblue = s.make<Lambertian>(Point(0.0, 0.0, 0.9));
+  Dielectrics *glass = s.make<Dielectrics>(1.3);
+  // Baked over the box of each object it is on, if the scene bakes
+  const Texture *noise =
+      s.make<TextureProgram>(graph.compile(graph.noise(5)));
+  Lambertian *perlin = s.make<Lambertian>(
+      s.bake(noise, aabb(Point(-1, 13, -33), Point(5, 19, -27))));
+  Lambertian *perlinCube = s.make<Lambertian>(
+      s.bake(noise, aabb(Point(-5, 0, -22), Point(-3, 2, -20))));
+
+  // Load image at specified path. Whatever its format, it is converted to RGB
+  // and handed to the scene's texture cache, so the surface can be freed
+  // straight away.
+  int image = -1;
   SDL_Surface *loadedSurface = IMG_Load("earthmap.jpg");
   if (loadedSurface == NULL) {
     printf("Unable to load image! SDL_image Error: %s\n", IMG_GetError());
+  } else {
+    SDL_Surface *rgb =
+        SDL_ConvertSurfaceFormat(loadedSurface, SDL_PIXELFORMAT_RGB24, 0);
+    if (rgb == NULL) {
+      printf("Unable to convert image! SDL Error: %s\n", SDL_GetError());
+    } else {
+      image = s.textureCache.addImage((unsigned char *)rgb->pixels, rgb->w,
+                                      rgb->h, rgb->pitch);
+      SDL_FreeSurface(rgb);
+    }
+    SDL_FreeSurface(loadedSurface);
   }
-
   Lambertian *earth =
-      new Lambertian(new ImageTexture(((unsigned char *)loadedSurface->pixels),
-                                      loadedSurface->w, loadedSurface->h));
-  Hittable *earthSphere2 = new Sphere(1, Point(1, 2, -10), earth);
-  Hittable *earthSphere = new Sphere(2, Point(-10, 4, -40), glass);
-  Hittable *metallicSphere = new Sphere(3, Point(-18, 6, -40), mwhite);
-  Hittable *mirrorSphere = new Sphere(4, Point(-8, 18, -70), mirror);
-  Hittable *glassSphere = new Sphere(5, Point(28, 10, -80), glass);
-  Hittable *glassSphere2 = new Sphere(6, Point(-0, 12, -80), glass);
-  Hittable *redSphere = new Sphere(7, Point(-30, 14, -60), lred);
-  Hittable *blueSphere = new Sphere(8, Point(32, 16, -90), lblue);
-  Hittable *goldSphere = new Sphere(9, Point(22, 18, -50), mgold);
-  Hittable *ground = new Sphere(1100, Point(0, -1100.5, 0), lchecker);
-  Hittable *perlinSphere = new Sphere(3, Point(2, 16, -30), perlin);
-  Hittable *emitterSphere =
-      new Sphere(3, Point(2, 8, -20), new Emissive(Point(255, 255, 255)));
-
-  Hittable *cube = new Box(Point(-5, 0, -20), Point(-3, 2, -22), perlin);
-  // cube = new Rotation(cube, Point(15, 0, 0));
-  // cube = new Translate(cube, Vec(-5, 5, -25));
+      s.make<Lambertian>(s.make<ImageTexture>(&s.textureCache, image));
+  Hittable *earthSphere2 = s.make<Sphere>(1, Point(1, 2, -10), earth);
+  Hittable *earthSphere = s.make<Sphere>(2, Point(-10, 4, -40), glass);
+  Hittable *metallicSphere = s.make<Sphere>(3, Point(-18, 6, -40), mwhite);
+  Hittable *mirrorSphere = s.make<Sphere>(4, Point(-8, 18, -70), mirror);
+  Hittable *glassSphere = s.make<Sphere>(5, Point(28, 10, -80), glass);
+  Hittable *glassSphere2 = s.make<Sphere>(6, Point(-0, 12, -80), glass);
+  Hittable *redSphere = s.make<Sphere>(7, Point(-30, 14, -60), lred);
+  Hittable *blueSphere = s.make<Sphere>(8, Point(32, 16, -90), lblue);
+  Hittable *goldSphere = s.make<Sphere>(9, Point(22, 18, -50), mgold);
+  Hittable *ground = s.make<Sphere>(1100, Point(0, -1100.5, 0), lchecker);
+  Hittable *perlinSphere = s.make<Sphere>(3, Point(2, 16, -30), perlin);
+  Hittable *emitterSphere = s.make<Sphere>(
+      3, Point(2, 8, -20), s.make<Emissive>(Point(1, 1, 1)));
+
+  Hittable *cube =
+      s.make<Box>(Point(-5, 0, -20), Point(-3, 2, -22), perlinCube);
+  // cube = s.make<Rotation>(cube, Point(15, 0, 0));
+  // cube = s.make<Translate>(cube, Vec(-5, 5, -25));
 
   s.addObject(cube);
   s.addObject(earthSphere);
@@ -103,21 +149,22 @@ void addSampleScene(Scene &s) {
 }
 
 void addDebugScene(Scene &s) {
-  Lambertian *green = new Lambertian(Point(.12, .45, .15));
-  Lambertian *red = new Lambertian(Point(.65, .05, .05));
-  Lambertian *white = new Lambertian(Point(1, 1, 1));
+  Lambertian *green = s.make<Lambertian>(Point(.12, .45, .15));
+  Lambertian *red = s.make<Lambertian>(Point(.65, .05, .05));
+  Lambertian *white = s.make<Lambertian>(Point(1, 1, 1));
 
-  Emissive *emission = new Emissive(Point(500, 500, 500));
+  Emissive *emission = s.make<Emissive>(Point(2, 2, 2));
 
-  Hittable *floor = new XZRectangle(-100, 100, -100, 100, -0.5, white, 0);
-  Hittable *sphere = new Sphere(1, Point(1, 0.5, -5), green);
-  Hittable *cube = new Box(Point(-1, -0.5, -6), Point(-0.5, 0, -5.5), red);
+  Hittable *floor = s.make<XZRectangle>(-100, 100, -100, 100, -0.5, white, 0);
+  Hittable *sphere = s.make<Sphere>(1, Point(1, 0.5, -5), green);
+  Hittable *cube =
+      s.make<Box>(Point(-1, -0.5, -6), Point(-0.5, 0, -5.5), red);
 
-  cube = new Rotation(cube, Point(45, 0, 0));
-  // cube = new Translate(cube, Vec(-1, 1, 1));
-  cube = new Move(cube, Point(-1, 1, -6));
+  cube = s.make<Rotation>(cube, Point(45, 0, 0));
+  // cube = s.make<Translate>(cube, Vec(-1, 1, 1));
+  cube = s.make<Move>(cube, Point(-1, 1, -6));
 
-  Hittable *light = new XZRectangle(-50, 50, -50, 50, 50, emission, 0);
+  Hittable *light = s.make<XZRectangle>(-50, 50, -50, 50, 50, emission, 0);
   s.addObject(floor);
   s.addObject(light);
   s.addObject(sphere);
@@ -125,47 +172,49 @@ void addDebugScene(Scene &s) {
 }
 
 void addCornellBox(Scene &s) {
-  Lambertian *green = new Lambertian(Point(.12, .45, .15));
-  Lambertian *red = new Lambertian(Point(.65, .05, .05));
-  Lambertian *white = new Lambertian(Point(.73, .73, .73));
-  Emissive *light = new Emissive(Point(7500, 7500, 7500));
-  Emissive *lightbig = new Emissive(Point(2500, 2500, 2500));
-  // Dielectrics *glass = new Dielectrics(1.3);
+  Lambertian *green = s.make<Lambertian>(Point(.12, .45, .15));
+  Lambertian *red = s.make<Lambertian>(Point(.65, .05, .05));
+  Lambertian *white = s.make<Lambertian>(Point(.73, .73, .73));
+  Emissive *light = s.make<Emissive>(Point(30, 30, 30));
+  Emissive *lightbig = s.make<Emissive>(Point(10, 10, 10));
+  // Dielectrics *glass = s.make<Dielectrics>(1.3);
 
   // Left wall
-  Hittable *rect1 = new YZRectangle(0, 555, -555, 0, 555, green, 1);
+  Hittable *rect1 = s.make<YZRectangle>(0, 555, -555, 0, 555, green, 1);
   // Right wall
-  Hittable *rect2 = new YZRectangle(0, 555, -555, 0, 0, red, 0);
+  Hittable *rect2 = s.make<YZRectangle>(0, 555, -555, 0, 0, red, 0);
   // Lights
-  Hittable *rect3 = new XZRectangle(213, 343, -332, -227, 554, light, 1);
-  // Hittable *rect3 = new XZRectangle(113, 443, -432, -127, 554, lightbig, 1);
+  Hittable *rect3 = s.make<XZRectangle>(213, 343, -332, -227, 554, light, 1);
+  // Hittable *rect3 =
+  //     s.make<XZRectangle>(113, 443, -432, -127, 554, lightbig, 1);
   s.setLight(rect3);
   // Bottom wall (floor)
-  Hittable *rect4 = new XZRectangle(0, 555, -555, 0, 0, white, 0);
+  Hittable *rect4 = s.make<XZRectangle>(0, 555, -555, 0, 0, white, 0);
   // Top wall
-  Hittable *rect5 = new XZRectangle(0, 555, -555, 0, 555, white, 1);
+  Hittable *rect5 = s.make<XZRectangle>(0, 555, -555, 0, 555, white, 1);
   // Front wall
-  Hittable *rect6 = new XYRectangle(0, 555, 0, 555, -555, white, 0);
+  Hittable *rect6 = s.make<XYRectangle>(0, 555, 0, 555, -555, white, 0);
 
-  // Hittable *fogBoundary = new Box(Point(0, 0, -555), Point(555, 555, 0),
-  // white); Point fogCol = Point(1, 1, 1); Hittable *fog = new
-  // ConstantMedium(fogBoundary, 0.001, fogCol);
+  // Hittable *fogBoundary = s.make<Box>(Point(0, 0, -555), Point(555, 555, 0),
+  // white); Point fogCol = Point(1, 1, 1); Hittable *fog =
+  // s.make<ConstantMedium>(fogBoundary, 0.001, fogCol);
 
-  // Hittable *testRect = new XYRectangle(0, 165, 0, 330, 0, white, 0);
-  // testRect = new Rotation(testRect, Point(-15, 0, 0));
-  // testRect = new Translate(testRect, Vec(265, 0, -295));
+  // Hittable *testRect = s.make<XYRectangle>(0, 165, 0, 330, 0, white, 0);
+  // testRect = s.make<Rotation>(testRect, Point(-15, 0, 0));
+  // testRect = s.make<Translate>(testRect, Vec(265, 0, -295));
 
   // no rotation
-  // Hittable *box1 = new Box(Point(130, 0, -230), Point(295, 165, -65), white);
-  // Hittable *box2 = new Box(Point(265, 0, -460), Point(430, 330, -295),
+  // Hittable *box1 =
+  //     s.make<Box>(Point(130, 0, -230), Point(295, 165, -65), white);
+  // Hittable *box2 = s.make<Box>(Point(265, 0, -460), Point(430, 330, -295),
   // white);
   //
-  Box *box1 = new Box(Point(0, 0, -165), Point(165, 330, 0), white);
-  Rotation *rbox = new Rotation(box1, Point(-15, 0, 0));
-  Translate *tbox = new Translate(rbox, Vec(265, 0, -295));
-  Hittable *box2 = new Box(Point(0, 0, -165), Point(165, 165, 0), white);
-  box2 = new Rotation(box2, Point(18, 0, 0));
-  box2 = new Translate(box2, Vec(130, 0, -65));
+  Box *box1 = s.make<Box>(Point(0, 0, -165), Point(165, 330, 0), white);
+  Rotation *rbox = s.make<Rotation>(box1, Point(-15, 0, 0));
+  Translate *tbox = s.make<Translate>(rbox, Vec(265, 0, -295));
+  Hittable *box2 = s.make<Box>(Point(0, 0, -165), Point(165, 165, 0), white);
+  box2 = s.make<Rotation>(box2, Point(18, 0, 0));
+  box2 = s.make<Translate>(box2, Vec(130, 0, -65));
 
   s.addObject(rect1);
   s.addObject(rect2);
@@ -180,7 +229,737 @@ void addCornellBox(Scene &s) {
   // s.addObject(fog);
 }
 
+// The Cornell box filled with fog that thins out towards the ceiling
+void addCornellFog(Scene &s) {
+  addCornellBox(s);
+
+  const int n = 16;
+  std::vector<float> values(n * n * n);
+  for (int z = 0; z < n; z++)
+    for (int y = 0; y < n; y++)
+      for (int x = 0; x < n; x++)
+        values[(z * n + y) * n + x] = std::exp(-3.0f * y / (n - 1));
+  const DensityField *fog = s.make<GridDensity>(
+      aabb(Point(0, 0, -555), Point(555, 555, 0)), n, n, n, values);
+  s.addObject(s.make<HeterogeneousMedium>(fog, 0.004, Point(1, 1, 1)));
+}
+
+// The Cornell box with a cloud of smoke hanging under the light
+void addCornellSmoke(Scene &s) {
+  addCornellBox(s);
+
+  const DensityField *smoke = s.make<NoiseDensity>(
+      aabb(Point(130, 250, -430), Point(430, 550, -130)), 0.015f, 0.3f);
+  s.addObject(s.make<HeterogeneousMedium>(smoke, 0.03, Point(0.8, 0.8, 0.8)));
+}
+
+// The Cornell box with a ball rolling across the floor and a box that drops
+// and slides during the shutter
+void addCornellMotion(Scene &s) {
+  addCornellBox(s);
+  s.shutterOpen = 0;
+  s.shutterClose = 1;
+
+  Metal *steel = s.make<Metal>(Point(.8, .8, .85), 0.1);
+  s.addObject(s.make<MovingSphere>(60, Point(120, 60, -400),
+                                   Point(220, 60, -400), 0.0, 1.0, steel));
+
+  Lambertian *blue = s.make<Lambertian>(Point(.2, .3, .7));
+  Hittable *box = s.make<Box>(Point(380, 0, -200), Point(460, 80, -120), blue);
+  std::vector<Keyframe> path = {{0.0, Vec(0, 150, 0)},
+                                {0.5, Vec(0, 0, 0)},
+                                {1.0, Vec(-60, 0, 0)}};
+  s.addObject(s.make<KeyframedTransform>(box, path));
+}
+
+// Restarts the preview where an edit shows up directly: the pixels box
+// covers, or the whole image if that can't be told
+static void resetAround(Scene &s, const aabb &box) {
+  int x0, y0, x1, y1;
+  if (s.screenBounds(box, x0, y0, x1, y1))
+    s.resetRegion(x0, y0, x1, y1);
+  else
+    s.resetAccumulation();
+}
+
+// A material picked in the Scene tab. It is only made, in the scene's arena,
+// by the edit that uses it, so clearing the scene can't free it first.
+struct MaterialChoice {
+  // Metal, diffuse or dielectric, as in the tab's list
+  int type;
+  Point colour;
+  float fuzz;
+};
+
+static Materials *makeMaterial(Scene &s, const MaterialChoice &choice) {
+  switch (choice.type) {
+  case 0:
+    return s.make<Metal>(choice.colour, choice.fuzz);
+  case 1:
+    return s.make<Lambertian>(choice.colour);
+  default:
+    return s.make<Dielectrics>(1);
+  }
+}
+
+// Moves the sphere at index, if it is still there, resizes it and gives it
+// a new material if material is set
+static void editSphere(Scene &s, int index, Sphere *sphere,
+                       const Point &location, int rad,
+                       const MaterialChoice *material) {
+  const std::vector<Hittable *> objects = s.getObjects();
+  if (index >= (int)objects.size() || objects[index] != sphere)
+    return;
+  aabb before, after;
+  sphere->boundingBox(0, 0, before);
+  sphere->location = location;
+  sphere->rad = rad;
+  if (material != nullptr)
+    sphere->material = makeMaterial(s, *material);
+  sphere->boundingBox(0, 0, after);
+  s.updateObject(sphere);
+  resetAround(s, surroundingBox(before, after));
+}
+
+// Removes o, if it is still the object at index
+static void removeAt(Scene &s, int index, Hittable *o) {
+  const std::vector<Hittable *> objects = s.getObjects();
+  if (index >= (int)objects.size() || objects[index] != o)
+    return;
+  aabb box;
+  const bool bounded = o->boundingBox(0, 0, box);
+  s.removeObject(index);
+  if (bounded)
+    resetAround(s, box);
+  else
+    s.resetAccumulation();
+}
+
+// Adds a whole scene and starts accumulating again
+static void addScene(RenderService &service, void (*add)(Scene &)) {
+  service.edit([add](Scene &s) {
+    add(s);
+    s.resetAccumulation();
+  });
+}
+
+// Keeps a render: output.bmp as it is shown, output.exr with its radiance
+static void saveOutput(const Scene &s) {
+  FrameDisplay::save(s, "output.bmp");
+  writeEXR(s, "output.exr");
+}
+
+static const char *objectName(const Hittable *o) {
+  switch (primitiveType(o)) {
+  case PRIM_SPHERE:
+    return "Sphere";
+  case PRIM_XY_RECT:
+  case PRIM_XZ_RECT:
+  case PRIM_YZ_RECT:
+    return "Rectangle";
+  case PRIM_BOX:
+    return "Box";
+  case PRIM_TRIANGLE:
+    return "Triangle";
+  default:
+    return o->participating() ? "Medium" : "Object";
+  }
+}
+
+// Renders the sample scene (three glass spheres) with 1, 2, 4... threads up to
+// the number of cores and prints the speedup over one thread. Every path is
+// seeded from its pixel, so each run has to give exactly the same image.
+// With bake its procedural textures are baked.
+int runScalingBenchmark(int samples, bool bake) {
+  const int size = screenWidth * screenHeight * 3;
+  double *raw = new double[size];
+  double *reference = new double[size];
+
+  Scene s(screenWidth, screenHeight,
+          PinholeCamera(screenWidth, screenHeight, 90.0f, Point(0, 0, 0),
+                        Point(0, 0, -1)),
+          Point(0.7, 0.8, 1), raw);
+  s.bakeResolution = bake ? BAKE_RESOLUTION : 0;
+  addSampleScene(s);
+  s.samples = samples;
+  s.bounces = 8;
+  s.createBVHBox();
+
+  const int maxThreads = omp_get_max_threads();
+  double singleTime = 0;
+  printf("%dx%d, %d samples per pixel\n", screenWidth, screenHeight,
+         samples);
+  printf("threads     time  speedup  efficiency  image\n");
+  for (int threads = 1;; threads *= 2) {
+    if (threads > maxThreads)
+      threads = maxThreads;
+    omp_set_num_threads(threads);
+    memset(raw, 0, size * sizeof(double));
+    s.passIndex = 0;
+
+    const auto start = std::chrono::steady_clock::now();
+    s.render();
+    const double seconds = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+
+    bool same = true;
+    if (threads == 1) {
+      singleTime = seconds;
+      memcpy(reference, raw, size * sizeof(double));
+    } else {
+      same = memcmp(reference, raw, size * sizeof(double)) == 0;
+    }
+    printf("%7d %7.3fs %7.2fx %10.0f%%  %s\n", threads, seconds,
+           singleTime / seconds, 100 * singleTime / (seconds * threads),
+           same ? "identical" : "DIFFERENT");
+    if (threads == maxThreads)
+      break;
+  }
+
+  s.deleteScene();
+  delete[] raw;
+  delete[] reference;
+  return 0;
+}
+
+// Renders the moving Cornell box as frames prefix0000.bmp onwards, while the
+// camera pans across the box. The motion of the scene spans the whole
+// sequence, and the BVH is refit between frames.
+int runAnimation(int frames, int passes, const char *prefix) {
+  const int size = screenWidth * screenHeight * 3;
+  double *raw = new double[size];
+
+  Scene s(screenWidth, screenHeight,
+          PinholeCamera(screenWidth, screenHeight, 90.0f,
+                        Point(278, 278, 800), Point(278, 278, 0)),
+          Point(0, 0, 0), raw);
+  addCornellMotion(s);
+  s.samples = 4;
+
+  Animation animation;
+  animation.frameLength = 1.0 / frames;
+  animation.shutter = 0.5;
+  animation.addCameraKey(0, Point(178, 278, 800), Point(278, 278, 0));
+  animation.addCameraKey(1, Point(378, 278, 800), Point(278, 278, 0));
+  const bool saved = animation.render(s, 0, frames - 1, passes, prefix);
+
+  s.deleteScene();
+  delete[] raw;
+  return saved ? 0 : 1;
+}
+
+// Set by SIGTERM and SIGINT, so a render that is stopped can checkpoint first
+static volatile std::sig_atomic_t stopRequested = 0;
+
+static void requestStop(int) { stopRequested = 1; }
+
+// The options of --render, --distribute and --worker that change what is
+// rendered
+struct FrameOptions {
+  unsigned int aovs = 0;
+  FilmSettings film;
+  // A .jtvol volume added to the Cornell box as a medium, if not empty,
+  // where its file places it. Its densities are multiplied by
+  // volumeDensity.
+  std::string volume;
+  float volumeDensity = 1;
+};
+
+// Reads the options above from argv[first] on into options, and the rest
+// into args. --filter-radius defaults to the filter's usual radius. Returns
+// false on a bad option.
+static bool parseFrameOptions(int argc, char **argv, int first,
+                              FrameOptions &options,
+                              std::vector<const char *> &args) {
+  float radius = 0;
+  for (int i = first; i < argc; i++) {
+    if (strcmp(argv[i], "--aovs") == 0 && i + 1 < argc) {
+      std::string list = argv[++i];
+      for (size_t start = 0; start <= list.size();) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos)
+          end = list.size();
+        const std::string name = list.substr(start, end - start);
+        const AovPass pass = aovFromName(name.c_str());
+        if (pass == AOV_COUNT) {
+          printf("Unknown AOV %s\n", name.c_str());
+          return false;
+        }
+        options.aovs |= aovBit(pass);
+        start = end + 1;
+      }
+    } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      options.film.filter = filterFromName(argv[++i]);
+      if (options.film.filter == FILTER_COUNT) {
+        printf("Unknown filter %s\n", argv[i]);
+        return false;
+      }
+    } else if (strcmp(argv[i], "--filter-radius") == 0 && i + 1 < argc) {
+      radius = atof(argv[++i]);
+      if (radius <= 0) {
+        printf("Filter radius %s is not positive\n", argv[i]);
+        return false;
+      }
+    } else if (strcmp(argv[i], "--splat") == 0) {
+      options.film.splat = true;
+    } else if (strcmp(argv[i], "--volume") == 0 && i + 1 < argc) {
+      options.volume = argv[++i];
+    } else if (strcmp(argv[i], "--volume-density") == 0 && i + 1 < argc) {
+      options.volumeDensity = atof(argv[++i]);
+      if (options.volumeDensity <= 0) {
+        printf("Volume density %s is not positive\n", argv[i]);
+        return false;
+      }
+    } else {
+      args.push_back(argv[i]);
+    }
+  }
+  options.film.radius =
+      radius > 0 ? radius : defaultFilterRadius(options.film.filter);
+  return true;
+}
+
+// options as arguments parseFrameOptions() reads back exactly
+static std::vector<std::string> frameArguments(const FrameOptions &options) {
+  std::vector<std::string> args;
+  std::string aovs;
+  for (int p = 0; p < AOV_COUNT; p++)
+    if (options.aovs & aovBit((AovPass)p))
+      aovs += (aovs.empty() ? "" : ",") + std::string(aovName((AovPass)p));
+  if (!aovs.empty()) {
+    args.push_back("--aovs");
+    args.push_back(aovs);
+  }
+  char radius[32];
+  snprintf(radius, sizeof(radius), "%.9g", options.film.radius);
+  args.push_back("--filter");
+  args.push_back(filterName(options.film.filter));
+  args.push_back("--filter-radius");
+  args.push_back(radius);
+  if (options.film.splat)
+    args.push_back("--splat");
+  if (!options.volume.empty()) {
+    char density[32];
+    snprintf(density, sizeof(density), "%.9g", options.volumeDensity);
+    args.push_back("--volume");
+    args.push_back(options.volume);
+    args.push_back("--volume-density");
+    args.push_back(density);
+  }
+  return args;
+}
+
+// The frame rendered by --render, --distribute and --worker. Every process
+// has to build exactly the same one, with the same options. Returns null if
+// the volume of options can't be loaded.
+static Scene *makeFinalFrame(double *raw,
+                             const FrameOptions &options = FrameOptions()) {
+  Scene *s = new Scene(screenWidth, screenHeight,
+                       PinholeCamera(screenWidth, screenHeight, 90.0f,
+                                     Point(278, 278, 800), Point(278, 278, 0)),
+                       Point(0, 0, 0), raw);
+  addCornellBox(*s);
+  if (!options.volume.empty()) {
+    SparseVolume *volume = s->make<SparseVolume>();
+    if (!volume->load(options.volume.c_str())) {
+      s->deleteScene();
+      delete s;
+      return nullptr;
+    }
+    s->addObject(s->make<HeterogeneousMedium>(volume, options.volumeDensity,
+                                              Point(0.8, 0.8, 0.8)));
+  }
+  s->samples = 4;
+  s->aovs = options.aovs;
+  s->film = options.film;
+  s->createBVHBox();
+  s->resetAccumulation();
+  return s;
+}
+
+static bool saveFinalFrame(const Scene &s, const char *name) {
+  const std::string exr = std::string(name) + ".exr";
+  const std::string bmp = std::string(name) + ".bmp";
+  return writeEXR(s, exr.c_str()) && FrameDisplay::save(s, bmp.c_str());
+}
+
+// Renders the Cornell box for passes passes into name.exr and name.bmp.
+// After a pass it checkpoints to name.ckpt if interval seconds have gone by
+// since the last checkpoint, or if it was asked to stop, which it then does.
+// With resume it carries on from name.ckpt, giving the same image as a render
+// that never stopped; a finished checkpoint can be resumed with more passes.
+// It fails without rendering if name.ckpt can't be resumed.
+// The AOV passes of options are written to name.exr too. Checkpoints don't
+// hold them, so after a resume they only average the passes since.
+int runRender(int passes, const char *name, double interval, bool resume,
+              const FrameOptions &options) {
+  double *raw = new double[screenWidth * screenHeight * 3]();
+  std::unique_ptr<Scene> frame(makeFinalFrame(raw, options));
+  if (!frame) {
+    delete[] raw;
+    return 1;
+  }
+  Scene &s = *frame;
+
+  const std::string checkpoint = std::string(name) + ".ckpt";
+  // Starting over would overwrite the checkpoint that was to be resumed
+  if (resume) {
+    if (!s.loadCheckpoint(checkpoint.c_str())) {
+      printf("Not resuming, %s is left as it is\n", checkpoint.c_str());
+      frame.reset();
+      delete[] raw;
+      return 1;
+    }
+    printf("Resuming after pass %u\n", s.passIndex);
+  }
+
+  signal(SIGTERM, requestStop);
+  signal(SIGINT, requestStop);
+  auto lastCheckpoint = std::chrono::steady_clock::now();
+  while ((int)s.passIndex < passes) {
+    s.render();
+    const auto now = std::chrono::steady_clock::now();
+    const bool due = interval > 0 &&
+                     std::chrono::duration<double>(now - lastCheckpoint)
+                             .count() >= interval;
+    if (due || stopRequested) {
+      if (s.saveCheckpoint(checkpoint.c_str()))
+        printf("Checkpoint after pass %u\n", s.passIndex);
+      lastCheckpoint = now;
+    }
+    if (stopRequested) {
+      frame.reset();
+      delete[] raw;
+      return 1;
+    }
+  }
+
+  const bool saved =
+      s.saveCheckpoint(checkpoint.c_str()) && saveFinalFrame(s, name);
+  frame.reset();
+  delete[] raw;
+  return saved ? 0 : 1;
+}
+
+// Renders the same frame as --render with workers processes of this program,
+// each rendering every workers-th pass on its share of the cores
+int runDistributed(int workers, int passes, const char *name,
+                   const FrameOptions &options) {
+  double *raw = new double[screenWidth * screenHeight * 3]();
+  std::unique_ptr<Scene> frame(makeFinalFrame(raw, options));
+  if (!frame) {
+    delete[] raw;
+    return 1;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::string> command = {"/proc/self/exe", "--worker",
+                                      std::to_string(passes)};
+  for (const std::string &arg : frameArguments(options))
+    command.push_back(arg);
+  bool saved = renderWithWorkers(*frame, command, workers);
+  printf("%d passes with %d workers in %.3fs\n", passes, workers,
+         std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+             .count());
+  saved = saved && saveFinalFrame(*frame, name);
+  frame.reset();
+  delete[] raw;
+  return saved ? 0 : 1;
+}
+
+// One of the workers of --distribute: renders its share of the passes and
+// writes it to standard output
+int runWorker(int passes, int worker, int workers,
+              const FrameOptions &options) {
+  // Anything printed goes to standard error, clear of the image
+  const int out = dup(STDOUT_FILENO);
+  dup2(STDERR_FILENO, STDOUT_FILENO);
+  omp_set_num_threads(std::max(1, omp_get_num_procs() / workers));
+
+  double *raw = new double[screenWidth * screenHeight * 3]();
+  std::unique_ptr<Scene> frame(makeFinalFrame(raw, options));
+  if (!frame) {
+    close(out);
+    delete[] raw;
+    return 1;
+  }
+  const int last = renderShare(*frame, worker, workers, passes);
+  const bool sent = writePartial(out, *frame, last);
+  close(out);
+  frame.reset();
+  delete[] raw;
+  return sent ? 0 : 1;
+}
+
+// Converts a dense grid of raw 32 bit floats (x varying fastest) into a
+// sparse .jtvol volume, keeping the values above threshold
+int runVoxelize(const char *in, int nx, int ny, int nz, const char *out,
+                float threshold, float voxelSize) {
+  if (nx <= 0 || ny <= 0 || nz <= 0 || voxelSize <= 0) {
+    printf("Invalid grid size\n");
+    return 1;
+  }
+  FILE *f = fopen(in, "rb");
+  if (f == nullptr) {
+    printf("Unable to open %s\n", in);
+    return 1;
+  }
+  std::vector<float> values((size_t)nx * ny * nz);
+  const size_t read = fread(values.data(), sizeof(float), values.size(), f);
+  fclose(f);
+  if (read != values.size()) {
+    printf("%s holds %zu values, expected %zu\n", in, read, values.size());
+    return 1;
+  }
+
+  SparseVolume volume(Point(0, 0, 0), voxelSize);
+  if (!volume.fromDense(values.data(), nx, ny, nz, threshold))
+    return 1;
+  printf("%zu of %zu voxels active in %zu leaves, %zu bytes (dense %zu)\n",
+         volume.activeVoxels(), values.size(), volume.leafCount(),
+         volume.bytes(), values.size() * sizeof(float));
+  return volume.save(out) ? 0 : 1;
+}
+
+// Compares a render with a reference, both .pfm or .exr: the root mean square
+// difference, the mean squared difference relative to the reference and the
+// largest difference over every channel
+int runCompare(const char *test, const char *reference) {
+  HdrImage a, b;
+  if (!readHDR(test, a) || !readHDR(reference, b))
+    return 1;
+  if (a.width != b.width || a.height != b.height) {
+    printf("%s is %dx%d but %s is %dx%d\n", test, a.width, a.height,
+           reference, b.width, b.height);
+    return 1;
+  }
+  double squared = 0, relative = 0, largest = 0;
+  for (size_t i = 0; i < a.rgb.size(); i++) {
+    const double d = a.rgb[i] - b.rgb[i];
+    squared += d * d;
+    relative += d * d / (b.rgb[i] * b.rgb[i] + 0.01);
+    largest = std::fmax(largest, std::fabs(d));
+  }
+  const double n = a.rgb.size();
+  printf("RMSE %g, relMSE %g, largest difference %g\n", std::sqrt(squared / n),
+         relative / n, largest);
+  return 0;
+}
+
+// The mean radiance of every pixel of sums, as s counts their samples
+static std::vector<float> meanRadiance(const Scene &s, const double *sums) {
+  std::vector<float> rgb(s.pixelSamples.size() * 3, 0.0f);
+  for (size_t i = 0; i < s.pixelSamples.size(); i++)
+    for (int c = 0; c < 3; c++)
+      if (s.pixelSamples[i] > 0)
+        rgb[i * 3 + c] = sums[i * 3 + c] / s.pixelSamples[i];
+  return rgb;
+}
+
+// The root mean square difference between two images, as they are or
+// clamped to white the way an 8 bit image shows them
+static double rootMeanSquare(const std::vector<float> &a,
+                             const std::vector<float> &b, bool clamped) {
+  double squared = 0;
+  for (size_t i = 0; i < a.size(); i++) {
+    const double d = clamped ? std::fmin(a[i], 1.0f) - std::fmin(b[i], 1.0f)
+                             : a[i] - b[i];
+    squared += d * d;
+  }
+  return std::sqrt(squared / a.size());
+}
+
+// Renders the frame of --render for passes passes with the denoiser's
+// features, and prints how long the denoiser takes on it and how much closer
+// it brings the image to a reference: reference, a .pfm or .exr of the same
+// frame such as --render writes, or else a render of 64 times as many passes.
+// Writes the result to denoised.exr and denoised.bmp.
+int runDenoise(int passes, const char *reference) {
+  const size_t count = (size_t)screenWidth * screenHeight;
+  std::vector<float> expected;
+  if (reference != nullptr) {
+    HdrImage image;
+    if (!readHDR(reference, image))
+      return 1;
+    if (image.width != screenWidth || image.height != screenHeight) {
+      printf("%s is %dx%d, not %dx%d\n", reference, image.width,
+             image.height, screenWidth, screenHeight);
+      return 1;
+    }
+    expected.swap(image.rgb);
+  } else {
+    double *raw = new double[count * 3]();
+    std::unique_ptr<Scene> converged(makeFinalFrame(raw));
+    // Samples of their own: with the same seed its first passes would be
+    // those of the image measured against it
+    converged->seed = 0x9e3779b9u;
+    for (int i = 0; i < passes * 64; i++)
+      converged->render();
+    expected = meanRadiance(*converged, raw);
+    converged.reset();
+    delete[] raw;
+  }
+
+  double *raw = new double[count * 3]();
+  std::unique_ptr<Scene> frame(makeFinalFrame(raw));
+  Scene &s = *frame;
+  s.features = true;
+  for (int i = 0; i < passes; i++)
+    s.render();
+
+  DenoiseSettings settings;
+  settings.enabled = true;
+  Denoiser denoiser;
+  // The first run allocates
+  denoiser.run(s, settings);
+  const int runs = 10;
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < runs; i++)
+    denoiser.run(s, settings);
+  const double ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start)
+                        .count() /
+                    runs;
+
+  const std::vector<float> noisy = meanRadiance(s, raw);
+  const std::vector<float> denoised = meanRadiance(s, denoiser.sums.data());
+  printf("%d samples per pixel, denoised in %.2f ms on %d threads\n",
+         passes * s.samples, ms, omp_get_max_threads());
+  printf("RMSE %g -> %g, clamped to white %g -> %g\n",
+         rootMeanSquare(noisy, expected, false),
+         rootMeanSquare(denoised, expected, false),
+         rootMeanSquare(noisy, expected, true),
+         rootMeanSquare(denoised, expected, true));
+
+  std::copy(denoiser.sums.begin(), denoiser.sums.end(), raw);
+  const bool saved = saveFinalFrame(s, "denoised");
+  frame.reset();
+  delete[] raw;
+  return saved ? 0 : 1;
+}
+
 int main(int argc, char **argv) {
+  // joetracer --bench [samples] [--bake]: thread scaling benchmark, no
+  // window
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+    IMG_Init(IMG_INIT_JPG);
+    bool bake = false;
+    std::vector<const char *> args;
+    for (int i = 2; i < argc; i++) {
+      if (strcmp(argv[i], "--bake") == 0)
+        bake = true;
+      else
+        args.push_back(argv[i]);
+    }
+    const int samples = args.size() > 0 ? atoi(args[0]) : 16;
+    const int result = runScalingBenchmark(samples > 0 ? samples : 16, bake);
+    IMG_Quit();
+    return result;
+  }
+
+  // joetracer --animate [frames] [passes] [prefix]: image sequence, no window
+  if (argc > 1 && strcmp(argv[1], "--animate") == 0) {
+    IMG_Init(IMG_INIT_JPG);
+    const int frames = argc > 2 ? atoi(argv[2]) : 24;
+    const int passes = argc > 3 ? atoi(argv[3]) : 1;
+    const int result = runAnimation(frames > 0 ? frames : 24,
+                                    passes > 0 ? passes : 1,
+                                    argc > 4 ? argv[4] : "frame");
+    IMG_Quit();
+    return result;
+  }
+
+  // joetracer --render [passes] [name] [checkpoint seconds] [--resume]
+  // [--aovs pass,pass...] [--filter name] [--filter-radius pixels] [--splat]
+  // [--volume file.jtvol] [--volume-density scale]: a long render, no window
+  if (argc > 1 && strcmp(argv[1], "--render") == 0) {
+    FrameOptions options;
+    std::vector<const char *> all, args;
+    if (!parseFrameOptions(argc, argv, 2, options, all))
+      return 1;
+    bool resume = false;
+    for (const char *arg : all) {
+      if (strcmp(arg, "--resume") == 0)
+        resume = true;
+      else
+        args.push_back(arg);
+    }
+    IMG_Init(IMG_INIT_JPG);
+    const int passes = args.size() > 0 ? atoi(args[0]) : 64;
+    const int result =
+        runRender(passes > 0 ? passes : 64, args.size() > 1 ? args[1] : "render",
+                  args.size() > 2 ? atof(args[2]) : 600, resume, options);
+    IMG_Quit();
+    return result;
+  }
+
+  // joetracer --distribute [workers] [passes] [name] and the options of
+  // --render but --resume: --render split across worker processes on this
+  // machine
+  if (argc > 1 && strcmp(argv[1], "--distribute") == 0) {
+    FrameOptions options;
+    std::vector<const char *> args;
+    if (!parseFrameOptions(argc, argv, 2, options, args))
+      return 1;
+    IMG_Init(IMG_INIT_JPG);
+    const int workers = args.size() > 0 ? atoi(args[0]) : 2;
+    const int passes = args.size() > 1 ? atoi(args[1]) : 64;
+    const int result = runDistributed(workers > 0 ? workers : 2,
+                                      passes > 0 ? passes : 64,
+                                      args.size() > 2 ? args[2] : "render",
+                                      options);
+    IMG_Quit();
+    return result;
+  }
+
+  // joetracer --worker passes [options] worker workers: started by
+  // --distribute
+  if (argc > 1 && strcmp(argv[1], "--worker") == 0) {
+    FrameOptions options;
+    std::vector<const char *> args;
+    if (!parseFrameOptions(argc, argv, 2, options, args) || args.size() < 3 ||
+        atoi(args[2]) <= 0) {
+      printf("Usage: %s --worker passes [options] worker workers\n", argv[0]);
+      return 1;
+    }
+    return runWorker(atoi(args[0]), atoi(args[1]), atoi(args[2]), options);
+  }
+
+  // joetracer --denoise [passes] [reference.exr]: denoiser time and error,
+  // no window
+  if (argc > 1 && strcmp(argv[1], "--denoise") == 0) {
+    IMG_Init(IMG_INIT_JPG);
+    const int passes = argc > 2 ? atoi(argv[2]) : 4;
+    const int result =
+        runDenoise(passes > 0 ? passes : 4, argc > 3 ? argv[3] : nullptr);
+    IMG_Quit();
+    return result;
+  }
+
+  // joetracer --voxelize in.raw nx ny nz out.jtvol [threshold] [voxelSize]
+  if (argc > 1 && strcmp(argv[1], "--voxelize") == 0) {
+    if (argc < 7) {
+      printf("Usage: %s --voxelize in.raw nx ny nz out.jtvol [threshold] "
+             "[voxelSize]\n",
+             argv[0]);
+      return 1;
+    }
+    return runVoxelize(argv[2], atoi(argv[3]), atoi(argv[4]), atoi(argv[5]),
+                       argv[6], argc > 7 ? atof(argv[7]) : 0,
+                       argc > 8 ? atof(argv[8]) : 1);
+  }
+
+  // joetracer --compare test reference: differences between HDR images
+  if (argc > 1 && strcmp(argv[1], "--compare") == 0) {
+    if (argc < 4) {
+      printf("Usage: %s --compare test.exr reference.exr\n", argv[0]);
+      return 1;
+    }
+    return runCompare(argv[2], argv[3]);
+  }
+
   // Setup SDL
   if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_GAMECONTROLLER) !=
       0) {
@@ -220,24 +999,16 @@ int main(int argc, char **argv) {
   // Scene s = Scene(screenWidth, screenHeight,
   // PinholeCamera(screenWidth, screenHeight, 90.0f,
   // Point(x, y, z), Point(lx, ly, lz)),
-  // Point(clear_color.x * 255.0f, clear_color.y * 255.0f,
-  // clear_color.z * 255.0f));
+  // Point(clear_color.x, clear_color.y, clear_color.z));
 
   double *raw = new double[screenHeight * screenWidth * 3];
 
   Scene s = Scene(screenWidth, screenHeight,
                   PinholeCamera(screenWidth, screenHeight, 90.0f,
                                 Point(x, y, z), Point(lx, ly, lz)),
-                  Point(clear_color.x * 255.0f, clear_color.y * 255.0f,
-                        clear_color.z * 255.0f),
+                  Point(clear_color.x, clear_color.y, clear_color.z),
                   raw);
 
-  // RGB Array of pixels
-  unsigned char *pixels = new unsigned char[screenHeight * screenWidth * 3];
-
-  SDL_Surface *surface = NULL;
-  SDL_Texture *finalTexture = NULL;
-
   // Setup window
   SDL_WindowFlags window_flags =
       (SDL_WindowFlags)(SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI);
@@ -253,6 +1024,11 @@ int main(int argc, char **argv) {
     return -1;
   }
 
+  // Shows the accumulated image, converting only the rows that changed. Its
+  // texture has to go before the renderer.
+  std::unique_ptr<FrameDisplay> display(
+      new FrameDisplay(renderer, screenWidth, screenHeight));
+
   if (debug) {
     addCornellBox(s);
 
@@ -261,31 +1037,35 @@ int main(int argc, char **argv) {
 
     static float fov = 90.0f;
 
-    s.background = Point(clear_color.x * 255.0f, clear_color.y * 255.0f,
-                         clear_color.z * 255.0f);
+    s.background = Point(clear_color.x, clear_color.y, clear_color.z);
     s.newCamera(
         PinholeCamera(screenWidth, screenHeight, fov, location, lookingAt));
-    int sampleCount = 0;
     s.createBVHBox();
-    while (true) {
-      sampleCount++;
-      s.render();
-      for (int i = 0; i < screenHeight * screenWidth * 3; i++) {
-        pixels[i] =
-            ((s.raw[i] / sampleCount > 255) ? 255 : s.raw[i] / sampleCount);
-      }
-      surface = SDL_CreateRGBSurfaceFrom((void *)pixels, screenWidth,
-                                         screenHeight, 3 * 8, screenWidth * 3,
-                                         0x0000ff, 0x00ff00, 0xff0000, 0);
-      finalTexture = SDL_CreateTextureFromSurface(renderer, surface);
+    s.resetAccumulation();
+    s.memoryReport();
+
+    // Passes render on their own thread; this one only shows them, so the
+    // window keeps answering
+    std::unique_ptr<RenderService> service(new RenderService(s));
+    service->start();
+    bool quit = false;
+    while (!quit) {
+      SDL_Event event;
+      while (SDL_PollEvent(&event))
+        if (event.type == SDL_QUIT)
+          quit = true;
+      service->present(*display);
       SDL_RenderClear(renderer);
-      SDL_RenderCopy(renderer, finalTexture, NULL, NULL);
+      SDL_RenderCopy(renderer, display->texture(), NULL, NULL);
       SDL_RenderPresent(renderer);
-      SDL_FreeSurface(surface);
-      SDL_DestroyTexture(finalTexture); 
     }
+    service.reset();
 
-    SDL_SaveBMP(surface, "output.bmp");
+    saveOutput(s);
+    display.reset();
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
 
     return 0;
   }
@@ -307,6 +1087,10 @@ int main(int argc, char **argv) {
   ImGui_ImplSDL2_InitForSDLRenderer(window, renderer);
   ImGui_ImplSDLRenderer_Init(renderer);
 
+  // Renders in the background from here on. The scene is only changed
+  // through it, and only read while holding lockScene().
+  RenderService service(s);
+
   // Main loop
   bool quit = false;
 
@@ -332,21 +1116,43 @@ int main(int argc, char **argv) {
 
     {
       static float fov = 90.0f;
+      static int projection = CAMERA_PERSPECTIVE;
+      static float aperture = 0.0f;
+      static float focusDistance = 800.0f;
+      static float orthographicHeight = 600.0f;
+      // Whether dragging the camera around moves the image with it
+      static bool followCamera = true;
+      auto settingsCamera = [&]() {
+        PinholeCamera camera(screenWidth, screenHeight, fov, location,
+                             lookingAt);
+        camera.setProjection((CameraProjection)projection);
+        camera.setLens(aperture, focusDistance);
+        camera.setOrthographicHeight(orthographicHeight);
+        return camera;
+      };
       ImGui::Begin("Settings");
       if (ImGui::Button("Render",
                         ImVec2(ImGui::GetWindowWidth() - 15, 20.0f))) {
 
-        s.background = Point(clear_color.x * 255.0f, clear_color.y * 255.0f,
-                             clear_color.z * 255.0f);
-        s.newCamera(
-            PinholeCamera(screenWidth, screenHeight, fov, location, lookingAt));
-        // pixels = s.render();
-        surface = SDL_CreateRGBSurfaceFrom((void *)pixels, screenWidth,
-                                           screenHeight, 3 * 8, screenWidth * 3,
-                                           0x0000ff, 0x00ff00, 0xff0000, 0);
-        finalTexture = SDL_CreateTextureFromSurface(renderer, surface);
-        SDL_SaveBMP(surface, "output.bmp");
-        SDL_FreeSurface(surface);
+        const Point background(clear_color.x, clear_color.y,
+                               clear_color.z);
+        const bool rendered = service.rendering;
+        service.edit([=](Scene &s) {
+          // Keep the image of the last render before starting again
+          if (rendered)
+            saveOutput(s);
+          s.background = background;
+        });
+        service.setCamera(settingsCamera());
+        service.start();
+      }
+      if (service.rendering) {
+        ImGui::Text("%u passes, %.0f ms per pass, %d%% of this one",
+                    service.passes.load(),
+                    service.passMicroseconds.load() / 1000.0,
+                    100 * service.rows.load() / screenHeight);
+        if (ImGui::Button("Stop"))
+          service.stop();
       }
 
       ImGuiTabBarFlags tab_bar_flags = ImGuiTabBarFlags_None;
@@ -356,26 +1162,165 @@ int main(int argc, char **argv) {
           const float CAM_MAX = 1000.0f;
           const float FOV_MIN = 0.0f;
           const float FOV_MAX = 180.0f;
-          ImGui::DragScalarN("Location", ImGuiDataType_Float, &location, 3,
-                             0.05f, &CAM_MIN, &CAM_MAX, "%f");
-          ImGui::DragScalarN("Looking at", ImGuiDataType_Float, &lookingAt, 3,
-                             0.05f, &CAM_MIN, &CAM_MAX, "%f");
-          ImGui::DragScalar("FOV", ImGuiDataType_Float, &fov, 0.005f, &FOV_MIN,
-                            &FOV_MAX, "%f");
+          bool moved = false;
+          moved |= ImGui::DragScalarN("Location", ImGuiDataType_Float,
+                                      &location, 3, 0.05f, &CAM_MIN, &CAM_MAX,
+                                      "%f");
+          moved |= ImGui::DragScalarN("Looking at", ImGuiDataType_Float,
+                                      &lookingAt, 3, 0.05f, &CAM_MIN,
+                                      &CAM_MAX, "%f");
+          moved |= ImGui::DragScalar("FOV", ImGuiDataType_Float, &fov, 0.005f,
+                                     &FOV_MIN, &FOV_MAX, "%f");
+          moved |= ImGui::Combo("Projection", &projection,
+                                "Perspective\0Orthographic\0Panoramic\0");
+          moved |= ImGui::DragFloat("Aperture", &aperture, 0.1f, 0.0f, 100.0f,
+                                    "%f");
+          moved |= ImGui::DragFloat("Focus distance", &focusDistance, 1.0f,
+                                    0.01f, 10000.0f, "%f");
+          moved |= ImGui::DragFloat("Orthographic height", &orthographicHeight,
+                                    1.0f, 0.01f, 10000.0f, "%f");
+          ImGui::Checkbox("Follow while rendering", &followCamera);
+          // Previews at one sample per pixel while dragging, reusing what
+          // the last view accumulated
+          if (moved && followCamera && service.rendering)
+            service.moveCamera(settingsCamera());
           ImGui::EndTabItem();
         }
         if (ImGui::BeginTabItem("Render")) {
-          ImGui::DragInt("Samples", &s.samples, 0.5f, 0, 1000, "%d", 0);
-          ImGui::DragInt("Bounces", &s.bounces, 0.5f, 0, 20, "%d", 0);
+          // Copies of the scene's settings, sent to it when they change
+          static int samples = s.samples;
+          static int bounces = s.bounces;
+          static float shutter[2] = {(float)s.shutterOpen,
+                                     (float)s.shutterClose};
+          const bool changedSamples =
+              ImGui::DragInt("Samples", &samples, 0.5f, 0, 1000, "%d", 0);
+          const bool changedBounces =
+              ImGui::DragInt("Bounces", &bounces, 0.5f, 0, 20, "%d", 0);
+          // The BVH is refit to a new shutter
+          const bool changedShutter =
+              ImGui::DragFloat2("Shutter", shutter, 0.01f, 0.0f, 10.0f);
+          if (changedSamples || changedBounces || changedShutter) {
+            const int n = samples, depth = bounces;
+            const double open = shutter[0];
+            const double close = std::fmax(shutter[0], shutter[1]);
+            service.edit([=](Scene &s) {
+              // More samples per pass don't change what the image converges
+              // to. Fewer would go back over sample indices already taken,
+              // as a pass starts at passIndex * samples, so they reset it
+              // along with the rest.
+              if (n < s.samples || s.bounces != depth ||
+                  s.shutterOpen != open || s.shutterClose != close)
+                s.resetAccumulation();
+              s.samples = n;
+              s.bounces = depth;
+              s.shutterOpen = open;
+              s.shutterClose = close;
+            });
+          }
+
+          static FilmSettings film;
+          static int filter = film.filter;
+          bool filmChanged = ImGui::Combo(
+              "Filter", &filter, "Box\0Gaussian\0Mitchell\0Blackman-Harris\0");
+          if (filmChanged) {
+            film.filter = (FilterType)filter;
+            film.radius = defaultFilterRadius(film.filter);
+          }
+          filmChanged |= ImGui::DragFloat("Filter radius", &film.radius, 0.05f,
+                                          0.5f, 8.0f, "%.2f px");
+          filmChanged |= ImGui::Checkbox("Splat samples", &film.splat);
+          if (filmChanged) {
+            const FilmSettings next = film;
+            service.edit([next](Scene &s) {
+              s.film = next;
+              s.resetAccumulation();
+            });
+          }
+
+          static ToneSettings tone;
+          static int op = tone.op;
+          bool toneChanged = ImGui::DragFloat("Exposure", &tone.exposure, 0.05f,
+                                              -16.0f, 16.0f, "%.2f stops");
+          toneChanged |=
+              ImGui::Combo("Tonemap", &op, "Clamp\0Reinhard\0ACES filmic\0");
+          toneChanged |= ImGui::Checkbox("sRGB", &tone.srgb);
+          toneChanged |= ImGui::Checkbox("Dither", &tone.dither);
+          if (toneChanged) {
+            tone.op = (TonemapOperator)op;
+            service.setTone(tone);
+          }
+
+          static DenoiseSettings denoise;
+          bool denoiseChanged = ImGui::Checkbox("Denoise", &denoise.enabled);
+          if (denoise.enabled) {
+            denoiseChanged |= ImGui::SliderInt("Filter passes",
+                                               &denoise.iterations, 1, 8);
+            denoiseChanged |= ImGui::DragFloat(
+                "Colour sigma", &denoise.colourSigma, 0.05f, 0.1f, 64.0f);
+            ImGui::Text("%.1f ms to denoise",
+                        service.denoiseMicroseconds.load() / 1000.0);
+          }
+          if (denoiseChanged)
+            service.setDenoise(denoise);
+
+          // Written to output.exr alongside the image
+          static bool aovs[AOV_COUNT] = {};
+          bool aovsChanged = false;
+          if (ImGui::TreeNode("AOVs")) {
+            for (int p = 0; p < AOV_COUNT; p++)
+              aovsChanged |= ImGui::Checkbox(aovName((AovPass)p), &aovs[p]);
+            ImGui::TreePop();
+          }
+          if (aovsChanged) {
+            unsigned int mask = 0;
+            for (int p = 0; p < AOV_COUNT; p++)
+              if (aovs[p])
+                mask |= aovBit((AovPass)p);
+            service.edit([mask](Scene &s) { s.aovs = mask; });
+          }
           ImGui::EndTabItem();
         }
         if (ImGui::BeginTabItem("Scene")) {
+          // Edits are queued while the scene is read here
+          std::unique_lock<std::mutex> guard = service.lockScene();
+          // Material used by "Add Sphere", once one has been set
+          static MaterialChoice m;
+          static bool haveMaterial = false;
+          // Selected in the object list
+          static int selected = -1;
+          // Procedural textures of scenes added from now on are baked
+          static bool bake = false;
+          if (ImGui::Checkbox("Bake Procedural Textures", &bake)) {
+            const int resolution = bake ? BAKE_RESOLUTION : 0;
+            service.edit(
+                [resolution](Scene &s) { s.bakeResolution = resolution; });
+          }
           if (ImGui::Button("Add Sample Scene")) {
-            addSampleScene(s);
+            addScene(service, addSampleScene);
           }
           if (ImGui::Button("Add Cornell Box")) {
-            addCornellBox(s);
+            addScene(service, addCornellBox);
           }
+          if (ImGui::Button("Add Cornell Box With Fog")) {
+            addScene(service, addCornellFog);
+          }
+          if (ImGui::Button("Add Cornell Box With Smoke")) {
+            addScene(service, addCornellSmoke);
+          }
+          if (ImGui::Button("Add Cornell Box With Motion")) {
+            addScene(service, addCornellMotion);
+          }
+          if (ImGui::Button("Clear Scene")) {
+            service.edit([](Scene &s) {
+              s.deleteScene();
+              s.resetAccumulation();
+            });
+            haveMaterial = false;
+            selected = -1;
+          }
+          ImGui::Text("%zu objects, %zu allocations, %zu bytes",
+                      s.getObjects().size(), s.arena.allocations(),
+                      s.arena.bytesUsed());
 
           ImGui::Text("Add Sphere");
 
@@ -386,7 +1331,6 @@ int main(int argc, char **argv) {
           static float slocation[3] = {0, 0, 1};
           ImGui::Combo("Material Type", &currentMaterial,
                        "Metal\0Diffuse\0Dielectric\0\0");
-          Materials *m;
           static float fuzz = 0;
           static float rfidx = 1.3f;
           const float FUZZMAX = 1.0f;
@@ -417,21 +1361,68 @@ int main(int argc, char **argv) {
                              ImGuiSliderFlags_Logarithmic);
           ImGui::ColorEdit3("Sphere Colour##1", (float *)&colour);
           if (ImGui::Button("Add/Set New Material")) {
-            switch (currentMaterial) {
-            case (0): // Metal
-              m = new Metal(Point(colour.x, colour.y, colour.z), fuzz);
-              break;
-            case (1): // Diffuse
-              m = new Lambertian(Point(colour.x, colour.y, colour.z));
-              break;
-            case (2): // Dielectric
-              m = new Dielectrics(1);
-              break;
+            m = {currentMaterial, Point(colour.x, colour.y, colour.z), fuzz};
+            haveMaterial = true;
+          }
+          if (ImGui::Button("Add Sphere") && haveMaterial) {
+            // Made between passes, along with its material
+            const MaterialChoice material = m;
+            const float rad = radius;
+            const Point location(slocation[0], slocation[1], slocation[2]);
+            service.edit([=](Scene &s) {
+              Sphere *sphere =
+                  s.make<Sphere>(rad, location, makeMaterial(s, material));
+              s.addObject(sphere);
+              aabb box;
+              sphere->boundingBox(0, 0, box);
+              resetAround(s, box);
+            });
+          }
+
+          // Edits to the selected object only restart the part of the
+          // preview it covers
+          const std::vector<Hittable *> objects = s.getObjects();
+          if (selected >= (int)objects.size())
+            selected = -1;
+          if (ImGui::BeginListBox("Objects")) {
+            for (int i = 0; i < (int)objects.size(); i++) {
+              ImGui::PushID(i);
+              if (ImGui::Selectable(objectName(objects[i]), selected == i))
+                selected = i;
+              ImGui::PopID();
             }
+            ImGui::EndListBox();
           }
-          if (ImGui::Button("Add Sphere")) {
-            s.addObject(new Sphere(
-                radius, Point(slocation[0], slocation[1], slocation[2]), m));
+          if (selected >= 0) {
+            Hittable *o = objects[selected];
+            const int index = selected;
+            if (primitiveType(o) == PRIM_SPHERE) {
+              Sphere *sphere = static_cast<Sphere *>(o);
+              float centre[3] = {(float)sphere->location.x,
+                                 (float)sphere->location.y,
+                                 (float)sphere->location.z};
+              int rad = sphere->rad;
+              bool changed = ImGui::DragFloat3("Sphere Location", centre, 0.5f);
+              changed = ImGui::DragInt("Sphere Radius", &rad, 0.2f, 1, 1000) ||
+                        changed;
+              bool newMaterial = false;
+              if (ImGui::Button("Use Material") && haveMaterial) {
+                newMaterial = true;
+                changed = true;
+              }
+              if (changed) {
+                const Point location(centre[0], centre[1], centre[2]);
+                const MaterialChoice material = m;
+                service.edit([=](Scene &s) {
+                  editSphere(s, index, sphere, location, rad,
+                             newMaterial ? &material : nullptr);
+                });
+              }
+            }
+            if (ImGui::Button("Remove Object")) {
+              service.edit([=](Scene &s) { removeAt(s, index, o); });
+              selected = -1;
+            }
           }
           ImGui::ColorEdit3("Background", (float *)&clear_color);
 
@@ -443,10 +1434,13 @@ int main(int argc, char **argv) {
       ImGui::End();
     }
 
+    // Whatever the render thread finished last
+    service.present(*display);
+
     // Rendering
     ImGui::Render();
     SDL_RenderClear(renderer);
-    SDL_RenderCopy(renderer, finalTexture, NULL, NULL);
+    SDL_RenderCopy(renderer, display->texture(), NULL, NULL);
 
     ImGui_ImplSDLRenderer_RenderDrawData(ImGui::GetDrawData());
     SDL_RenderPresent(renderer);
@@ -457,6 +1451,7 @@ int main(int argc, char **argv) {
   ImGui_ImplSDL2_Shutdown();
   ImGui::DestroyContext();
 
+  display.reset();
   SDL_DestroyRenderer(renderer);
   SDL_DestroyWindow(window);
   SDL_Quit();